@@ -0,0 +1,49 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <chrono>
+#include <cstdio>
+#include "Network/WebSocket.hpp"
+#include "Utils/Sha1.hpp"
+
+template<typename F>
+static void bench(const char *name, unsigned iterations, F &&fct)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned i = 0; i < iterations; i++)
+		fct();
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+	printf("%-24s %10u iterations %10.1f ns/op\n", name, iterations, static_cast<double>(elapsed.count()) / iterations);
+}
+
+int main()
+{
+	Socket::HttpRequest request;
+	unsigned char digest[Sha1::digestSize];
+	const char key[] = "dGhlIHNhbXBsZSBub25jZQ==258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+	volatile unsigned char sink = 0;
+
+	request.method = "GET";
+	request.header["upgrade"] = "websocket";
+	request.header["connection"] = "Upgrade";
+	request.header["sec-websocket-key"] = "dGhlIHNhbXBsZSBub25jZQ==";
+
+	// Sanity check with the example from RFC 6455
+	if (WebSocket::solveHandshake(request).header["Sec-WebSocket-Accept"] != "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") {
+		puts("Invalid handshake answer");
+		return 1;
+	}
+	printf("SHA extensions: %s\n", Sha1::hasHardwareSupport() ? "yes" : "no");
+	bench("Sha1::hash", 1000000, [&]{
+		Sha1::hash(key, sizeof(key) - 1, digest);
+		sink = sink + digest[0];
+	});
+	bench("WebSocket::solveHandshake", 200000, [&]{
+		sink = sink + WebSocket::solveHandshake(request).returnCode;
+	});
+	return 0;
+}
@@ -0,0 +1,294 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "BattleSource.hpp"
+#include "State.hpp"
+
+//! @brief Gives the palettes and the scene the state json is built with.
+class FixedSource : public BattleSource {
+public:
+	unsigned char palettes[2] = {0, 0};
+	bool inBattle = true;
+
+	void capture(BattleSample &, bool) override {}
+	void getRounds(unsigned &left, unsigned &right) override { left = right = 0; }
+	bool isInBattle() override { return this->inBattle; }
+	unsigned char getPalette(bool left) override { return this->palettes[!left]; }
+};
+
+template<typename F>
+static void bench(const char *name, unsigned iterations, F &&fct)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned i = 0; i < iterations; i++)
+		fct();
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+	printf("%-32s %10u iterations %10.1f ns/op\n", name, iterations, static_cast<double>(elapsed.count()) / iterations);
+}
+
+// What the serialization used to be: copy the state and build a DOM.
+static nlohmann::json statsToDom(const Stats &stats)
+{
+	nlohmann::json result = {
+		{"doll",     stats.doll},
+		{"rod",      stats.rod},
+		{"grimoire", stats.grimoire},
+		{"fan",      stats.fan},
+		{"drops",    stats.drops},
+		{"special",  stats.specialValue}
+	};
+	std::map<std::string, unsigned char> skillMap;
+
+	for (int i = 0; i < 16; i++)
+		if (!stats.skillMap[i].notUsed)
+			skillMap[std::to_string(i)] = stats.skillMap[i].level;
+	result["skills"] = skillMap;
+	return result;
+}
+
+static void cardsToDom(nlohmann::json &result, const CachedMatchData &cache, bool left)
+{
+	auto &cards = left ? cache.leftCards : cache.rightCards;
+	auto &hand = left ? cache.leftHand : cache.rightHand;
+	auto &used = left ? cache.leftUsed : cache.rightUsed;
+
+	if (cache.cardsHidden) {
+		result["deck"] = std::vector<unsigned short>(cards.size() + hand.size(), 21);
+		result["hand"] = std::vector<unsigned short>();
+	} else {
+		result["deck"] = std::vector<unsigned short>(cards.begin(), cards.end());
+		result["hand"] = std::vector<unsigned short>(hand.begin(), hand.end());
+	}
+	result["used"] = std::vector<unsigned short>(used.begin(), used.end());
+}
+
+static nlohmann::json sideToDom(const CachedMatchData &cache, bool left)
+{
+	nlohmann::json result = {
+		{ "palette",   battleSource->getPalette(left) },
+		{ "character", left ? cache.left : cache.right },
+		{ "score",     left ? cache.leftScore : cache.rightScore },
+		{ "name",      (left ? cache.leftUtf8Name : cache.rightUtf8Name).c_str() },
+		{ "stats",     statsToDom(left ? cache.leftStats : cache.rightStats) }
+	};
+
+	cardsToDom(result, cache, left);
+	return result;
+}
+
+static std::string stateToDom(CachedMatchData cache)
+{
+	nlohmann::json result;
+
+	result["isPlaying"] = battleSource->isInBattle();
+	result["left"] = sideToDom(cache, true);
+	result["right"] = sideToDom(cache, false);
+	result["round"] = cache.round.c_str();
+	return result.dump(-1, ' ', true);
+}
+
+static std::string cardsToDom(CachedMatchData cache)
+{
+	nlohmann::json result;
+
+	cardsToDom(result["left"], cache, true);
+	cardsToDom(result["right"], cache, false);
+	return result.dump(-1, ' ', true);
+}
+
+static std::string sideCardsToDom(CachedMatchData cache, bool left)
+{
+	nlohmann::json result;
+
+	cardsToDom(result, cache, left);
+	return result.dump(-1, ' ', true);
+}
+
+static void sideDeltaToDom(nlohmann::json &patch, const CachedMatchData &cache, bool left)
+{
+	std::string side = left ? "left" : "right";
+	unsigned dirty = left ? cache.leftDirty : cache.rightDirty;
+	auto &stats = left ? cache.leftStats : cache.rightStats;
+	nlohmann::json cards;
+	auto replace = [&patch, &side](const char *field, const nlohmann::json &value){
+		patch.push_back({
+			{ "op",    "replace" },
+			{ "path",  "/" + side + "/" + field },
+			{ "value", value }
+		});
+	};
+
+	cardsToDom(cards, cache, left);
+	if (dirty & DIRTY_DECK || (cache.cardsHidden && dirty & DIRTY_HAND))
+		replace("deck", cards["deck"]);
+	if (dirty & DIRTY_HAND)
+		replace("hand", cards["hand"]);
+	if (dirty & DIRTY_USED)
+		replace("used", cards["used"]);
+	if (dirty & DIRTY_ROD)
+		replace("stats/rod", stats.rod);
+	if (dirty & DIRTY_DOLL)
+		replace("stats/doll", stats.doll);
+	if (dirty & DIRTY_GRIMOIRE)
+		replace("stats/grimoire", stats.grimoire);
+	if (dirty & DIRTY_FAN)
+		replace("stats/fan", stats.fan);
+	if (dirty & DIRTY_DROPS)
+		replace("stats/drops", stats.drops);
+	if (dirty & DIRTY_SPECIAL)
+		replace("stats/special", stats.specialValue);
+	if (dirty & DIRTY_SKILLS)
+		replace("stats/skills", statsToDom(stats)["skills"]);
+}
+
+static std::string deltaToDom(CachedMatchData cache)
+{
+	nlohmann::json patch = nlohmann::json::array();
+
+	sideDeltaToDom(patch, cache, true);
+	sideDeltaToDom(patch, cache, false);
+	return patch.dump(-1, ' ', true);
+}
+
+template<size_t N>
+static void randomString(std::mt19937 &random, FixedString<N> &result, const std::vector<const char *> &pieces)
+{
+	std::string str;
+
+	for (unsigned i = random() % 24; i; i--) {
+		std::string piece = pieces[random() % pieces.size()];
+
+		if (str.size() + piece.size() >= N)
+			break;
+		str += piece;
+	}
+	result = str.c_str();
+}
+
+static void randomCards(std::mt19937 &random, CardList &list, unsigned max)
+{
+	list.clear();
+	for (unsigned i = random() % (max + 1); i; i--)
+		list.push_back(random() % 300);
+	std::sort(list.begin(), list.end());
+}
+
+static void randomStats(std::mt19937 &random, Stats &stats)
+{
+	stats.rod = (random() % 100) / 8.f;
+	stats.doll = std::uniform_real_distribution<float>(0, 10)(random);
+	stats.grimoire = random() % 5;
+	stats.fan = random() % 5;
+	stats.drops = random() % 5;
+	for (auto &skill : stats.skillMap)
+		skill = {static_cast<unsigned char>(random() % 5), random() % 3 != 0};
+	stats.specialValue = random();
+}
+
+static CachedMatchData randomCache(std::mt19937 &random)
+{
+	// ASCII, escaped characters and Shift-JIS (博麗 霊夢, ｱ) for the names
+	static const std::vector<const char *> names = {"a", "Reimu", " ", "\"", "\\", "\t", "\x01", "\x7F", "/", "\x94\x8E", "\x97\xED", "\x96\xB2", "\xB1"};
+	// ASCII, escaped characters, 2, 3 and 4 bytes UTF-8 sequences for the round
+	static const std::vector<const char *> rounds = {"a", "Finals", " ", "\"", "\\", "\n", "\t", "\x01", "\x7F", "/", "\xC3\xA9", "\xE9\x9C\x8A", "\xF0\x9F\x8E\xB4"};
+	CachedMatchData cache{};
+	NameString name;
+
+	static_cast<FixedSource &>(*battleSource).palettes[0] = random() % 8;
+	static_cast<FixedSource &>(*battleSource).palettes[1] = random() % 8;
+	static_cast<FixedSource &>(*battleSource).inBattle = random() % 4 != 0;
+	cache.cardsHidden = random() % 4 == 0;
+	cache.left = random() % 20;
+	cache.right = random() % 20;
+	cache.leftScore = random() % 10;
+	cache.rightScore = random() % 10;
+	randomString(random, name, names);
+	setName(cache, true, name.c_str());
+	randomString(random, name, names);
+	setName(cache, false, name.c_str());
+	randomString(random, cache.round, rounds);
+	randomCards(random, cache.leftCards, 20);
+	randomCards(random, cache.rightCards, 20);
+	randomCards(random, cache.leftHand, 5);
+	randomCards(random, cache.rightHand, 5);
+	randomCards(random, cache.leftUsed, 20);
+	randomCards(random, cache.rightUsed, 20);
+	randomStats(random, cache.leftStats);
+	randomStats(random, cache.rightStats);
+	cache.leftDirty = random() & ((DIRTY_SKILLS << 1U) - 1);
+	cache.rightDirty = random() & ((DIRTY_SKILLS << 1U) - 1);
+	return cache;
+}
+
+static bool check(const char *name, const std::string &expected, const std::string &result)
+{
+	if (expected == result)
+		return true;
+	printf("%s output mismatch:\n%s\n%s\n", name, expected.c_str(), result.c_str());
+	return false;
+}
+
+int main()
+{
+	std::mt19937 random{42};
+	std::vector<CachedMatchData> caches;
+	volatile size_t sink = 0;
+
+	battleSource = std::make_unique<FixedSource>();
+	// Compares the real serializers with the DOM on random states, the palettes and the scene included.
+	for (int i = 0; i < 10000; i++) {
+		auto cache = randomCache(random);
+
+		if (
+			!check("cacheToJson", stateToDom(cache), cacheToJson(cache)) ||
+			!check("generateCardsJson", cardsToDom(cache), generateCardsJson(cache)) ||
+			!check("generateLeftCardsJson", sideCardsToDom(cache, true), generateLeftCardsJson(cache)) ||
+			!check("generateRightCardsJson", sideCardsToDom(cache, false), generateRightCardsJson(cache)) ||
+			!check("generateStatsJson", statsToDom(cache.leftStats).dump(-1, ' ', true), generateStatsJson(cache.leftStats)) ||
+			!check("generateDeltaJson", deltaToDom(cache), generateDeltaJson(cache))
+		)
+			return 1;
+		if (i < 64)
+			caches.push_back(cache);
+	}
+
+	unsigned i = 0;
+
+	bench("nlohmann::json/state", 100000, [&]{
+		sink = sink + stateToDom(caches[i++ % caches.size()]).size();
+	});
+	bench("cacheToJson", 100000, [&]{
+		sink = sink + cacheToJson(caches[i++ % caches.size()]).size();
+	});
+	bench("nlohmann::json/cards", 100000, [&]{
+		sink = sink + cardsToDom(caches[i++ % caches.size()]).size();
+	});
+	bench("generateCardsJson", 100000, [&]{
+		sink = sink + generateCardsJson(caches[i++ % caches.size()]).size();
+	});
+	bench("nlohmann::json/stats", 100000, [&]{
+		sink = sink + statsToDom(caches[i++ % caches.size()].leftStats).dump(-1, ' ', true).size();
+	});
+	bench("generateStatsJson", 100000, [&]{
+		sink = sink + generateStatsJson(caches[i++ % caches.size()].leftStats).size();
+	});
+	bench("nlohmann::json/delta", 100000, [&]{
+		sink = sink + deltaToDom(caches[i++ % caches.size()]).size();
+	});
+	bench("generateDeltaJson", 100000, [&]{
+		sink = sink + generateDeltaJson(caches[i++ % caches.size()]).size();
+	});
+	battleSource.reset();
+	return 0;
+}
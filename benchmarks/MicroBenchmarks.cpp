@@ -0,0 +1,421 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include "nlohmann/json.hpp"
+#include "Network/WebServer.hpp"
+#include "Network/base64.hpp"
+#include "Utils/ShiftJISDecoder.hpp"
+#include "Exceptions.hpp"
+#include "State.hpp"
+
+struct Options {
+	std::string filter;
+	std::string output;
+	std::string baseline;
+	double threshold = 10;
+	unsigned samples = 5;
+	unsigned sampleTime = 100;
+};
+
+struct Result {
+	std::string name;
+	unsigned long long iterations;
+	//! Median of the samples
+	double nsPerOp;
+	double min;
+	double max;
+};
+
+//! @brief Serves a canned request instead of reading a socket.
+class MemorySocket : public Socket {
+private:
+	std::string _data;
+	size_t _pos = 0;
+
+protected:
+	void _wait(timeval *) override
+	{
+		if (this->_pos >= this->_data.size())
+			throw EOFException("End of file");
+	}
+
+	size_t _read(char *buffer, size_t size) override
+	{
+		size = this->_data.copy(buffer, size, this->_pos);
+		this->_pos += size;
+		return size;
+	}
+
+public:
+	void reset(const std::string &data)
+	{
+		this->_data = data;
+		this->_pos = 0;
+		this->_buffer.release();
+		this->_bufferStart = 0;
+	}
+};
+
+static volatile size_t sink = 0;
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options]\n", name);
+	puts("Times the network and serialization hot paths, the results are written as json.");
+	puts("  --filter <text>        Only run the benchmarks whose name contains this text");
+	puts("  --output <file>        Write the results to a file instead of the standard output");
+	puts("  --baseline <file>      Compare with the results of a previous run, fails if a benchmark got slower than the threshold");
+	puts("  --threshold <percent>  Slowdown tolerated by --baseline (default 10)");
+	puts("  --samples <n>          Number of timed runs of each benchmark, the median is kept (default 5)");
+	puts("  --sample-time <ms>     Minimum duration of a timed run (default 100)");
+}
+
+static bool parseOptions(int argc, char **argv, Options &options)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto next = [&]() -> const char * {
+			if (i + 1 >= argc)
+				throw std::invalid_argument(arg + " needs a value");
+			return argv[++i];
+		};
+
+		if (arg == "--filter")
+			options.filter = next();
+		else if (arg == "--output")
+			options.output = next();
+		else if (arg == "--baseline")
+			options.baseline = next();
+		else if (arg == "--threshold")
+			options.threshold = std::stod(next());
+		else if (arg == "--samples")
+			options.samples = (std::max)(1UL, std::stoul(next()));
+		else if (arg == "--sample-time")
+			options.sampleTime = std::stoul(next());
+		else
+			return false;
+	}
+	return true;
+}
+
+template<typename F>
+static double run(unsigned long long iterations, F &fct)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned long long i = 0; i < iterations; i++)
+		fct();
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+template<typename F>
+static void bench(const Options &options, std::vector<Result> &results, const std::string &name, F &&fct)
+{
+	if (name.find(options.filter) == std::string::npos)
+		return;
+
+	double target = options.sampleTime * 1e6;
+	unsigned long long iterations = 1;
+	double elapsed = run(iterations, fct);
+	std::vector<double> samples;
+
+	// Grow the runs until they are long enough for the clock, then size them to the sample time
+	while (elapsed < target / 10) {
+		iterations *= 2;
+		elapsed = run(iterations, fct);
+	}
+	iterations = (std::max)(1ULL, static_cast<unsigned long long>(iterations * target / elapsed));
+	for (unsigned i = 0; i < options.samples; i++)
+		samples.push_back(run(iterations, fct) / iterations);
+	std::sort(samples.begin(), samples.end());
+	results.push_back({name, iterations, samples[samples.size() / 2], samples.front(), samples.back()});
+	fprintf(stderr, "%-48s %12llu iterations %12.1f ns/op\n", name.c_str(), iterations, results.back().nsPerOp);
+}
+
+static void benchHttp(const Options &options, std::vector<Result> &results)
+{
+	static const std::pair<const char *, std::string> requests[] = {
+		{"get", "GET /state HTTP/1.1\r\nHost: localhost\r\n\r\n"},
+		{"browser",
+			"GET /static/html/overlay.html HTTP/1.1\r\n"
+			"Host: 127.0.0.1:80\r\n"
+			"Connection: keep-alive\r\n"
+			"Cache-Control: max-age=0\r\n"
+			"Upgrade-Insecure-Requests: 1\r\n"
+			"User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) obs-browser/2.21.1 Chrome/103.0.5060.134 Safari/537.36\r\n"
+			"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+			"Accept-Encoding: gzip, deflate, br\r\n"
+			"Accept-Language: en-US,en;q=0.9\r\n"
+			"If-Modified-Since: Mon, 19 Oct 2026 12:00:00 GMT\r\n"
+			"\r\n"
+		},
+		{"upgrade",
+			"GET /chat HTTP/1.1\r\n"
+			"Host: 127.0.0.1:80\r\n"
+			"Upgrade: websocket\r\n"
+			"Connection: Upgrade\r\n"
+			"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+			"Sec-WebSocket-Version: 13\r\n"
+			"Origin: http://127.0.0.1\r\n"
+			"\r\n"
+		},
+		{"post",
+			"POST /state HTTP/1.1\r\n"
+			"Host: 127.0.0.1:80\r\n"
+			"Content-Type: application/json\r\n"
+			"Content-Length: 71\r\n"
+			"\r\n"
+			"{\"left\":{\"name\":\"Reimu\",\"score\":2},\"right\":{\"name\":\"Marisa\",\"score\":1}}"
+		},
+	};
+	static const char *paths[][2] = {
+		{"simple", "/state"},
+		{"query", "/history/12?from=100&to=20000"},
+		{"encoded", "/static/%E9%9C%8A%E5%A4%A2/overlay%20v2.html?scene=main+stage&debug"},
+	};
+	MemorySocket socket;
+
+	for (auto &request : requests)
+		bench(options, results, std::string("Socket::readHttpRequest/") + request.first, [&]{
+			socket.reset(request.second);
+			sink = sink + socket.readHttpRequest().header.size();
+		});
+	for (auto &path : paths) {
+		Socket::HttpRequest request;
+
+		request.path = path[1];
+		bench(options, results, std::string("WebServer::parsePath/") + path[0], [&]{
+			request.query.clear();
+			WebServer::parsePath(request);
+			sink = sink + request.realPath.size();
+		});
+	}
+	bench(options, results, "WebServer::decodeURIComponent", [&]{
+		sink = sink + WebServer::decodeURIComponent("%E5%8D%9A%E9%BA%97%20%E9%9C%8A%E5%A4%A2+vs+%E9%9C%A7%E9%9B%A8%20%E9%AD%94%E7%90%86%E6%B2%99").size();
+	});
+}
+
+static void benchWebSocket(const Options &options, std::vector<Result> &results)
+{
+	int fds[2];
+	sockaddr_in addr{};
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		perror("socketpair");
+		return;
+	}
+
+	// Same as the server: it doesn't mask what it sends, the clients do
+	WebSocket server{Socket(fds[0], addr)};
+	WebSocket client{Socket(fds[1], addr)};
+
+	server.needsMask(false);
+	for (auto size : {64U, 2048U, 32768U, 131072U}) {
+		std::string message(size, 'a');
+		auto suffix = "/" + std::to_string(size) + "B";
+
+		server.send(message);
+		client.send(message);
+		if (client.getAnswer() != message || server.getAnswer() != message) {
+			puts("WebSocket round trip mismatch");
+			exit(1);
+		}
+		bench(options, results, "WebSocket::send+getAnswer/unmasked" + suffix, [&]{
+			server.send(message);
+			sink = sink + client.getAnswer().size();
+		});
+		bench(options, results, "WebSocket::send+getAnswer/masked" + suffix, [&]{
+			client.send(message);
+			sink = sink + server.getAnswer().size();
+		});
+	}
+}
+
+static void fillCards(CardList &list, unsigned character, unsigned count, unsigned seed)
+{
+	list.clear();
+	for (unsigned i = 0; i < count; i++)
+		// Mostly the character's own cards, with a few system cards
+		list.push_back(i % 4 == 0 ? (seed + i) % 21 : 100 + character * 100 + (seed + i * 7) % 20);
+	std::sort(list.begin(), list.end());
+}
+
+static void benchState(const Options &options, std::vector<Result> &results)
+{
+	CachedMatchData cache{};
+
+	cache.left = 0;
+	cache.right = 1;
+	setName(cache, true, "Reimu player");
+	// 霧雨 魔理沙
+	setName(cache, false, "\x96\xB6\x89\x4A \x96\x82\x97\x9D\x8D\xB2");
+	cache.round = "Winners finals";
+	cache.leftScore = 2;
+	cache.rightScore = 1;
+	// Middle of a round: part of the deck drawn, a full hand and a few cards used
+	fillCards(cache.leftCards, 0, 12, 3);
+	fillCards(cache.rightCards, 1, 10, 5);
+	fillCards(cache.leftHand, 0, 5, 7);
+	fillCards(cache.rightHand, 1, 4, 11);
+	fillCards(cache.leftUsed, 0, 3, 13);
+	fillCards(cache.rightUsed, 1, 6, 17);
+	for (auto stats : {&cache.leftStats, &cache.rightStats}) {
+		stats->rod = 1.5;
+		stats->doll = 2;
+		stats->grimoire = 1;
+		stats->fan = 0;
+		stats->drops = 3;
+		stats->specialValue = 0;
+		for (unsigned i = 0; i < 16; i++)
+			stats->skillMap[i] = {static_cast<unsigned char>(i % 3), i >= 4};
+	}
+	if (nlohmann::json::parse(cacheToJson(cache))["left"]["deck"].size() != 12) {
+		puts("Invalid state json");
+		exit(1);
+	}
+	bench(options, results, "cacheToJson", [&]{
+		sink = sink + cacheToJson(cache).size();
+	});
+	bench(options, results, "generateCardsJson", [&]{
+		sink = sink + generateCardsJson(cache).size();
+	});
+	cache.cardsHidden = true;
+	bench(options, results, "cacheToJson/hidden", [&]{
+		sink = sink + cacheToJson(cache).size();
+	});
+}
+
+static void benchStrings(const Options &options, std::vector<Result> &results)
+{
+	static const char *names[][2] = {
+		{"ascii", "Reimu player 123"},
+		// 博麗 霊夢
+		{"japanese", "\x94\x8E\x97\xED \x97\xEC\x96\xB2"},
+		// Profile name with half width katakana, full width letters and ASCII
+		{"mixed", "\xB1\xB2\xB3 \x82\x60\x82\x61\x82\x62 player \x97\xEC\x96\xB2 (2)"},
+		// Round names are longer, and mostly ASCII
+		{"long", "Grand finals - Reimu player 123 vs Marisa player 456 \x97\xEC\x96\xB2 (set 2)"},
+	};
+	std::vector<unsigned char> blobs[] = {
+		std::vector<unsigned char>(20),
+		std::vector<unsigned char>(1024),
+		std::vector<unsigned char>(65536),
+	};
+
+	if (convertShiftJisToUTF8(names[1][1]) != "\xE5\x8D\x9A\xE9\xBA\x97 \xE9\x9C\x8A\xE5\xA4\xA2") {
+		puts("Invalid Shift-JIS conversion");
+		exit(1);
+	}
+	for (auto &name : names)
+		bench(options, results, std::string("convertShiftJisToUTF8/") + name[0], [&]{
+			sink = sink + convertShiftJisToUTF8(name[1]).size();
+		});
+	if (base64::encode(reinterpret_cast<const unsigned char *>("foobar"), 6) != "Zm9vYmFy") {
+		puts("Invalid base64 encoding");
+		exit(1);
+	}
+	for (auto &blob : blobs) {
+		for (size_t i = 0; i < blob.size(); i++)
+			blob[i] = i * 31 + 7;
+		bench(options, results, "base64::encode/" + std::to_string(blob.size()) + "B", [&]{
+			sink = sink + base64::encode(blob.data(), blob.size()).size();
+		});
+	}
+}
+
+//! @return false if a benchmark got slower than the threshold
+static bool compare(const Options &options, const nlohmann::json &baseline, nlohmann::json &report)
+{
+	bool ok = true;
+	auto &benchmarks = baseline.at("benchmarks");
+
+	fprintf(stderr, "\nCompared to %s\n%-48s %12s %12s %8s\n", options.baseline.c_str(), "Benchmark", "Baseline", "Current", "Change");
+	for (auto &entry : report["benchmarks"].items()) {
+		auto it = benchmarks.find(entry.key());
+
+		if (it == benchmarks.end())
+			continue;
+
+		double before = it->at("nsPerOp");
+		double after = entry.value()["nsPerOp"];
+		double change = (after - before) * 100 / before;
+		bool regressed = change > options.threshold;
+
+		entry.value()["baseline"] = before;
+		entry.value()["change"] = change;
+		entry.value()["regressed"] = regressed;
+		ok &= !regressed;
+		fprintf(stderr, "%-48s %12.1f %12.1f %+7.1f%%%s\n", entry.key().c_str(), before, after, change, regressed ? " REGRESSED" : "");
+	}
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	nlohmann::json baseline;
+
+	try {
+		if (!parseOptions(argc, argv, options)) {
+			usage(argv[0]);
+			return 1;
+		}
+		if (!options.baseline.empty()) {
+			std::ifstream stream{options.baseline};
+
+			if (!stream)
+				throw std::invalid_argument("Cannot open " + options.baseline);
+			baseline = nlohmann::json::parse(stream);
+		}
+	} catch (std::exception &e) {
+		printf("%s\n", e.what());
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::vector<Result> results;
+	nlohmann::json report = {{"benchmarks", nlohmann::json::object()}};
+
+	benchHttp(options, results);
+	benchWebSocket(options, results);
+	benchState(options, results);
+	benchStrings(options, results);
+	for (auto &result : results)
+		report["benchmarks"][result.name] = {
+			{"iterations", result.iterations},
+			{"nsPerOp",    result.nsPerOp},
+			{"min",        result.min},
+			{"max",        result.max}
+		};
+
+	bool ok = true;
+
+	if (!baseline.is_null()) {
+		try {
+			ok = compare(options, baseline, report);
+		} catch (nlohmann::detail::exception &e) {
+			printf("Invalid baseline: %s\n", e.what());
+			return 1;
+		}
+	}
+	if (options.output.empty())
+		printf("%s\n", report.dump(4).c_str());
+	else {
+		std::ofstream stream{options.output};
+
+		if (!stream) {
+			printf("Cannot open %s\n", options.output.c_str());
+			return 1;
+		}
+		stream << report.dump(4) << std::endl;
+	}
+	return ok ? 0 : 2;
+}
@@ -0,0 +1,345 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <algorithm>
+#include <chrono>
+#include "Aggregator.hpp"
+#include "Logger.hpp"
+#include "Network/Handlers.hpp"
+#include "Trace.hpp"
+
+std::unique_ptr<Aggregator> aggregator;
+
+Aggregator::Aggregator(WebServer &server, unsigned queueSize, unsigned reconnectDelay) :
+	_queueSize(queueSize),
+	_reconnectDelay(reconnectDelay),
+	_server(server)
+{
+}
+
+Aggregator::~Aggregator()
+{
+	this->stop();
+}
+
+void Aggregator::addUpstream(const std::string &id, const std::string &host, unsigned short port)
+{
+	auto upstream = std::make_unique<Upstream>();
+
+	LOG_INFO("Adding upstream setup %s -> %s:%u", id.c_str(), host.c_str(), port);
+	upstream->id = id;
+	upstream->host = host;
+	upstream->port = port;
+	this->_upstreams[id] = std::move(upstream);
+}
+
+void Aggregator::start()
+{
+	this->_closed = false;
+	for (auto &[id, upstream] : this->_upstreams) {
+		auto ptr = upstream.get();
+
+		upstream->thread = std::thread([this, ptr]{
+			Trace::nameThread("Upstream " + ptr->id);
+			this->_upstreamLoop(*ptr);
+		});
+	}
+	this->_dispatchThread = std::thread([this]{
+		Trace::nameThread("Aggregator dispatch");
+		this->_dispatchLoop();
+	});
+	Metrics::addCollector("sokustreaming_aggregator_queue_depth", "Messages waiting to be forwarded, by setup.", Metrics::GAUGE, [this]{
+		return this->_collect([](const Upstream &upstream){ return upstream.queue.size(); });
+	});
+	Metrics::addCollector("sokustreaming_aggregator_dropped_total", "Times the queue of a setup overflowed and was replaced by a full state.", Metrics::COUNTER, [this]{
+		return this->_collect([](const Upstream &upstream){ return upstream.dropped; });
+	});
+	Metrics::addCollector("sokustreaming_aggregator_connected", "Whether a setup is connected.", Metrics::GAUGE, [this]{
+		return this->_collect([](const Upstream &upstream){ return upstream.connected; });
+	});
+}
+
+Metrics::Samples Aggregator::_collect(const std::function<double (const Upstream &upstream)> &value)
+{
+	Metrics::Samples result;
+
+	for (auto &[id, upstream] : this->_upstreams) {
+		std::lock_guard<std::mutex> lock{upstream->mutex};
+
+		result.emplace_back(Metrics::label("setup", id), value(*upstream));
+	}
+	return result;
+}
+
+void Aggregator::stop()
+{
+	Metrics::removeCollector("sokustreaming_aggregator_queue_depth");
+	Metrics::removeCollector("sokustreaming_aggregator_dropped_total");
+	Metrics::removeCollector("sokustreaming_aggregator_connected");
+	this->_dispatchMutex.lock();
+	this->_closed = true;
+	this->_dispatchMutex.unlock();
+	this->_dispatchCond.notify_all();
+	for (auto &[id, upstream] : this->_upstreams) {
+		upstream->mutex.lock();
+		if (upstream->sock)
+			upstream->sock->disconnect();
+		upstream->mutex.unlock();
+		if (upstream->thread.joinable())
+			upstream->thread.join();
+	}
+	if (this->_dispatchThread.joinable())
+		this->_dispatchThread.join();
+}
+
+void Aggregator::_upstreamLoop(Upstream &upstream)
+{
+	while (!this->_closed) {
+		WebSocket sock;
+
+		try {
+			upstream.mutex.lock();
+			upstream.sock = &sock;
+			upstream.mutex.unlock();
+			// Looked up again on each attempt, the setup may have moved.
+			// resolve can run in all the upstream threads at once, unlike gethostbyname.
+			sock.connect(Socket::resolve(upstream.host), upstream.port, upstream.host);
+			// Deltas are smaller than the per-side updates
+			sock.send("{\"deltas\": true}");
+			LOG_INFO("Connected to upstream setup %s", upstream.id.c_str());
+			upstream.mutex.lock();
+			upstream.connected = true;
+			upstream.mutex.unlock();
+			while (!this->_closed)
+				this->_onUpstreamMessage(upstream, sock.getAnswer());
+		} catch (std::exception &e) {
+			LOG_WARNING("Upstream setup %s: %s", upstream.id.c_str(), e.what());
+		}
+		upstream.mutex.lock();
+		upstream.sock = nullptr;
+		upstream.connected = false;
+		upstream.mutex.unlock();
+		sock.disconnect();
+
+		std::unique_lock<std::mutex> lock{this->_dispatchMutex};
+
+		this->_dispatchCond.wait_for(lock, std::chrono::milliseconds(this->_reconnectDelay), [this]{
+			return this->_closed.load();
+		});
+	}
+}
+
+void Aggregator::_onUpstreamMessage(Upstream &upstream, const std::string &msg)
+{
+	nlohmann::json json;
+
+	try {
+		json = nlohmann::json::parse(msg);
+	} catch (nlohmann::detail::exception &) {
+		return;
+	}
+	if (json.is_array()) {
+		// Batch of events from a single frame
+		for (auto &event : json)
+			this->_onUpstreamMessage(upstream, event.dump());
+		return;
+	}
+	if (!json.is_object() || !json.contains("o") || !json["o"].is_number())
+		return;
+
+	auto &data = json["d"];
+	int op = json["o"];
+	std::unique_lock<std::mutex> lock{upstream.mutex};
+
+	try {
+		switch (op) {
+		case STATE_UPDATE:
+			upstream.state = data;
+			break;
+		case CARDS_UPDATE:
+			for (auto side : {"left", "right"})
+				for (auto field : {"used", "deck", "hand"})
+					upstream.state[side][field] = data[side][field];
+			break;
+		case L_SCORE_UPDATE:
+			upstream.state["left"]["score"] = data;
+			break;
+		case R_SCORE_UPDATE:
+			upstream.state["right"]["score"] = data;
+			break;
+		case L_CARDS_UPDATE:
+		case R_CARDS_UPDATE:
+			for (auto field : {"used", "deck", "hand"})
+				upstream.state[op == L_CARDS_UPDATE ? "left" : "right"][field] = data[field];
+			break;
+		case L_NAME_UPDATE:
+			upstream.state["left"]["name"] = data;
+			break;
+		case R_NAME_UPDATE:
+			upstream.state["right"]["name"] = data;
+			break;
+		case L_STATS_UPDATE:
+			upstream.state["left"]["stats"] = data;
+			break;
+		case R_STATS_UPDATE:
+			upstream.state["right"]["stats"] = data;
+			break;
+		case STATE_DELTA:
+			upstream.state = upstream.state.patch(data);
+			break;
+		case GAME_STARTED:
+			upstream.state["isPlaying"] = true;
+			break;
+		case GAME_ENDED:
+			upstream.state["isPlaying"] = false;
+			break;
+		}
+	} catch (nlohmann::detail::exception &) {
+		// The upstream sent something we don't understand, so our view may be wrong.
+		// Ask the followers to drop their incremental updates in favor of a snapshot.
+		upstream.queue.clear();
+		upstream.resync = true;
+	}
+
+	if (upstream.resync)
+		// A snapshot is already pending, it will contain this change too.
+		;
+	else if (upstream.queue.size() >= this->_queueSize) {
+		// The followers can't keep up with this upstream.
+		// Rather than blocking the reader, drop everything and send a fresh snapshot once they caught up.
+		upstream.queue.clear();
+		upstream.resync = true;
+		upstream.dropped++;
+	} else
+		upstream.queue.emplace_back(Aggregator::_tag(upstream.id, msg));
+	lock.unlock();
+
+	// Taking the dispatch lock makes sure the dispatcher is either waiting or about to check the queues again.
+	this->_dispatchMutex.lock();
+	this->_dispatchMutex.unlock();
+	this->_dispatchCond.notify_all();
+}
+
+void Aggregator::_dispatchLoop()
+{
+	std::vector<std::string> pending;
+
+	while (true) {
+		std::unique_lock<std::mutex> lock{this->_dispatchMutex};
+
+		this->_dispatchCond.wait(lock, [this]{
+			if (this->_closed)
+				return true;
+			for (auto &[id, upstream] : this->_upstreams) {
+				std::lock_guard<std::mutex> upstreamLock{upstream->mutex};
+
+				if (upstream->resync || !upstream->queue.empty())
+					return true;
+			}
+			return false;
+		});
+		if (this->_closed)
+			return;
+		lock.unlock();
+
+		// Handle one batch per upstream in turn so a chatty setup can't starve the others.
+		for (auto &[id, upstream] : this->_upstreams) {
+			upstream->mutex.lock();
+			pending.clear();
+			if (upstream->resync) {
+				pending.push_back(Aggregator::_tag(id, "{\"o\": " + std::to_string(STATE_UPDATE) + ",\"d\": " + upstream->state.dump() + "}"));
+				upstream->resync = false;
+			} else
+				pending.assign(upstream->queue.begin(), upstream->queue.end());
+			upstream->queue.clear();
+			upstream->mutex.unlock();
+			for (auto &msg : pending)
+				this->_forward(id, msg);
+		}
+	}
+}
+
+void Aggregator::_forward(const std::string &id, const std::string &msg)
+{
+	this->_server.broadcast(msg, [this, &id](WebSocket &sock){
+		std::lock_guard<std::mutex> lock{this->_followersMutex};
+		auto it = this->_followers.find(&sock);
+
+		return it != this->_followers.end() && (it->second.count(id) || it->second.count("*"));
+	});
+}
+
+std::string Aggregator::_tag(const std::string &id, const std::string &msg)
+{
+	// Upstream events are all json objects so we can just add the setup id in front.
+	return "{\"s\": " + nlohmann::json(id).dump() + "," + msg.substr(1);
+}
+
+void Aggregator::follow(WebSocket &sock, const std::vector<std::string> &ids)
+{
+	std::vector<std::string> snapshots;
+
+	this->_followersMutex.lock();
+	for (auto &id : ids)
+		this->_followers[&sock].insert(id);
+	this->_followersMutex.unlock();
+
+	for (auto &[id, upstream] : this->_upstreams) {
+		if (std::find(ids.begin(), ids.end(), id) == ids.end() && std::find(ids.begin(), ids.end(), "*") == ids.end())
+			continue;
+
+		std::lock_guard<std::mutex> lock{upstream->mutex};
+
+		if (!upstream->state.is_null())
+			snapshots.push_back(Aggregator::_tag(id, "{\"o\": " + std::to_string(STATE_UPDATE) + ",\"d\": " + upstream->state.dump() + "}"));
+	}
+	for (auto &snapshot : snapshots)
+		sock.send(snapshot);
+}
+
+void Aggregator::unfollow(WebSocket &sock, const std::vector<std::string> &ids)
+{
+	std::lock_guard<std::mutex> lock{this->_followersMutex};
+	auto it = this->_followers.find(&sock);
+
+	if (it == this->_followers.end())
+		return;
+	for (auto &id : ids)
+		it->second.erase(id);
+	if (it->second.empty())
+		this->_followers.erase(it);
+}
+
+void Aggregator::forget(WebSocket &sock)
+{
+	std::lock_guard<std::mutex> lock{this->_followersMutex};
+
+	this->_followers.erase(&sock);
+}
+
+nlohmann::json Aggregator::getSetups()
+{
+	nlohmann::json result = nlohmann::json::object();
+
+	for (auto &[id, upstream] : this->_upstreams) {
+		std::lock_guard<std::mutex> lock{upstream->mutex};
+
+		result[id] = {
+			{"host",      upstream->host},
+			{"port",      upstream->port},
+			{"connected", upstream->connected},
+			{"queued",    upstream->queue.size()},
+			{"dropped",   upstream->dropped}
+		};
+	}
+	return result;
+}
+
+nlohmann::json Aggregator::getState(const std::string &id)
+{
+	auto &upstream = this->_upstreams.at(id);
+	std::lock_guard<std::mutex> lock{upstream->mutex};
+
+	return upstream->state;
+}
@@ -0,0 +1,88 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_AGGREGATOR_HPP
+#define SWRSTOYS_AGGREGATOR_HPP
+
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include "Network/WebServer.hpp"
+#include "Memory.hpp"
+#include "Metrics.hpp"
+#include "nlohmann/json.hpp"
+
+//! @brief Follows several upstream SokuStreaming instances and
+//! exposes a merged view of their states, indexed by setup id.
+class Aggregator {
+private:
+	struct Upstream {
+		std::string id;
+		std::string host;
+		unsigned short port;
+		bool connected = false;
+		bool resync = false;
+		unsigned dropped = 0;
+		nlohmann::json state;
+		//! Messages received from the upstream that still need to be forwarded, already tagged with the setup id.
+		std::deque<Memory::String<Memory::TAG_WEBSOCKET>, Memory::Allocator<Memory::String<Memory::TAG_WEBSOCKET>, Memory::TAG_WEBSOCKET>> queue;
+		std::mutex mutex;
+		std::thread thread;
+		WebSocket *sock = nullptr;
+	};
+
+	std::atomic<bool> _closed{false};
+	unsigned _queueSize;
+	unsigned _reconnectDelay;
+	WebServer &_server;
+	std::thread _dispatchThread;
+	std::mutex _dispatchMutex;
+	std::condition_variable _dispatchCond;
+	std::map<std::string, std::unique_ptr<Upstream>> _upstreams;
+	std::mutex _followersMutex;
+	std::map<WebSocket *, std::set<std::string>> _followers;
+
+	void _upstreamLoop(Upstream &upstream);
+	void _onUpstreamMessage(Upstream &upstream, const std::string &msg);
+	void _dispatchLoop();
+	void _forward(const std::string &id, const std::string &msg);
+	static std::string _tag(const std::string &id, const std::string &msg);
+	//! @brief Read a value of each upstream, labelled with its setup id.
+	Metrics::Samples _collect(const std::function<double (const Upstream &upstream)> &value);
+
+public:
+	//! @param server The server used to forward the upstream messages.
+	//! @param queueSize Maximum number of pending messages per upstream before they are dropped in favor of a full resync.
+	//! @param reconnectDelay Delay in milliseconds before reconnecting to a lost upstream.
+	Aggregator(WebServer &server, unsigned queueSize, unsigned reconnectDelay);
+	~Aggregator();
+
+	//! @brief Register a new upstream. Must be called before start.
+	void addUpstream(const std::string &id, const std::string &host, unsigned short port);
+	void start();
+	void stop();
+
+	//! @brief Subscribe a client to the given setups. "*" follows all of them.
+	void follow(WebSocket &sock, const std::vector<std::string> &ids);
+	void unfollow(WebSocket &sock, const std::vector<std::string> &ids);
+	//! @brief Drop the subscriptions of a client. Must be called when it disconnects, before the socket is freed.
+	void forget(WebSocket &sock);
+
+	nlohmann::json getSetups();
+	//! @brief Get the last known state of a setup.
+	//! @throw std::out_of_range The setup doesn't exist.
+	nlohmann::json getState(const std::string &id);
+};
+
+extern std::unique_ptr<Aggregator> aggregator;
+
+
+#endif //SWRSTOYS_AGGREGATOR_HPP
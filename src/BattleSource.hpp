@@ -0,0 +1,29 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_BATTLESOURCE_HPP
+#define SWRSTOYS_BATTLESOURCE_HPP
+
+
+#include <memory>
+#include "State.hpp"
+
+//! @brief Where the state takes the battle from.
+//! The game is the only source in the mod, replays stand in for it elsewhere.
+class BattleSource {
+public:
+	virtual ~BattleSource() = default;
+
+	//! @brief Copy everything the cache is computed from. Called by updateCache.
+	virtual void capture(BattleSample &sample, bool isMultiplayer) = 0;
+	//! @brief Get the number of rounds each side won in the current game.
+	virtual void getRounds(unsigned &left, unsigned &right) = 0;
+	virtual bool isInBattle() = 0;
+	virtual unsigned char getPalette(bool left) = 0;
+};
+
+extern std::unique_ptr<BattleSource> battleSource;
+
+
+#endif //SWRSTOYS_BATTLESOURCE_HPP
@@ -165,12 +165,6 @@ public:
 	explicit InvalidPongException(const std::string &&msg) : NetworkException(static_cast<const std::string &&>(msg)) {};
 };
 
-class CryptFailedException : public NetworkException {
-public:
-	//! @param msg The error message.
-	explicit CryptFailedException(const std::string &&msg) : NetworkException(msg + ": " + std::to_string(GetLastError())) {};
-};
-
 class ConnectionTerminatedException : public NetworkException {
 private:
 	unsigned _code;
@@ -192,7 +186,7 @@ public:
 	//! @brief Create a HTTPErrorException with a message.
 	//! @param response The response from a Socket.
 	HTTPErrorException(const Socket::HttpResponse &response):
-		NetworkException(response.request.host + " responded with code " + std::to_string(response.returnCode) + " " + response.codeName), _response(response) {}
+		NetworkException(std::string(response.request.host) + " responded with code " + std::to_string(response.returnCode) + " " + response.codeName.c_str()), _response(response) {}
 
 	//! @brief Return the response of the last Socket Exception.
 	//! @return Socket::HttpResponse
@@ -201,4 +195,12 @@ public:
 	}
 };
 
+//! @brief Define a FileMappingException.
+class FileMappingException : public BaseException {
+public:
+	//! @brief Create a FileMappingException with a message.
+	//! @param msg The error message.
+	explicit FileMappingException(const std::string &&msg) : BaseException("FileMappingException: " + static_cast<const std::string &&>(msg)) {};
+};
+
 #endif // DISCXXORD_EXCEPTION_HPP
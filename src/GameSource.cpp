@@ -0,0 +1,82 @@
+//
+// Created by PinkySmile on 08/12/2020.
+//
+
+#include <SokuLib.hpp>
+#include "GameSource.hpp"
+
+static void captureSide(SideSample &side, SokuLib::CharacterManager &manager, SokuLib::Character character)
+{
+	auto &deck = manager.deckInfo;
+	auto &hand = manager.hand;
+
+	side.deck.clear();
+	for (int i = 0; i < deck.deck.size; i++)
+		side.deck.push_back(deck.deck[i]);
+	side.deckCopy.clear();
+	for (int i = 0; i < deck.deckCopy.size; i++)
+		side.deckCopy.push_back(deck.deckCopy[i]);
+	side.hand.clear();
+	for (int i = 0; i < manager.cardCount; i++)
+		side.hand.push_back(hand.handCardBase[(i + hand.selectedCard) % hand.handCardMax]->id);
+
+	side.stats.doll =     manager.sacrificialDolls;
+	side.stats.drops =    manager.drops;
+	side.stats.rod =      manager.controlRod;
+	side.stats.fan =      manager.tenguFans;
+	side.stats.grimoire = manager.grimoires;
+	if (character == SokuLib::CHARACTER_YUYUKO)
+		side.stats.specialValue = manager.resurrectionButterfliesUsed;
+	else if (character == SokuLib::CHARACTER_REISEN)
+		side.stats.specialValue = manager.elixirUsed;
+	else
+		side.stats.specialValue = 0;
+	for (int i = 0; i < 16; i++) {
+		side.stats.skillMap[i].level = manager.skillMap[i].level;
+		side.stats.skillMap[i].notUsed = manager.skillMap[i].notUsed;
+	}
+}
+
+void GameSource::capture(BattleSample &sample, bool isMultiplayer)
+{
+	auto &battleMgr = SokuLib::getBattleMgr();
+
+	sample.isMultiplayer = isMultiplayer;
+	sample.isReplay = SokuLib::subMode == SokuLib::BATTLE_SUBMODE_REPLAY;
+	sample.weather = SokuLib::activeWeather;
+	sample.cardsHidden = SokuLib::activeWeather == SokuLib::WEATHER_MOUNTAIN_VAPOR;
+	sample.left = SokuLib::leftChar;
+	sample.right = SokuLib::rightChar;
+	if (isMultiplayer) {
+		auto &netObj = SokuLib::getNetObject();
+
+		sample.leftProfile = netObj.profile1name;
+		sample.rightProfile = netObj.profile2name;
+	} else {
+		sample.leftProfile = static_cast<const char *>(SokuLib::profile1.name);
+		sample.rightProfile = static_cast<const char *>(SokuLib::profile2.name);
+	}
+	captureSide(sample.leftSide, battleMgr.leftCharacterManager, SokuLib::leftChar);
+	captureSide(sample.rightSide, battleMgr.rightCharacterManager, SokuLib::rightChar);
+}
+
+void GameSource::getRounds(unsigned &left, unsigned &right)
+{
+	auto &battleMgr = SokuLib::getBattleMgr();
+
+	left = battleMgr.leftCharacterManager.score;
+	right = battleMgr.rightCharacterManager.score;
+}
+
+bool GameSource::isInBattle()
+{
+	return SokuLib::sceneId == SokuLib::SCENE_BATTLE ||
+	       SokuLib::sceneId == SokuLib::SCENE_BATTLECL ||
+	       SokuLib::sceneId == SokuLib::SCENE_BATTLESV ||
+	       SokuLib::sceneId == SokuLib::SCENE_BATTLEWATCH;
+}
+
+unsigned char GameSource::getPalette(bool left)
+{
+	return (left ? SokuLib::leftPlayerInfo : SokuLib::rightPlayerInfo).palette;
+}
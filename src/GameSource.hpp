@@ -0,0 +1,21 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_GAMESOURCE_HPP
+#define SWRSTOYS_GAMESOURCE_HPP
+
+
+#include "BattleSource.hpp"
+
+//! @brief Reads the battle from the game memory.
+class GameSource : public BattleSource {
+public:
+	void capture(BattleSample &sample, bool isMultiplayer) override;
+	void getRounds(unsigned &left, unsigned &right) override;
+	bool isInBattle() override;
+	unsigned char getPalette(bool left) override;
+};
+
+
+#endif //SWRSTOYS_GAMESOURCE_HPP
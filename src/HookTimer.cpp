@@ -0,0 +1,150 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include "HookTimer.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "State.hpp"
+
+struct HookMetrics {
+	Metrics::Histogram duration;
+	Metrics::Counter stalls;
+	//! Only written by the game thread.
+	std::atomic<long long> max{0};
+};
+
+struct Stall {
+	long long time;
+	Hook hook;
+	long long duration;
+	FixedVector<unsigned char, 32> opcodes;
+	bool sampled;
+	unsigned frame;
+	unsigned clients;
+};
+
+static const char *hookNames[HOOK_COUNT] = {
+	"CBattle_OnProcess",
+	"CBattleWatch_OnProcess",
+	"CTitle_OnProcess",
+	"CLoading_OnProcess",
+	"CLoadingWatch_OnProcess",
+	"CBattleManager_KO",
+	"CBattleManager_Start"
+};
+long long stallBudget = 0;
+static thread_local HookTimer *current = nullptr;
+static std::mutex stallsMutex;
+static std::deque<Stall> stalls;
+
+const std::vector<long long> &getHookBuckets()
+{
+	// 1us to 134ms, with a 50% precision
+	static const std::vector<long long> buckets = Metrics::logLinearBuckets(1000, 1LL << 27, 2);
+
+	return buckets;
+}
+
+static HookMetrics *getHookMetrics()
+{
+	static HookMetrics *metrics = []{
+		auto result = new HookMetrics[HOOK_COUNT];
+
+		for (int i = 0; i < HOOK_COUNT; i++) {
+			auto labels = Metrics::label("hook", hookNames[i]);
+
+			result[i].duration = Metrics::histogram("sokustreaming_hook_duration_seconds", "Time spent running our code in the game hooks.", getHookBuckets(), 1e-9, labels);
+			result[i].stalls = Metrics::counter("sokustreaming_hook_stalls_total", "Hooks which took longer than the stall budget.", labels);
+		}
+		Metrics::addCollector("sokustreaming_hook_max_duration_seconds", "Longest time spent in each game hook.", Metrics::GAUGE, [result]{
+			Metrics::Samples samples;
+
+			for (int i = 0; i < HOOK_COUNT; i++)
+				samples.emplace_back(Metrics::label("hook", hookNames[i]), result[i].max.load(std::memory_order_relaxed) * 1e-9);
+			return samples;
+		});
+		return result;
+	}();
+
+	return metrics;
+}
+
+HookTimer::HookTimer(Hook hook) :
+	_hook(hook),
+	_start(Metrics::now())
+{
+	current = this;
+}
+
+HookTimer::~HookTimer()
+{
+	auto duration = Metrics::now() - this->_start;
+	auto &metrics = getHookMetrics()[this->_hook];
+
+	current = nullptr;
+	metrics.duration.observe(duration);
+	if (duration > metrics.max.load(std::memory_order_relaxed))
+		metrics.max.store(duration, std::memory_order_relaxed);
+	if (!stallBudget || duration <= stallBudget)
+		return;
+	metrics.stalls.add();
+
+	Stall stall;
+	std::string opcodes;
+	std::string frame = "no frame";
+
+	stall.time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	stall.hook = this->_hook;
+	stall.duration = duration;
+	stall.opcodes = this->_opcodes;
+	stall.sampled = this->_sampled;
+	stall.frame = this->_frame;
+	stall.clients = webServer ? webServer->getClientCount() : 0;
+	for (auto op : stall.opcodes)
+		opcodes += (opcodes.empty() ? "" : ", ") + std::to_string(op);
+	if (stall.sampled)
+		frame = "frame " + std::to_string(stall.frame);
+	LOG_WARNING("Stall in %s: %.3fms with %u clients, sampled %s, broadcast opcodes [%s]", hookNames[stall.hook], duration / 1e6, stall.clients, frame.c_str(), opcodes.c_str());
+
+	std::lock_guard<std::mutex> lock{stallsMutex};
+
+	stalls.push_back(stall);
+	if (stalls.size() > 64)
+		stalls.pop_front();
+}
+
+void HookTimer::noteOpcode(int op)
+{
+	if (current)
+		current->_opcodes.push_back(op);
+}
+
+void HookTimer::noteSample(unsigned frame)
+{
+	if (!current)
+		return;
+	current->_sampled = true;
+	current->_frame = frame;
+}
+
+nlohmann::json getStalls()
+{
+	std::lock_guard<std::mutex> lock{stallsMutex};
+	nlohmann::json result = nlohmann::json::array();
+
+	for (auto &stall : stalls)
+		result.push_back({
+			{"time",       stall.time},
+			{"hook",       hookNames[stall.hook]},
+			{"durationMs", stall.duration / 1e6},
+			{"frame",      stall.sampled ? nlohmann::json(stall.frame) : nlohmann::json()},
+			{"opcodes",    std::vector<unsigned char>(stall.opcodes.begin(), stall.opcodes.end())},
+			{"clients",    stall.clients}
+		});
+	return result;
+}
@@ -0,0 +1,58 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_HOOKTIMER_HPP
+#define SWRSTOYS_HOOKTIMER_HPP
+
+
+#include <vector>
+#include "Utils/FixedVector.hpp"
+#include "nlohmann/json.hpp"
+
+//! @brief The game functions we hook, which run our code inside the game loop.
+enum Hook {
+	HOOK_BATTLE,
+	HOOK_BATTLE_WATCH,
+	HOOK_TITLE,
+	HOOK_LOADING,
+	HOOK_LOADING_WATCH,
+	HOOK_KO,
+	HOOK_ROUND_START,
+	HOOK_COUNT
+};
+
+//! @brief Measures the time spent in a hook, from its construction to its destruction.
+//! Created right after calling the original function, so only our code is measured.
+//! Hooks going over stallBudget are logged along with the frame they sampled and what they broadcast themselves.
+//! Only one can be running per thread.
+class HookTimer {
+private:
+	Hook _hook;
+	long long _start;
+	FixedVector<unsigned char, 32> _opcodes;
+	bool _sampled = false;
+	unsigned _frame = 0;
+
+public:
+	explicit HookTimer(Hook hook);
+	~HookTimer();
+
+	//! @brief Remember an opcode broadcast by the hook running on this thread, if any.
+	static void noteOpcode(int op);
+	//! @brief Remember the battle frame sampled by the hook running on this thread, if any.
+	//! Its state updates are broadcast later by the state worker.
+	static void noteSample(unsigned frame);
+};
+
+//! @brief Time in nanoseconds after which a hook is logged as a stall. 0 disables the log.
+extern long long stallBudget;
+
+//! @brief Bounds of the histograms of the time spent on the game thread, in nanoseconds.
+const std::vector<long long> &getHookBuckets();
+
+//! @brief The last stalls, oldest first.
+nlohmann::json getStalls();
+
+
+#endif //SWRSTOYS_HOOKTIMER_HPP
@@ -0,0 +1,167 @@
+//
+// Created by PinkySmile on 08/12/2020.
+//
+
+#include <SokuLib.hpp>
+#include <thread>
+#include <nlohmann/json.hpp>
+#include "KeyInputs.hpp"
+#include "State.hpp"
+#include "Network/Handlers.hpp"
+#include "Utils/InputBox.hpp"
+
+#define checkKey(key) (GetKeyState(keys[key]) & 0x8000)
+
+std::vector<unsigned> keys(TOTAL_NB_OF_KEYS);
+bool threadUsed = false;
+std::thread thread;
+std::vector<bool> oldState;
+
+void checkKeyInputs()
+{
+	std::vector<bool> isPressed;
+
+	if (!threadUsed && thread.joinable())
+		thread.join();
+
+	if (GetForegroundWindow() != SokuLib::window)
+		return;
+
+	isPressed.reserve(TOTAL_NB_OF_KEYS);
+	oldState.resize(TOTAL_NB_OF_KEYS);
+	for (int i = 0; i < TOTAL_NB_OF_KEYS; i++) {
+		auto val = checkKey(i);
+
+		isPressed.push_back(val && !oldState[i]);
+		oldState[i] = val;
+	}
+	if (std::find(isPressed.begin(), isPressed.end(), true) == isPressed.end())
+		return;
+
+	// Broadcast once the lock is released, the fan-out can take a while
+	std::vector<std::pair<Opcodes, std::string>> messages;
+
+	{
+		CacheWriteLock lock;
+
+		if (isPressed[KEY_DECREASE_L_SCORE]) {
+			_cache.leftScore--;
+			_cache.version++;
+			messages.emplace_back(L_SCORE_UPDATE, std::to_string(_cache.leftScore));
+		}
+		if (isPressed[KEY_DECREASE_R_SCORE]) {
+			_cache.rightScore--;
+			_cache.version++;
+			messages.emplace_back(R_SCORE_UPDATE, std::to_string(_cache.rightScore));
+		}
+		if (isPressed[KEY_INCREASE_L_SCORE]) {
+			_cache.leftScore++;
+			_cache.version++;
+			messages.emplace_back(L_SCORE_UPDATE, std::to_string(_cache.leftScore));
+		}
+		if (isPressed[KEY_INCREASE_R_SCORE]) {
+			_cache.rightScore++;
+			_cache.version++;
+			messages.emplace_back(R_SCORE_UPDATE, std::to_string(_cache.rightScore));
+		}
+		if (isPressed[KEY_RESET_SCORES]) {
+			_cache.leftScore = 0;
+			_cache.rightScore = 0;
+			_cache.version++;
+			messages.emplace_back(L_SCORE_UPDATE, std::to_string(_cache.leftScore));
+			messages.emplace_back(R_SCORE_UPDATE, std::to_string(_cache.rightScore));
+		}
+		if (isPressed[KEY_RESET_STATE]) {
+			auto version = _cache.version;
+
+			_cache = CachedMatchData();
+			_cache.version = version + 1;
+			messages.emplace_back(STATE_UPDATE, getStateJson(_cache));
+			needRefresh = true;
+			needReset = true;
+		}
+	}
+	for (auto &[op, data] : messages)
+		broadcastOpcode(op, data);
+	if (isPressed[KEY_CHANGE_L_NAME]) {
+		if (!threadUsed) {
+			threadUsed = true;
+			if (thread.joinable())
+				thread.join();
+			thread = std::thread{[] {
+				auto answer = InputBox("Change left player name", "Left name", readCache().leftName.str());
+
+				if (answer.empty()) {
+					threadUsed = false;
+					return;
+				}
+
+				std::string message;
+
+				{
+					CacheWriteLock lock;
+
+					setName(_cache, true, answer.c_str());
+					_cache.version++;
+					message = nlohmann::json(_cache.leftUtf8Name.c_str()).dump();
+				}
+				broadcastOpcode(L_NAME_UPDATE, message);
+				threadUsed = false;
+			}};
+		}
+	}
+	if (isPressed[KEY_CHANGE_ROUND]) {
+		if (!threadUsed) {
+			threadUsed = true;
+			if (thread.joinable())
+				thread.join();
+			thread = std::thread{[] {
+				auto answer = InputBox("Change round name", "Round name", readCache().round.str());
+
+				if (answer.empty()) {
+					threadUsed = false;
+					return;
+				}
+
+				std::string message;
+
+				{
+					CacheWriteLock lock;
+
+					_cache.round = answer;
+					_cache.version++;
+					message = getStateJson(_cache);
+				}
+				broadcastOpcode(STATE_UPDATE, message);
+				threadUsed = false;
+			}};
+		}
+	}
+	if (isPressed[KEY_CHANGE_R_NAME]) {
+		if (!threadUsed) {
+			threadUsed = true;
+			if (thread.joinable())
+				thread.join();
+			thread = std::thread{[] {
+				auto answer = InputBox("Change right player name", "Right name", readCache().rightName.str());
+
+				if (answer.empty()) {
+					threadUsed = false;
+					return;
+				}
+
+				std::string message;
+
+				{
+					CacheWriteLock lock;
+
+					setName(_cache, false, answer.c_str());
+					_cache.version++;
+					message = nlohmann::json(_cache.rightUtf8Name.c_str()).dump();
+				}
+				broadcastOpcode(R_NAME_UPDATE, message);
+				threadUsed = false;
+			}};
+		}
+	}
+}
@@ -0,0 +1,30 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_KEYINPUTS_HPP
+#define SWRSTOYS_KEYINPUTS_HPP
+
+
+#include <vector>
+
+enum Keys {
+	KEY_DECREASE_L_SCORE,
+	KEY_DECREASE_R_SCORE,
+	KEY_INCREASE_L_SCORE,
+	KEY_INCREASE_R_SCORE,
+	KEY_CHANGE_L_NAME,
+	KEY_CHANGE_R_NAME,
+	KEY_RESET_SCORES,
+	KEY_RESET_STATE,
+	KEY_CHANGE_ROUND,
+	TOTAL_NB_OF_KEYS
+};
+
+extern std::vector<unsigned> keys;
+
+//! @brief Apply the shortcuts pressed since the last call, when the game has the focus.
+void checkKeyInputs();
+
+
+#endif //SWRSTOYS_KEYINPUTS_HPP
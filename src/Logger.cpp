@@ -0,0 +1,241 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include "Logger.hpp"
+#include "Metrics.hpp"
+
+namespace Logger
+{
+	std::atomic<Level> level{LEVEL_INFO};
+
+	struct Slot {
+		//! Equal to its index when free, to its index + 1 once filled (both plus a multiple of ringSize).
+		std::atomic<size_t> sequence;
+		long long time;
+		Level level;
+		char message[maxMessageSize];
+	};
+
+	constexpr size_t ringSize = 1024;
+	static const char *levelNames[] = {"DEBUG", "INFO", "WARNING", "ERROR", "NONE"};
+
+	//! Bounded multi producer queue (Vyukov's), the background thread is the only consumer.
+	struct Ring {
+		Slot slots[ringSize];
+		std::atomic<size_t> tail{0};
+		size_t head = 0;
+
+		Ring()
+		{
+			for (size_t i = 0; i < ringSize; i++)
+				this->slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	};
+
+	struct Output {
+		std::mutex mutex;
+		std::thread thread;
+		std::atomic<bool> running{false};
+		std::string path;
+		FILE *file = nullptr;
+		size_t fileSize = 0;
+		size_t maxFileSize = 0;
+		unsigned maxFiles = 0;
+	};
+
+	// Never destroyed, the threads may still be logging while the statics are destroyed.
+	static Ring &ring()
+	{
+		static Ring *ring = new Ring();
+
+		return *ring;
+	}
+
+	static Output &output()
+	{
+		static Output *output = new Output();
+
+		return *output;
+	}
+
+	static Metrics::Counter *getMessageCounters()
+	{
+		static Metrics::Counter *counters = []{
+			auto result = new Metrics::Counter[LEVEL_NONE];
+
+			for (int i = 0; i < LEVEL_NONE; i++)
+				result[i] = Metrics::counter("sokustreaming_log_messages_total", "Messages logged, by level.", Metrics::label("level", levelNames[i]));
+			return result;
+		}();
+
+		return counters;
+	}
+
+	void write(Level lvl, const char *format, ...)
+	{
+		static Metrics::Counter dropped = Metrics::counter("sokustreaming_log_dropped_total", "Messages dropped because the log ring was full.");
+		auto &r = ring();
+		auto pos = r.tail.load(std::memory_order_relaxed);
+		Slot *slot;
+
+		getMessageCounters()[lvl].add();
+		while (true) {
+			slot = &r.slots[pos % ringSize];
+
+			auto diff = static_cast<long long>(slot->sequence.load(std::memory_order_acquire)) - static_cast<long long>(pos);
+
+			if (diff == 0) {
+				if (r.tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			} else if (diff < 0) {
+				// Full, the background thread is behind or not started yet
+				dropped.add();
+				return;
+			} else
+				pos = r.tail.load(std::memory_order_relaxed);
+		}
+
+		va_list args;
+		int size;
+
+		va_start(args, format);
+		size = vsnprintf(slot->message, maxMessageSize, format, args);
+		va_end(args);
+		if (size >= static_cast<int>(maxMessageSize))
+			strcpy(&slot->message[maxMessageSize - 4], "...");
+		slot->time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		slot->level = lvl;
+		slot->sequence.store(pos + 1, std::memory_order_release);
+	}
+
+	Level parseLevel(const std::string &name)
+	{
+		std::string upper = name;
+
+		std::transform(upper.begin(), upper.end(), upper.begin(), [](unsigned char c){ return std::toupper(c); });
+		for (int i = 0; i <= LEVEL_NONE; i++)
+			if (upper == levelNames[i])
+				return static_cast<Level>(i);
+		throw std::invalid_argument(name + " is not a log level");
+	}
+
+	static void openFile(Output &out)
+	{
+		out.file = fopen(out.path.c_str(), "a");
+		if (!out.file) {
+			fprintf(stderr, "Cannot open log file %s: %s\n", out.path.c_str(), strerror(errno));
+			return;
+		}
+		fseek(out.file, 0, SEEK_END);
+		out.fileSize = ftell(out.file);
+	}
+
+	static void rotate(Output &out)
+	{
+		fclose(out.file);
+		out.file = nullptr;
+		if (!out.maxFiles)
+			remove(out.path.c_str());
+		else {
+			remove((out.path + "." + std::to_string(out.maxFiles)).c_str());
+			for (unsigned i = out.maxFiles - 1; i > 0; i--)
+				rename((out.path + "." + std::to_string(i)).c_str(), (out.path + "." + std::to_string(i + 1)).c_str());
+			rename(out.path.c_str(), (out.path + ".1").c_str());
+		}
+		openFile(out);
+	}
+
+	//! @brief Write the messages queued so far.
+	//! @return Whether there was any.
+	static bool drain(Output &out)
+	{
+		auto &r = ring();
+		bool any = false;
+		char line[maxMessageSize + 64];
+
+		while (true) {
+			auto &slot = r.slots[r.head % ringSize];
+
+			if (slot.sequence.load(std::memory_order_acquire) != r.head + 1)
+				break;
+
+			time_t seconds = slot.time / 1000;
+			auto tm = localtime(&seconds);
+			auto size = snprintf(line, sizeof(line), "[%04d-%02d-%02d %02d:%02d:%02d.%03d] [%s] %s\n",
+				tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec,
+				static_cast<int>(slot.time % 1000), levelNames[slot.level], slot.message
+			);
+
+			slot.sequence.store(r.head + ringSize, std::memory_order_release);
+			r.head++;
+			any = true;
+			fwrite(line, 1, size, stdout);
+			if (!out.file)
+				continue;
+			if (out.fileSize && out.fileSize + size > out.maxFileSize)
+				rotate(out);
+			if (out.file) {
+				fwrite(line, 1, size, out.file);
+				out.fileSize += size;
+			}
+		}
+		if (any) {
+			fflush(stdout);
+			if (out.file)
+				fflush(out.file);
+		}
+		return any;
+	}
+
+	void start(const std::string &file, size_t maxFileSize, unsigned maxFiles)
+	{
+		auto &out = output();
+		std::lock_guard<std::mutex> lock{out.mutex};
+
+		if (out.running)
+			return;
+		out.path = file;
+		out.maxFileSize = maxFileSize;
+		out.maxFiles = maxFiles;
+		if (!file.empty())
+			openFile(out);
+		out.running = true;
+		out.thread = std::thread([&out]{
+			while (true) {
+				// Checked before draining, so what was queued before stopping is written
+				bool stopping = !out.running;
+
+				if (!drain(out) && !stopping)
+					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				if (stopping)
+					break;
+			}
+		});
+	}
+
+	void stop()
+	{
+		auto &out = output();
+		std::lock_guard<std::mutex> lock{out.mutex};
+
+		if (!out.running)
+			return;
+		out.running = false;
+		out.thread.join();
+		if (out.file)
+			fclose(out.file);
+		out.file = nullptr;
+	}
+}
@@ -0,0 +1,73 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_LOGGER_HPP
+#define SWRSTOYS_LOGGER_HPP
+
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+//! @brief Lowest level compiled in, the messages below it cost nothing, their arguments aren't even evaluated.
+//! Defaults to everything in debug builds and to the info messages otherwise.
+#ifndef SOKUSTREAMING_LOG_LEVEL
+#ifdef _DEBUG
+#define SOKUSTREAMING_LOG_LEVEL 0
+#else
+#define SOKUSTREAMING_LOG_LEVEL 1
+#endif
+#endif
+
+#define SOKUSTREAMING_LOG(lvl, ...) do { \
+	if (lvl >= SOKUSTREAMING_LOG_LEVEL && lvl >= Logger::level.load(std::memory_order_relaxed)) \
+		Logger::write(lvl, __VA_ARGS__); \
+} while (0)
+#define LOG_DEBUG(...)   SOKUSTREAMING_LOG(Logger::LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)    SOKUSTREAMING_LOG(Logger::LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARNING(...) SOKUSTREAMING_LOG(Logger::LEVEL_WARNING, __VA_ARGS__)
+#define LOG_ERROR(...)   SOKUSTREAMING_LOG(Logger::LEVEL_ERROR, __VA_ARGS__)
+
+//! @brief Logs printf style messages without ever blocking the caller on the console or on the disk.
+//! The messages are formatted in a ring buffer shared by all the threads, without locking,
+//! and written by a background thread. When the ring is full the new messages are dropped and counted.
+namespace Logger
+{
+	enum Level {
+		LEVEL_DEBUG,
+		LEVEL_INFO,
+		LEVEL_WARNING,
+		LEVEL_ERROR,
+		LEVEL_NONE
+	};
+
+	//! Longer messages are truncated.
+	constexpr size_t maxMessageSize = 256;
+
+	//! @brief Lowest level written, on top of SOKUSTREAMING_LOG_LEVEL.
+	extern std::atomic<Level> level;
+
+	//! @brief Queue a message. Use the LOG_* macros instead, they filter the levels before formatting.
+	void write(Level level, const char *format, ...)
+#ifdef __GNUC__
+	__attribute__((format(printf, 2, 3)))
+#endif
+	;
+
+	//! @brief Get a level from its name (debug, info, warning, error or none), whatever the case.
+	//! @throw std::invalid_argument The name is not a level.
+	Level parseLevel(const std::string &name);
+
+	//! @brief Start writing the messages, those queued before are written too.
+	//! @param file Also write them in this file if not empty, appending to it.
+	//! @param maxFileSize Size in bytes after which the file is renamed to file.1 (file.1 to file.2, and so on) and a new one is started.
+	//! @param maxFiles Number of old files kept.
+	void start(const std::string &file = "", size_t maxFileSize = 10 * 1024 * 1024, unsigned maxFiles = 3);
+
+	//! @brief Write the queued messages and stop the background thread.
+	void stop();
+}
+
+
+#endif //SWRSTOYS_LOGGER_HPP
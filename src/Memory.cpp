@@ -0,0 +1,203 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include "Memory.hpp"
+#include "Metrics.hpp"
+#include "nlohmann/json.hpp"
+
+namespace Memory
+{
+	struct Counters {
+		std::atomic<long long> live{0};
+		std::atomic<long long> peak{0};
+		std::atomic<long long> allocations{0};
+		std::atomic<long long> frees{0};
+	};
+
+	// Constant initialized, so they can be used by operator new before the other statics are constructed.
+	static Counters counters[TAG_COUNT];
+	static const char *tagNames[TAG_COUNT] = {
+		"network",
+		"websocket",
+		"assets",
+		"state",
+		"json",
+		"other"
+	};
+	static std::mutex reportMutex;
+	static long long lastReport = Metrics::now();
+	static long long lastAllocations[TAG_COUNT];
+
+	void allocated(Tag tag, size_t size)
+	{
+		auto &counter = counters[tag];
+		auto live = counter.live.fetch_add(size, std::memory_order_relaxed) + static_cast<long long>(size);
+		auto peak = counter.peak.load(std::memory_order_relaxed);
+
+		counter.allocations.fetch_add(1, std::memory_order_relaxed);
+		while (live > peak && !counter.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+	}
+
+	void freed(Tag tag, size_t size)
+	{
+		counters[tag].live.fetch_sub(size, std::memory_order_relaxed);
+		counters[tag].frees.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	static Metrics::Samples collect(const std::atomic<long long> Counters::*value)
+	{
+		Metrics::Samples samples;
+
+		for (int i = 0; i < TAG_COUNT; i++)
+			samples.emplace_back(Metrics::label("tag", tagNames[i]), (counters[i].*value).load(std::memory_order_relaxed));
+		return samples;
+	}
+
+	static const bool registered = []{
+		Metrics::addCollector("sokustreaming_memory_live_bytes", "Bytes currently allocated, by tag.", Metrics::GAUGE, []{
+			return collect(&Counters::live);
+		});
+		Metrics::addCollector("sokustreaming_memory_peak_bytes", "Most bytes allocated at once, by tag.", Metrics::GAUGE, []{
+			return collect(&Counters::peak);
+		});
+		Metrics::addCollector("sokustreaming_memory_allocations_total", "Allocations made, by tag.", Metrics::COUNTER, []{
+			return collect(&Counters::allocations);
+		});
+		return true;
+	}();
+
+	std::string report()
+	{
+		std::lock_guard<std::mutex> lock{reportMutex};
+		auto now = Metrics::now();
+		double elapsed = (now - lastReport) / 1e9;
+		nlohmann::json result = {
+#ifdef SOKUSTREAMING_MEMORY_ACCOUNTING
+			{"instrumented", true},
+#else
+			{"instrumented", false},
+#endif
+			{"tags", nlohmann::json::object()}
+		};
+
+		for (int i = 0; i < TAG_COUNT; i++) {
+			auto &counter = counters[i];
+			auto allocations = counter.allocations.load(std::memory_order_relaxed);
+
+			result["tags"][tagNames[i]] = {
+				{"liveBytes",            counter.live.load(std::memory_order_relaxed)},
+				{"peakBytes",            counter.peak.load(std::memory_order_relaxed)},
+				{"liveAllocations",      allocations - counter.frees.load(std::memory_order_relaxed)},
+				{"allocations",          allocations},
+				{"allocationsPerSecond", elapsed > 0 ? (allocations - lastAllocations[i]) / elapsed : 0}
+			};
+			lastAllocations[i] = allocations;
+		}
+		lastReport = now;
+		return result.dump();
+	}
+
+#ifdef SOKUSTREAMING_MEMORY_ACCOUNTING
+	static thread_local Tag currentTag = TAG_OTHER;
+
+	Scope::Scope(Tag tag) :
+		_previous(currentTag)
+	{
+		currentTag = tag;
+	}
+
+	Scope::~Scope()
+	{
+		currentTag = this->_previous;
+	}
+
+	// Put in front of each allocation to know how much to uncount when it is freed
+	struct alignas(alignof(std::max_align_t)) Header {
+		size_t size;
+		Tag tag;
+	};
+
+	static void *allocate(size_t size)
+	{
+		auto header = static_cast<Header *>(malloc(sizeof(Header) + size));
+
+		if (!header)
+			return nullptr;
+		header->size = size;
+		header->tag = currentTag;
+		allocated(header->tag, size);
+		return header + 1;
+	}
+
+	static void deallocate(void *p)
+	{
+		if (!p)
+			return;
+
+		auto header = static_cast<Header *>(p) - 1;
+
+		freed(header->tag, header->size);
+		free(header);
+	}
+#endif
+}
+
+#ifdef SOKUSTREAMING_MEMORY_ACCOUNTING
+void *operator new(size_t size)
+{
+	if (auto p = Memory::allocate(size))
+		return p;
+	throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+	if (auto p = Memory::allocate(size))
+		return p;
+	throw std::bad_alloc();
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	return Memory::allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return Memory::allocate(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	Memory::deallocate(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	Memory::deallocate(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	Memory::deallocate(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	Memory::deallocate(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+	Memory::deallocate(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+	Memory::deallocate(p);
+}
+#endif
@@ -0,0 +1,106 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_MEMORY_HPP
+#define SWRSTOYS_MEMORY_HPP
+
+
+#include <cstddef>
+#include <new>
+#include <string>
+
+//! @brief Counts the memory used by each subsystem.
+//! The containers using Allocator are counted under its tag.
+//! Builds defining SOKUSTREAMING_MEMORY_ACCOUNTING also replace the global operator new,
+//! counting every allocation under the tag of the innermost Scope of the thread (TAG_OTHER outside of any).
+namespace Memory
+{
+	enum Tag {
+		//! Data received from the sockets and not read yet.
+		TAG_NETWORK,
+		//! The websocket connections and the messages waiting to be forwarded to them.
+		TAG_WEBSOCKET,
+		//! Files and game assets being served.
+		TAG_ASSETS,
+		//! The serialized state kept for the next requests.
+		TAG_STATE,
+		//! The buffers the json is written in.
+		TAG_JSON,
+		TAG_OTHER,
+		TAG_COUNT
+	};
+
+	void allocated(Tag tag, size_t size);
+	void freed(Tag tag, size_t size);
+
+	//! @brief Attributes the allocations of the calling thread to a tag while it lives.
+	//! Does nothing unless SOKUSTREAMING_MEMORY_ACCOUNTING is defined.
+	class Scope {
+#ifdef SOKUSTREAMING_MEMORY_ACCOUNTING
+	private:
+		Tag _previous;
+
+	public:
+		explicit Scope(Tag tag);
+		~Scope();
+#else
+	public:
+		explicit Scope(Tag) {}
+#endif
+
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+	};
+
+	//! @brief Standard allocator counting what it allocates under a tag.
+	template<typename T, Tag tag>
+	class Allocator {
+	public:
+		using value_type = T;
+
+		template<typename U>
+		struct rebind {
+			using other = Allocator<U, tag>;
+		};
+
+		Allocator() = default;
+		template<typename U>
+		Allocator(const Allocator<U, tag> &) {}
+
+		T *allocate(size_t n)
+		{
+#ifdef SOKUSTREAMING_MEMORY_ACCOUNTING
+			// Counted by operator new
+			Scope scope{tag};
+#else
+			allocated(tag, n * sizeof(T));
+#endif
+			return static_cast<T *>(::operator new(n * sizeof(T)));
+		}
+
+		void deallocate(T *p, size_t n)
+		{
+#ifndef SOKUSTREAMING_MEMORY_ACCOUNTING
+			freed(tag, n * sizeof(T));
+#endif
+			::operator delete(p);
+		}
+
+		template<typename U>
+		bool operator==(const Allocator<U, tag> &) const { return true; }
+		template<typename U>
+		bool operator!=(const Allocator<U, tag> &) const { return false; }
+	};
+
+	template<Tag tag>
+	using String = std::basic_string<char, std::char_traits<char>, Allocator<char, tag>>;
+
+	//! @brief Live bytes, peak bytes and allocations of each tag.
+	//! The allocations per second are averaged since the previous report.
+	//! @return The report, as json.
+	std::string report();
+}
+
+
+#endif //SWRSTOYS_MEMORY_HPP
@@ -0,0 +1,337 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include "Metrics.hpp"
+
+namespace Metrics
+{
+	const std::vector<long long> latencyBuckets{
+		1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+		1000000, 2500000, 5000000, 10000000, 25000000, 50000000,
+		100000000, 250000000, 500000000, 1000000000, 2500000000, 10000000000
+	};
+	const std::vector<long long> sizeBuckets{
+		64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536, 262144, 1048576
+	};
+
+	std::vector<long long> logLinearBuckets(long long min, long long max, unsigned subBuckets)
+	{
+		std::vector<long long> result;
+
+		for (long long power = 1; power < max; power *= 2)
+			for (unsigned i = 1; i <= subBuckets; i++) {
+				long long bound = power + power * i / subBuckets;
+
+				if (bound >= min && bound <= max && (result.empty() || result.back() != bound))
+					result.push_back(bound);
+			}
+		return result;
+	}
+
+	struct Family {
+		std::string help;
+		Type type;
+		std::vector<long long> bounds;
+		double scale = 1;
+		//! Labels of each series and the first slot holding its values.
+		std::vector<std::pair<std::string, size_t>> series;
+		std::function<Samples ()> collect;
+	};
+
+	//! Only ever written by the thread owning it.
+	struct ThreadValues {
+		std::atomic<long long> values[maxSlots];
+	};
+
+	struct Registry {
+		std::mutex mutex;
+		//! Held while the collectors run, so they can't be removed in the meantime.
+		std::mutex collectMutex;
+		std::map<std::string, Family> families;
+		size_t nextSlot = 0;
+		std::vector<ThreadValues *> threads;
+		//! What the threads which already ended had recorded.
+		long long retired[maxSlots] = {};
+	};
+
+	// Never destroyed, the threads may still be recording while the statics are destroyed.
+	static Registry &registry()
+	{
+		static Registry *registry = new Registry();
+
+		return *registry;
+	}
+
+	struct ThreadHolder {
+		ThreadValues *values = new ThreadValues();
+
+		ThreadHolder()
+		{
+			auto &reg = registry();
+			std::lock_guard<std::mutex> lock{reg.mutex};
+
+			for (auto &value : this->values->values)
+				value.store(0, std::memory_order_relaxed);
+			reg.threads.push_back(this->values);
+		}
+
+		~ThreadHolder()
+		{
+			auto &reg = registry();
+			std::lock_guard<std::mutex> lock{reg.mutex};
+
+			for (size_t i = 0; i < maxSlots; i++)
+				reg.retired[i] += this->values->values[i].load(std::memory_order_relaxed);
+			reg.threads.erase(std::find(reg.threads.begin(), reg.threads.end(), this->values));
+			delete this->values;
+		}
+	};
+
+	static void record(size_t slot, long long value)
+	{
+		thread_local ThreadHolder holder;
+		auto &atomic = holder.values->values[slot];
+
+		// This thread is the only writer, the readers only need to see a value that isn't torn.
+		atomic.store(atomic.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	Counter::Counter(size_t slot) :
+		_slot(slot)
+	{
+	}
+
+	void Counter::add(long long value) const
+	{
+		if (this->_slot < maxSlots)
+			record(this->_slot, value);
+	}
+
+	Gauge::Gauge(size_t slot) :
+		_slot(slot)
+	{
+	}
+
+	void Gauge::add(long long value) const
+	{
+		if (this->_slot < maxSlots)
+			record(this->_slot, value);
+	}
+
+	void Gauge::inc() const
+	{
+		this->add(1);
+	}
+
+	void Gauge::dec() const
+	{
+		this->add(-1);
+	}
+
+	Histogram::Histogram(size_t slot, const std::vector<long long> &bounds) :
+		_slot(slot),
+		_bounds(&bounds)
+	{
+	}
+
+	void Histogram::observe(long long value) const
+	{
+		if (this->_slot >= maxSlots)
+			return;
+
+		// A value equal to a bound belongs to its bucket
+		auto bucket = std::lower_bound(this->_bounds->begin(), this->_bounds->end(), value) - this->_bounds->begin();
+
+		record(this->_slot + bucket, 1);
+		record(this->_slot + this->_bounds->size() + 1, value);
+	}
+
+	std::string label(const std::string &name, const std::string &value)
+	{
+		std::string result = name + "=\"";
+
+		for (char c : value) {
+			if (c == '\\' || c == '"')
+				result.push_back('\\');
+			if (c == '\n')
+				result += "\\n";
+			else
+				result.push_back(c);
+		}
+		result.push_back('"');
+		return result;
+	}
+
+	static size_t getSeries(const std::string &name, const std::string &help, Type type, const std::vector<long long> &bounds, double scale, const std::string &labels, Family *&family)
+	{
+		auto &reg = registry();
+		std::lock_guard<std::mutex> lock{reg.mutex};
+		auto it = reg.families.find(name);
+
+		if (it == reg.families.end()) {
+			it = reg.families.emplace(name, Family()).first;
+			it->second.help = help;
+			it->second.type = type;
+			it->second.bounds = bounds;
+			it->second.scale = scale;
+		} else if (it->second.type != type || it->second.collect)
+			throw std::invalid_argument("Metric " + name + " already exists with another type");
+		family = &it->second;
+
+		auto series = std::find_if(family->series.begin(), family->series.end(), [&labels](auto &pair){
+			return pair.first == labels;
+		});
+
+		if (series != family->series.end())
+			return series->second;
+
+		// Buckets, including +Inf, and the sum
+		size_t size = type == HISTOGRAM ? family->bounds.size() + 2 : 1;
+
+		if (reg.nextSlot + size > maxSlots)
+			throw std::length_error("No slots left for metric " + name);
+		family->series.emplace_back(labels, reg.nextSlot);
+		reg.nextSlot += size;
+		return family->series.back().second;
+	}
+
+	Counter counter(const std::string &name, const std::string &help, const std::string &labels)
+	{
+		Family *family;
+
+		return Counter(getSeries(name, help, COUNTER, {}, 1, labels, family));
+	}
+
+	Gauge gauge(const std::string &name, const std::string &help, const std::string &labels)
+	{
+		Family *family;
+
+		return Gauge(getSeries(name, help, GAUGE, {}, 1, labels, family));
+	}
+
+	Histogram histogram(const std::string &name, const std::string &help, const std::vector<long long> &bounds, double scale, const std::string &labels)
+	{
+		Family *family;
+		size_t slot = getSeries(name, help, HISTOGRAM, bounds, scale, labels, family);
+
+		return {slot, family->bounds};
+	}
+
+	void addCollector(const std::string &name, const std::string &help, Type type, const std::function<Samples ()> &collect)
+	{
+		auto &reg = registry();
+		std::lock_guard<std::mutex> lock{reg.mutex};
+		auto it = reg.families.find(name);
+
+		if (it != reg.families.end() && !it->second.collect)
+			throw std::invalid_argument("Metric " + name + " is already recorded");
+
+		auto &family = reg.families[name];
+
+		family.help = help;
+		family.type = type;
+		family.collect = collect;
+	}
+
+	void removeCollector(const std::string &name)
+	{
+		auto &reg = registry();
+		std::lock_guard<std::mutex> collectLock{reg.collectMutex};
+		std::lock_guard<std::mutex> lock{reg.mutex};
+		auto it = reg.families.find(name);
+
+		if (it != reg.families.end() && it->second.collect)
+			reg.families.erase(it);
+	}
+
+	long long now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static std::string formatNumber(double value)
+	{
+		char buffer[32];
+
+		if (std::isinf(value))
+			return value > 0 ? "+Inf" : "-Inf";
+		if (value == std::floor(value) && std::fabs(value) < 1e15)
+			snprintf(buffer, sizeof(buffer), "%.0f", value);
+		else
+			snprintf(buffer, sizeof(buffer), "%.9g", value);
+		return buffer;
+	}
+
+	static std::string seriesName(const std::string &name, const std::string &labels, const std::string &extra = "")
+	{
+		if (labels.empty() && extra.empty())
+			return name;
+		if (labels.empty() || extra.empty())
+			return name + "{" + labels + extra + "}";
+		return name + "{" + labels + "," + extra + "}";
+	}
+
+	std::string render()
+	{
+		static const char *typeNames[] = {"counter", "gauge", "histogram"};
+		std::unique_ptr<long long[]> totals{new long long[maxSlots]};
+		std::map<std::string, Family> families;
+		std::string result;
+		auto &reg = registry();
+		std::lock_guard<std::mutex> collectLock{reg.collectMutex};
+
+		{
+			std::lock_guard<std::mutex> lock{reg.mutex};
+
+			std::copy(reg.retired, reg.retired + maxSlots, totals.get());
+			for (auto thread : reg.threads)
+				for (size_t i = 0; i < reg.nextSlot; i++)
+					totals[i] += thread->values[i].load(std::memory_order_relaxed);
+			families = reg.families;
+		}
+		for (auto &[name, family] : families) {
+			result += "# HELP " + name + " " + family.help + "\n";
+			result += "# TYPE " + name + " " + typeNames[family.type] + "\n";
+			if (family.collect) {
+				// Only the collector lock is held, so the collectors can record metrics
+				for (auto &[labels, value] : family.collect())
+					result += seriesName(name, labels) + " " + formatNumber(value) + "\n";
+				continue;
+			}
+			for (auto &[labels, slot] : family.series) {
+				if (family.type != HISTOGRAM) {
+					result += seriesName(name, labels) + " " + formatNumber(totals[slot]) + "\n";
+					continue;
+				}
+
+				long long count = 0;
+
+				for (size_t i = 0; i <= family.bounds.size(); i++)
+					count += totals[slot + i];
+				// Most hooks and opcodes are never seen by a given setup, no need for all their buckets
+				if (!count)
+					continue;
+				count = 0;
+				for (size_t i = 0; i <= family.bounds.size(); i++) {
+					auto bound = i == family.bounds.size() ? INFINITY : family.bounds[i] * family.scale;
+
+					count += totals[slot + i];
+					result += seriesName(name + "_bucket", labels, label("le", formatNumber(bound))) + " " + formatNumber(count) + "\n";
+				}
+				result += seriesName(name + "_sum", labels) + " " + formatNumber(totals[slot + family.bounds.size() + 1] * family.scale) + "\n";
+				result += seriesName(name + "_count", labels) + " " + formatNumber(count) + "\n";
+			}
+		}
+		return result;
+	}
+}
@@ -0,0 +1,102 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_METRICS_HPP
+#define SWRSTOYS_METRICS_HPP
+
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+//! @brief Counters, gauges and histograms exported in the Prometheus text format.
+//! Each thread updates its own copy of the values, so recording never contends with other threads.
+//! The copies are only summed when the metrics are rendered.
+namespace Metrics
+{
+	enum Type {
+		COUNTER,
+		GAUGE,
+		HISTOGRAM
+	};
+
+	//! Number of values a thread can hold. A histogram takes one per bucket, plus two.
+	constexpr size_t maxSlots = 4096;
+
+	class Counter {
+	private:
+		size_t _slot = maxSlots;
+
+	public:
+		Counter() = default;
+		explicit Counter(size_t slot);
+		void add(long long value = 1) const;
+	};
+
+	class Gauge {
+	private:
+		size_t _slot = maxSlots;
+
+	public:
+		Gauge() = default;
+		explicit Gauge(size_t slot);
+		void add(long long value) const;
+		void inc() const;
+		void dec() const;
+	};
+
+	class Histogram {
+	private:
+		size_t _slot = maxSlots;
+		const std::vector<long long> *_bounds = nullptr;
+
+	public:
+		Histogram() = default;
+		Histogram(size_t slot, const std::vector<long long> &bounds);
+		void observe(long long value) const;
+	};
+
+	//! @brief Values of a collected metric, as pairs of labels and value.
+	using Samples = std::vector<std::pair<std::string, double>>;
+
+	//! Upper bounds of the latency buckets, in nanoseconds.
+	extern const std::vector<long long> latencyBuckets;
+	//! Upper bounds of the size buckets, in bytes.
+	extern const std::vector<long long> sizeBuckets;
+
+	//! @brief Bounds splitting each power of two between min and max in subBuckets buckets of the same size,
+	//! so the relative error stays the same whatever the value (as in HDR histograms).
+	std::vector<long long> logLinearBuckets(long long min, long long max, unsigned subBuckets);
+
+	//! @brief Format a label, escaping its value.
+	std::string label(const std::string &name, const std::string &value);
+
+	//! @brief Get a series of a metric, creating it if needed.
+	//! Asking twice for the same name and labels gives the same series.
+	//! @param labels Labels of the series, built with label() and separated by commas.
+	//! @throw std::length_error There are no slots left.
+	//! @throw std::invalid_argument The metric already exists with another type.
+	Counter counter(const std::string &name, const std::string &help, const std::string &labels = "");
+	Gauge gauge(const std::string &name, const std::string &help, const std::string &labels = "");
+	//! @param bounds Upper bounds of the buckets, in increasing order. The same for all the series of the metric.
+	//! @param scale Factor from the observed values to the exported ones (e.g. 1e-9 for nanoseconds to seconds).
+	Histogram histogram(const std::string &name, const std::string &help, const std::vector<long long> &bounds, double scale, const std::string &labels = "");
+
+	//! @brief Register a metric computed when rendering, replacing any previous collector with the same name.
+	//! It is called from the thread rendering the metrics.
+	void addCollector(const std::string &name, const std::string &help, Type type, const std::function<Samples ()> &collect);
+	void removeCollector(const std::string &name);
+
+	//! @brief Nanoseconds since an arbitrary point, from a monotonic clock.
+	long long now();
+
+	//! @brief Render all the metrics in the Prometheus text exposition format.
+	//! The histogram series which never observed anything are left out.
+	std::string render();
+}
+
+
+#endif //SWRSTOYS_METRICS_HPP
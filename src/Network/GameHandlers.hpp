@@ -0,0 +1,26 @@
+//
+// Created by PinkySmile on 08/12/2020.
+//
+
+#ifndef SWRSTOYS_GAMEHANDLERS_HPP
+#define SWRSTOYS_GAMEHANDLERS_HPP
+
+
+#include <vector>
+#include "WebServer.hpp"
+#include "package.hpp"
+
+// Routes that need the game to be running, everything else is in Handlers.hpp.
+Socket::HttpResponse root(const Socket::HttpRequest &requ);
+Socket::HttpResponse getCharName(const Socket::HttpRequest &requ);
+Socket::HttpResponse getCharNames(const Socket::HttpRequest &requ);
+Socket::HttpResponse connectRoute(const Socket::HttpRequest &requ);
+Socket::HttpResponse loadSkillSheet(const Socket::HttpRequest &requ);
+Socket::HttpResponse loadInternalAsset(const Socket::HttpRequest &requ);
+
+extern char profilePath[1024 + MAX_PATH];
+extern char parentPath[1024 + MAX_PATH];
+extern wchar_t soku2Path[1024 + MAX_PATH];
+extern std::vector<unsigned> availableCharacters;
+
+#endif //SWRSTOYS_GAMEHANDLERS_HPP
@@ -3,363 +3,656 @@
 //
 
 #include <nlohmann/json.hpp>
-#include <sstream>
-#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <set>
 #include "Handlers.hpp"
 #include "../State.hpp"
+#include "../Aggregator.hpp"
+#include "../Timeline.hpp"
 #include "../Exceptions.hpp"
+#include "../Metrics.hpp"
+#include "../HookTimer.hpp"
+#include "../Memory.hpp"
+#include "../Trace.hpp"
+#include "../Utils/ShiftJISDecoder.hpp"
+
+//! @throw std::length_error The name doesn't fit in a NameString once converted.
+static std::string convertName(const nlohmann::json &name)
+{
+	auto result = convertUTF8ToShiftJis(name.get<std::string>().c_str());
+
+	if (result.size() > NameString::capacity())
+		throw std::length_error("Names are limited to " + std::to_string(NameString::capacity()) + " bytes in Shift-JIS");
+	return result;
+}
 
-Socket::HttpResponse connectRoute(const Socket::HttpRequest &requ)
+struct PartialSide {
+	bool hasName = false;
+	bool hasScore = false;
+	std::string name;
+	unsigned score = 0;
+};
+
+//! @throw nlohmann::detail::exception A value has the wrong type, nothing was changed.
+//! @throw std::length_error A name or the round is too long, nothing was changed.
+static void applyPartialState(const nlohmann::json &partial)
+{
+	// Everything is converted and checked first, so a rejected state changes nothing and the strings are never truncated.
+	PartialSide sides[2];
+	bool hasRound = partial.contains("round");
+	std::string round = hasRound ? partial["round"].get<std::string>() : "";
+
+	if (round.size() > RoundString::capacity())
+		throw std::length_error("The round is limited to " + std::to_string(RoundString::capacity()) + " bytes");
+	for (int i = 0; i < 2; i++) {
+		auto name = i ? "right" : "left";
+
+		if (!partial.contains(name))
+			continue;
+
+		auto &chr = partial[name];
+		auto &side = sides[i];
+
+		side.hasName = chr.contains("name");
+		if (side.hasName)
+			side.name = convertName(chr["name"]);
+		side.hasScore = chr.contains("score");
+		if (side.hasScore)
+			side.score = chr["score"].get<unsigned>();
+	}
+
+	for (int i = 0; i < 2; i++) {
+		if (sides[i].hasName)
+			setName(_cache, !i, sides[i].name.c_str());
+		if (sides[i].hasScore)
+			(i ? _cache.rightScore : _cache.leftScore) = sides[i].score;
+	}
+	if (hasRound)
+		_cache.round = round;
+	_cache.version++;
+}
+
+static void setState(const Socket::HttpRequest &requ)
 {
 	if (requ.ip != 0x0100007F)
 		throw AbortConnectionException(403);
-	if (requ.method != "POST")
-		throw AbortConnectionException(405);
 
-	Socket::HttpResponse response;
-	auto menuObj = SokuLib::getMenuObj<SokuLib::MenuConnect>();
-	std::string ip;
-	unsigned short hport;
-	bool isSpec;
-	nlohmann::json json;
-	std::map<std::string, std::string> errors;
+	std::string json;
+
+	{
+		CacheWriteLock lock;
+
+		try {
+			applyPartialState(nlohmann::json::parse(requ.body));
+		} catch (nlohmann::detail::exception &e) {
+			throw AbortConnectionException(400, nlohmann::json{
+				{"error", "JSON error"},
+				{"details", e.what()},
+				{"body", requ.body}
+			}.dump(), "application/json");
+		} catch (std::length_error &e) {
+			throw AbortConnectionException(400, nlohmann::json{
+				{"error", "Value too long"},
+				{"details", e.what()}
+			}.dump(), "application/json");
+		}
+		_cache.noReset = true;
+		json = getStateJson(_cache);
+	}
+	// Not under the lock, the fan-out can take a while
+	broadcastOpcode(STATE_UPDATE, json);
+}
 
-	try {
-		json = nlohmann::json::parse(requ.body);
-	} catch (std::exception &e) {
-		throw AbortConnectionException(400, nlohmann::json{
-			{"error", "JSON parsing error"},
-			{"details", e.what()},
-			{"body", requ.body}
-		}.dump(), "application/json");
+//! @param data Filled with the new score.
+//! @return The opcode to broadcast the new score with, once the cache is unlocked.
+static Opcodes changeScore(const std::string &side, int diff, std::string &data)
+{
+	if (side == "left") {
+		_cache.leftScore += diff;
+		_cache.version++;
+		data = std::to_string(_cache.leftScore);
+		return L_SCORE_UPDATE;
 	}
-	if (!json.contains("ip"))
-		errors["ip"] = "This field is required";
-	if (!json.contains("port"))
-		errors["port"] = "This field is required";
-	if (!json.contains("spec"))
-		errors["spec"] = "This field is required";
-
-	if (errors.begin() != errors.end())
-		throw AbortConnectionException(400, nlohmann::json{errors}.dump(), "application/json");
-
-	if (!json["ip"].is_string())
-		errors["ip"] = "String expected but got " + std::string(json["ip"].type_name());
-	if (!json["port"].is_number())
-		errors["port"] = "Number expected but got " + std::string(json["port"].type_name());
-	if (!json["spec"].is_boolean())
-		errors["spec"] = "Boolean expected but got " + std::string(json["spec"].type_name());
-	if (errors.begin() != errors.end())
-		throw AbortConnectionException(400, nlohmann::json{errors}.dump(), "application/json");
-
-	ip = json["ip"];
-	hport = json["port"];
-	isSpec = json["spec"];
-	if (inet_addr(ip.c_str()) == -1)
-		throw AbortConnectionException(400, nlohmann::json{{{"ip", "This field is invalid"}}}.dump(), "application/json");
-
-	if (!SokuLib::MenuConnect::isInNetworkMenu()) {
-		SokuLib::MenuConnect::moveToConnectMenu();
-		menuObj = SokuLib::getMenuObj<SokuLib::MenuConnect>();
+	if (side == "right") {
+		_cache.rightScore += diff;
+		_cache.version++;
+		data = std::to_string(_cache.rightScore);
+		return R_SCORE_UPDATE;
 	}
+	throw std::invalid_argument("Invalid side " + side);
+}
 
-	if (
-		menuObj->choice >= SokuLib::MenuConnect::CHOICE_ASSIGN_IP_CONNECT &&
-		menuObj->choice < SokuLib::MenuConnect::CHOICE_SELECT_PROFILE &&
-		menuObj->subchoice == 3
-	)
-		throw AbortConnectionException(503);
-	if (
-		menuObj->choice >= SokuLib::MenuConnect::CHOICE_HOST &&
-		menuObj->choice < SokuLib::MenuConnect::CHOICE_SELECT_PROFILE &&
-		menuObj->subchoice == 255
-	)
-		throw AbortConnectionException(503);
-	if (
-		menuObj->choice == SokuLib::MenuConnect::CHOICE_HOST &&
-		menuObj->subchoice == 2
-	)
-		throw AbortConnectionException(503);
+static void handleCommand(WebSocket &s, const nlohmann::json &json)
+{
+	auto id = json.contains("id") ? json["id"] : nlohmann::json();
+	unsigned seq;
 
-	menuObj->joinHost(ip.c_str(), hport, isSpec);
-	response.returnCode = 202;
-	return response;
+	try {
+		if (s.getRemote().sin_addr.s_addr != 0x0100007F)
+			throw std::invalid_argument("Forbidden");
+
+		std::string cmd = json["cmd"];
+		auto data = json.value("d", nlohmann::json());
+		Opcodes op;
+		std::string message;
+
+		{
+			CacheWriteLock lock;
+
+			if (cmd == "set") {
+				applyPartialState(data);
+				_cache.noReset = true;
+				op = STATE_UPDATE;
+				message = getStateJson(_cache);
+			} else if (cmd == "increment")
+				op = changeScore(data, 1, message);
+			else if (cmd == "decrement")
+				op = changeScore(data, -1, message);
+			else
+				throw std::invalid_argument("Unknown command " + cmd);
+			seq = _cache.version;
+		}
+		broadcastOpcode(op, message);
+	} catch (std::exception &e) {
+		sendOpcode(s, COMMAND_ERROR, nlohmann::json{
+			{"id", id},
+			{"error", e.what()}
+		}.dump());
+		return;
+	}
+	sendOpcode(s, COMMAND_ACK, nlohmann::json{
+		{"id", id},
+		{"seq", seq}
+	}.dump());
 }
 
-Socket::HttpResponse root(const Socket::HttpRequest &requ)
+Socket::HttpResponse state(const Socket::HttpRequest &requ)
 {
 	Socket::HttpResponse response;
-	char buffer[1024] = {0};
+
+	response.returnCode = 200;
+	if (requ.method == "POST")
+		return setState(requ), response;
 
 	if (requ.method != "GET")
 		throw AbortConnectionException(405);
-	GetPrivateProfileStringA("Server", "DefaultPage", "", buffer, sizeof(buffer), profilePath);
-	puts(buffer);
-	if (!*buffer)
-		throw AbortConnectionException(404);
-	response.header["Location"] = buffer;
-	response.returnCode = 302;
+
+	auto encoding = requ.header.find("accept-encoding");
+	auto cache = readCache();
+
+	response.header["Content-Type"] = "application/json";
+	if (encoding != requ.header.end() && encoding->second.find("gzip") != std::string::npos)
+		getCompressedStateJson(cache, response.body);
+	if (response.body.empty())
+		getStateJson(cache, response.body);
+	else
+		response.header["Content-Encoding"] = "gzip";
 	return response;
 }
 
-const std::vector<std::string> convertedFormats{"txt", "csv", "lbl", "png", "bmp", "act", "wav", "xml"};
-const std::map<std::string, std::string> gameMimeTypes{
-	// Game format
-	{ "cv0", "application/octet-stream" }, // TYPE_TEXT,    TEXT_GAME
-	{ "cv1", "application/octet-stream" }, // TYPE_TABLE,   TABLE_GAME
-	{ "sfl", "application/octet-stream" }, // TYPE_LABEL,   LABEL_RIFF
-	{ "cv2", "application/octet-stream" }, // TYPE_IMAGE,   IMAGE_GAME
-	{ "pal", "application/octet-stream" }, // TYPE_PALETTE, PALETTE_PAL
-	{ "cv3", "application/octet-stream" }, // TYPE_SFX,     SFX_GAME
-	{ "ogg", "audio/ogg" },                // TYPE_BGM,     BGM_OGG
-	{ "dds", "application/octet-stream" }, // TYPE_TEXTURE, TEXTURE_DDS
-	{ "dat", "application/octet-stream" }, // TYPE_SCHEMA,  SCHEMA_GAME_GUI
-	{ "pat", "application/octet-stream" }, // TYPE_SCHEMA,  SCHEMA_GAME_PATTERN | SCHEMA_GAME_ANIM
-
-	// Standard format
-	{ "txt", "text/plain" },               // TYPE_TEXT,    TEXT_NORMAL
-	{ "csv", "text/plain" },               // TYPE_TABLE,   TABLE_CSV
-	{ "lbl", "text/plain" },               // TYPE_LABEL,   LABEL_LBL
-	{ "png", "image/png" },                // TYPE_IMAGE,   IMAGE_PNG
-	{ "bmp", "image/bmp" },                // TYPE_IMAGE,   IMAGE_BMP
-	{ "act", "application/octet-stream" }, // TYPE_PALETTE, PALETTE_ACT
-	{ "wav", "audio/wav" },                // TYPE_SFX,     SFX_WAV
-	{ "xml", "application/xml" },          // TYPE_SCHEMA,  SCHEMA_XML
-};
-const std::map<std::string, std::string> gameFormatExtensions{
-	// Standard format
-	{ "txt", "cv0" },
-	{ "csv", "cv1" },
-	{ "lbl", "sfl" },
-	{ "png", "cv2" },
-	{ "bmp", "cv2" },
-	{ "act", "pal" },
-	{ "wav", "cv3" },
-	{ "xml", "pat" }
-};
-const std::map<std::string, ShadyCore::FileType> gameFileTypes{
-	{ "txt", {ShadyCore::FileType::TYPE_TEXT,    ShadyCore::FileType::TEXT_NORMAL} },
-	{ "csv", {ShadyCore::FileType::TYPE_TABLE,   ShadyCore::FileType::TABLE_CSV} },
-	{ "lbl", {ShadyCore::FileType::TYPE_LABEL,   ShadyCore::FileType::LABEL_LBL} },
-	{ "png", {ShadyCore::FileType::TYPE_IMAGE,   ShadyCore::FileType::IMAGE_PNG} },
-	{ "bmp", {ShadyCore::FileType::TYPE_IMAGE,   ShadyCore::FileType::IMAGE_BMP} },
-	{ "act", {ShadyCore::FileType::TYPE_PALETTE, ShadyCore::FileType::PALETTE_ACT} },
-	{ "wav", {ShadyCore::FileType::TYPE_SFX,     ShadyCore::FileType::SFX_WAV} },
-	{ "xml", {ShadyCore::FileType::TYPE_SCHEMA,  ShadyCore::FileType::SCHEMA_XML} },
-};
-
-Socket::HttpResponse loadInternalAsset(const Socket::HttpRequest &requ)
+Socket::HttpResponse setups(const Socket::HttpRequest &requ)
 {
-	if (requ.realPath == "/internal")
-		throw AbortConnectionException(501);
+	if (!aggregator)
+		throw AbortConnectionException(404);
 	if (requ.method != "GET")
 		throw AbortConnectionException(405);
-	if (requ.realPath.back() == '/')
-		throw AbortConnectionException(501);
 
-	auto path = requ.realPath.substr(strlen("/internal/"));
-	auto pos = path.find_last_of('.');
+	Socket::HttpResponse response;
+
+	response.header["Content-Type"] = "application/json";
+	response.body = aggregator->getSetups().dump();
+	response.returnCode = 200;
+	return response;
+}
 
-	if (pos == std::string::npos)
+Socket::HttpResponse setupState(const Socket::HttpRequest &requ)
+{
+	if (!aggregator)
 		throw AbortConnectionException(404);
+	if (requ.method != "GET")
+		throw AbortConnectionException(405);
 
-	auto ext = path.substr(pos + 1);
-	SokuLib::PackageReader reader;
+	std::string id{std::string_view(requ.realPath).substr(strlen("/setups/"))};
 	Socket::HttpResponse response;
-	char *buffer;
-	auto it = gameFormatExtensions.find(ext);
-
-	if (it != gameFormatExtensions.end())
-		path = path.substr(0, pos + 1) + it->second;
+	nlohmann::json json;
 
-	reader.open(path.c_str());
-	if (!reader.isOpen() && ext == "xml") {
-		path = path.substr(0, pos + 1) + "dat";
-		reader.open(path.c_str());
-	}
-	if (!reader.isOpen())
+	id = id.substr(0, id.find('/'));
+	try {
+		json = aggregator->getState(id);
+	} catch (std::out_of_range &) {
 		throw AbortConnectionException(404);
-	buffer = new char[reader.GetLength()];
-	reader.Read(buffer, reader.GetLength());
-	reader.close();
-
-	response.body = std::string{buffer, buffer + reader.GetLength()};
-	if (std::find(convertedFormats.begin(), convertedFormats.end(), ext) != convertedFormats.end()) {
-		std::stringstream input;
-		std::stringstream body;
-		auto fileType = gameFileTypes.at(ext);
-
-		input.str(response.body);
-		switch (fileType.type) {
-		case ShadyCore::FileType::TYPE_IMAGE: {
-			ShadyCore::Image image;
-
-			ShadyCore::getResourceReader({ShadyCore::FileType::TYPE_IMAGE, ShadyCore::FileType::IMAGE_GAME})(&image, input);
-			if (image.bitsPerPixel == 8 && requ.query.find("palette") != requ.query.end())
-				throw AbortConnectionException(501);
-			ShadyCore::getResourceWriter(fileType)(&image, body);
-			break;
-		}
-		case ShadyCore::FileType::TYPE_TEXT:
-		case ShadyCore::FileType::TYPE_TABLE:
-		case ShadyCore::FileType::TYPE_LABEL:
-		case ShadyCore::FileType::TYPE_PALETTE:
-		case ShadyCore::FileType::TYPE_SFX:
-		case ShadyCore::FileType::TYPE_BGM:
-		case ShadyCore::FileType::TYPE_SCHEMA:
-		case ShadyCore::FileType::TYPE_TEXTURE:
-			throw AbortConnectionException(501);
-		}
-		response.body = body.str();
 	}
+	if (json.is_null())
+		throw AbortConnectionException(503);
+	response.header["Content-Type"] = "application/json";
+	response.body = json.dump();
 	response.returnCode = 200;
-	response.header["Content-Type"] = gameMimeTypes.at(ext);
-	response.header["Cache-Control"] = "private, immutable, max-age=" + std::to_string(GetPrivateProfileIntA("Server", "Cache", 0, profilePath));
 	return response;
 }
 
-Socket::HttpResponse getCharNames(const Socket::HttpRequest &requ)
+Socket::HttpResponse history(const Socket::HttpRequest &requ)
 {
+	if (!timeline)
+		throw AbortConnectionException(404);
 	if (requ.method != "GET")
 		throw AbortConnectionException(405);
 
 	Socket::HttpResponse response;
-	nlohmann::json json = nlohmann::json::object();
 
-	for (auto id : availableCharacters)
-		json[std::to_string(id)] = SokuLib::getCharName(id);
-	response.body = json.dump();
-	response.header["Cache-Control"] = "private, immutable, max-age=" + std::to_string(GetPrivateProfileIntA("Server", "Cache", 0, profilePath));
 	response.header["Content-Type"] = "application/json";
+	response.body = timeline->getMatches().dump();
 	response.returnCode = 200;
 	return response;
 }
 
-Socket::HttpResponse getCharName(const Socket::HttpRequest &requ)
+Socket::HttpResponse matchHistory(const Socket::HttpRequest &requ)
 {
+	if (!timeline)
+		throw AbortConnectionException(404);
 	if (requ.method != "GET")
 		throw AbortConnectionException(405);
 
-	auto id = std::stoul(requ.realPath.substr(strlen("/charName/")));
-
-	if (std::find(availableCharacters.begin(), availableCharacters.end(), id) == availableCharacters.end())
-		throw AbortConnectionException(404);
-
-	auto name = SokuLib::getCharName(id);
+	auto from = requ.query.find("from");
+	auto to = requ.query.find("to");
 	Socket::HttpResponse response;
+	nlohmann::json json;
 
-	response.header["Cache-Control"] = "private, immutable, max-age=" + std::to_string(GetPrivateProfileIntA("Server", "Cache", 0, profilePath));
-	response.header["Content-Type"] = "text/plain";
-	response.body = name;
+	try {
+		json = timeline->getEvents(
+			std::stoul(std::string(std::string_view(requ.realPath).substr(strlen("/history/")))),
+			from == requ.query.end() ? 0 : std::stoul(std::string(from->second)),
+			to == requ.query.end() ? UINT32_MAX : std::stoul(std::string(to->second))
+		);
+	} catch (std::invalid_argument &) {
+		throw AbortConnectionException(400);
+	} catch (std::out_of_range &) {
+		throw AbortConnectionException(404);
+	}
+	response.header["Content-Type"] = "application/json";
+	response.body = json.dump();
 	response.returnCode = 200;
 	return response;
 }
 
-Socket::HttpResponse loadSkillSheet(const Socket::HttpRequest &requ)
+struct ClientLatency {
+	std::string name;
+	unsigned long long count = 0;
+	double average = 0;
+	long long max = 0;
+};
+
+static std::mutex clientLatenciesMutex;
+static std::map<WebSocket *, ClientLatency> clientLatencies;
+
+static Metrics::Samples collectClientLatencies(bool max)
 {
-	if (requ.method != "GET")
-		throw AbortConnectionException(405);
+	std::lock_guard<std::mutex> lock{clientLatenciesMutex};
+	Metrics::Samples result;
 
-	auto id = std::stoul(requ.realPath.substr(strlen("/skillSheet/")));
+	for (auto &[sock, latency] : clientLatencies)
+		result.emplace_back(Metrics::label("client", latency.name), (max ? latency.max : latency.average) * 1e-9);
+	return result;
+}
 
-	if (std::find(availableCharacters.begin(), availableCharacters.end(), id) == availableCharacters.end())
-		throw AbortConnectionException(404);
+static void onAck(WebSocket &s, const nlohmann::json &ack)
+{
+	static const auto roundTrip = []{
+		Metrics::addCollector("sokustreaming_client_round_trip_average_seconds", "Moving average of the round trip time of each connected client.", Metrics::GAUGE, []{
+			return collectClientLatencies(false);
+		});
+		Metrics::addCollector("sokustreaming_client_round_trip_max_seconds", "Longest round trip time of each connected client.", Metrics::GAUGE, []{
+			return collectClientLatencies(true);
+		});
+		return Metrics::histogram("sokustreaming_client_round_trip_seconds", "Time from sampling the game to a client acknowledging the message.", Metrics::latencyBuckets, 1e-9);
+	}();
+
+	if (!traceMessages || !ack.is_number_integer())
+		return;
+
+	auto time = Metrics::now() - ack.get<long long>();
+
+	// Anything else didn't come from this server
+	if (time < 0 || time > 60000000000LL)
+		return;
+	roundTrip.observe(time);
+
+	std::lock_guard<std::mutex> lock{clientLatenciesMutex};
+	auto &latency = clientLatencies[&s];
+
+	if (latency.name.empty())
+		latency.name = std::string(inet_ntoa(s.getRemote().sin_addr)) + ":" + std::to_string(ntohs(s.getRemote().sin_port));
+	// Smooth over the last 16 or so acks
+	latency.average = latency.count ? latency.average + (time - latency.average) / 16 : time;
+	latency.max = (std::max)(latency.max, time);
+	latency.count++;
+}
 
-	auto name = SokuLib::getCharName(id);
-	Socket::HttpResponse response;
-	std::filesystem::path path;
+static std::mutex deltaClientsMutex;
+static std::set<WebSocket *> deltaClients;
+
+static bool wantsDeltas(WebSocket &s)
+{
+	std::lock_guard<std::mutex> lock{deltaClientsMutex};
 
-	if (id < 20)
-		path = std::filesystem::path(parentPath) / "skillSheets" / (name + std::string("Skills.png"));
+	return deltaClients.count(&s) != 0;
+}
+
+static void setWantsDeltas(WebSocket &s, bool deltas)
+{
+	std::lock_guard<std::mutex> lock{deltaClientsMutex};
+
+	if (deltas)
+		deltaClients.insert(&s);
 	else
-		path = std::filesystem::path(soku2Path) / "sheets" / (name + std::string("Skills.png"));
+		deltaClients.erase(&s);
+}
 
-	std::ifstream stream{path, std::ifstream::binary};
+void onNewWebSocket(WebSocket &s)
+{
+	sendOpcode(s, STATE_UPDATE, getStateJson(readCache()));
+}
 
-	puts(path.string().c_str());
-	if (stream.fail())
-		throw AbortConnectionException(404);
+void onWebSocketMessage(WebSocket &s, const std::string &msg)
+{
+	nlohmann::json json;
 
+	try {
+		json = nlohmann::json::parse(msg);
+	} catch (nlohmann::detail::exception &) {
+		return;
+	}
+	if (!json.is_object())
+		return;
+	if (json.contains("cmd"))
+		return handleCommand(s, json);
+	if (json.contains("ack"))
+		return onAck(s, json["ack"]);
+	if (json.contains("deltas") && json["deltas"].is_boolean())
+		return setWantsDeltas(s, json["deltas"]);
+	if (!aggregator)
+		return;
+	try {
+		if (json.contains("follow"))
+			aggregator->follow(s, json["follow"].get<std::vector<std::string>>());
+		if (json.contains("unfollow"))
+			aggregator->unfollow(s, json["unfollow"].get<std::vector<std::string>>());
+	} catch (nlohmann::detail::exception &) {}
+}
+
+void onWebSocketClose(WebSocket &s)
+{
+	clientLatenciesMutex.lock();
+	clientLatencies.erase(&s);
+	clientLatenciesMutex.unlock();
+	setWantsDeltas(s, false);
+	if (aggregator)
+		aggregator->forget(s);
+}
+
+void sendOpcode(WebSocket &s, Opcodes op, const std::string &data)
+{
+	std::string json = "{"
+		"\"o\": " + std::to_string(op) + ","
+		"\"d\": " + data +
+	"}";
+
+	s.send(json);
+}
+
+Socket::HttpResponse metrics(const Socket::HttpRequest &requ)
+{
+	Socket::HttpResponse response;
+
+	if (requ.method != "GET")
+		throw AbortConnectionException(405);
 	response.returnCode = 200;
-	response.header["Cache-Control"] = "private, immutable, max-age=" + std::to_string(GetPrivateProfileIntA("Server", "Cache", 0, profilePath));
-	response.header["Content-Type"] = "image/png";
-	response.body = {std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()};
+	response.header["Content-Type"] = "text/plain; version=0.0.4; charset=utf-8";
+	response.body = Metrics::render();
 	return response;
 }
 
-static void setState(const Socket::HttpRequest &requ)
+Socket::HttpResponse stalls(const Socket::HttpRequest &requ)
 {
-	if (requ.ip != 0x0100007F)
-		throw AbortConnectionException(403);
-	try {
-		auto result = nlohmann::json::parse(requ.body);
+	Socket::HttpResponse response;
 
-		if (result.contains("left")) {
-			auto &chr = result["left"];
+	if (requ.method != "GET")
+		throw AbortConnectionException(405);
+	response.returnCode = 200;
+	response.header["Content-Type"] = "application/json";
+	response.body = getStalls().dump();
+	return response;
+}
 
-			if (chr.contains("name"))
-				_cache.leftName = chr["name"];
-			if (chr.contains("score"))
-				_cache.leftScore = chr["score"];
-		}
-		if (result.contains("right")) {
-			auto &chr = result["right"];
+Socket::HttpResponse trace(const Socket::HttpRequest &requ)
+{
+	Socket::HttpResponse response;
+	auto it = requ.query.find("seconds");
+	double seconds = 1;
 
-			if (chr.contains("name"))
-				_cache.rightName = chr["name"];
-			if (chr.contains("score"))
-				_cache.rightScore = chr["score"];
+	if (requ.method != "GET")
+		throw AbortConnectionException(405);
+	if (it != requ.query.end())
+		try {
+			seconds = std::stod(std::string(it->second));
+		} catch (std::exception &) {
+			throw AbortConnectionException(400);
 		}
-		if (result.contains("round"))
-			_cache.round = result["round"];
-	} catch (nlohmann::detail::exception &e) {
-		throw AbortConnectionException(400, nlohmann::json{
-			{"error", "JSON error"},
-			{"details", e.what()},
-			{"body", requ.body}
-		}.dump(), "application/json");
+	if (!(seconds > 0 && seconds <= 60))
+		throw AbortConnectionException(400);
+	try {
+		response.body = Trace::capture(seconds * 1000);
+	} catch (std::logic_error &) {
+		throw AbortConnectionException(409);
 	}
-	broadcastOpcode(STATE_UPDATE, cacheToJson(_cache));
-	_cache.noReset = true;
+	response.returnCode = 200;
+	response.header["Content-Type"] = "application/json";
+	response.header["Content-Disposition"] = "attachment; filename=\"trace.json\"";
+	return response;
 }
 
-Socket::HttpResponse state(const Socket::HttpRequest &requ)
+Socket::HttpResponse memory(const Socket::HttpRequest &requ)
 {
 	Socket::HttpResponse response;
 
-	response.returnCode = 200;
-	if (requ.method == "POST")
-		return setState(requ), response;
-
 	if (requ.method != "GET")
 		throw AbortConnectionException(405);
-
+	response.returnCode = 200;
 	response.header["Content-Type"] = "application/json";
-	response.body = cacheToJson(_cache);
+	response.body = Memory::report();
 	return response;
 }
 
-void onNewWebSocket(WebSocket &s)
+struct BroadcastMetrics {
+	Metrics::Counter messages;
+	Metrics::Histogram size;
+	Metrics::Histogram fanOut;
+};
+
+//! @return Whether the opcode is sent during the battles, and not only now and then.
+static bool isFrequent(int op)
 {
-	sendOpcode(s, STATE_UPDATE, cacheToJson(_cache));
+	switch (op) {
+	case STATE_UPDATE:
+	case CARDS_UPDATE:
+	case L_CARDS_UPDATE:
+	case R_CARDS_UPDATE:
+	case L_STATS_UPDATE:
+	case R_STATS_UPDATE:
+	case STATE_DELTA:
+		return true;
+	default:
+		return false;
+	}
 }
 
-void sendOpcode(WebSocket &s, Opcodes op, const std::string &data)
+//! One entry per opcode, and a last one for the batches.
+static BroadcastMetrics *getBroadcastMetrics()
 {
-	std::string json = "{"
-		"\"o\": " + std::to_string(op) + ","
-		"\"d\": " + data +
-	"}";
+	static BroadcastMetrics *metrics = []{
+		auto result = new BroadcastMetrics[STATE_DELTA + 2];
+
+		for (int i = 0; i <= STATE_DELTA + 1; i++) {
+			auto labels = Metrics::label("opcode", i <= STATE_DELTA ? std::to_string(i) : "batch");
+			// The rare opcodes share their histograms, they would be almost empty anyway
+			auto histogramLabels = i > STATE_DELTA || isFrequent(i) ? labels : Metrics::label("opcode", "other");
+
+			if (i <= STATE_DELTA) {
+				result[i].messages = Metrics::counter("sokustreaming_broadcast_messages_total", "Messages broadcast, by opcode.", labels);
+				result[i].size = Metrics::histogram("sokustreaming_broadcast_message_bytes", "Size of the broadcast messages, by opcode. The rare ones are under the other opcode.", Metrics::sizeBuckets, 1, histogramLabels);
+			}
+			result[i].fanOut = Metrics::histogram(
+				"sokustreaming_broadcast_fanout_seconds",
+				"Time taken to send a message to all the clients, by opcode. Batches and the rare opcodes have their own opcode label.",
+				Metrics::latencyBuckets,
+				1e-9,
+				histogramLabels
+			);
+		}
+		return result;
+	}();
 
-	s.send(json);
+	return metrics;
 }
 
-void broadcastOpcode(Opcodes op, const std::string &data)
+struct BroadcastOrigin {
+	bool set = false;
+	unsigned frame;
+	long long sampledAt;
+};
+
+static thread_local BroadcastOrigin origin;
+
+void setBroadcastOrigin(unsigned frame, long long sampledAt)
 {
+	origin.set = true;
+	origin.frame = frame;
+	origin.sampledAt = sampledAt;
+}
+
+void clearBroadcastOrigin()
+{
+	origin.set = false;
+}
+
+static void broadcast(const std::string &msg, int index, Audience audience)
+{
+	static const auto sampleToBroadcast = Metrics::histogram("sokustreaming_sample_to_broadcast_seconds", "Time from sampling the game to sending the resulting messages.", Metrics::latencyBuckets, 1e-9);
+	auto start = Metrics::now();
+
+	if (origin.set)
+		sampleToBroadcast.observe(start - origin.sampledAt);
+	if (audience == AUDIENCE_ALL)
+		webServer->broadcast(msg);
+	else
+		webServer->broadcast(msg, [audience](WebSocket &sock){
+			return wantsDeltas(sock) == (audience == AUDIENCE_DELTAS);
+		});
+	getBroadcastMetrics()[index].fanOut.observe(Metrics::now() - start);
+}
+
+struct Batch {
+	std::string json;
+	unsigned size = 0;
+	//! Opcode of the first message, which is the one recorded when it is sent alone.
+	Opcodes op;
+};
+
+// Only the thread which started the batch (the game thread) puts its messages in it.
+static thread_local bool batching = false;
+// The legacy clients and the delta clients only need their own batch once a message is meant for only one of them.
+// Until then everything is in the first one, sent to everyone.
+static thread_local bool batchSplit = false;
+static thread_local Batch batches[2];
+
+static void addToBatch(Batch &batch, const std::string &json, Opcodes op)
+{
+	if (!batch.size)
+		batch.op = op;
+	batch.json += ",";
+	batch.json += json;
+	batch.size++;
+}
+
+static void sendBatch(Batch &batch, Audience audience)
+{
+	if (batch.size == 1)
+		// Don't wrap lone messages so the most common case is unchanged for clients.
+		broadcast(batch.json.substr(1), batch.op, audience);
+	else if (batch.size) {
+		batch.json[0] = '[';
+		batch.json.push_back(']');
+		broadcast(batch.json, STATE_DELTA + 1, audience);
+	}
+	batch.json.clear();
+	batch.size = 0;
+}
+
+void beginBroadcastBatch()
+{
+	batching = true;
+	batchSplit = false;
+	for (auto &batch : batches) {
+		batch.json.clear();
+		batch.size = 0;
+	}
+}
+
+void endBroadcastBatch()
+{
+	batching = false;
+	if (batchSplit) {
+		sendBatch(batches[0], AUDIENCE_LEGACY);
+		sendBatch(batches[1], AUDIENCE_DELTAS);
+	} else
+		sendBatch(batches[0], AUDIENCE_ALL);
+}
+
+bool timestampMessages = false;
+bool traceMessages = false;
+
+void broadcastOpcode(Opcodes op, const std::string &data, Audience audience)
+{
+	static const auto duration = Metrics::histogram("sokustreaming_broadcast_opcode_duration_seconds", "Time spent in broadcastOpcode, including the fan-out when not batched.", getHookBuckets(), 1e-9);
+	auto start = Metrics::now();
 	std::string json = "{"
 		"\"o\": " + std::to_string(op) + ","
-		"\"d\": " + data +
-	"}";
+		"\"d\": " + data;
+
+	if (timestampMessages) {
+		auto now = std::chrono::system_clock::now().time_since_epoch();
 
-	webServer->broadcast(json);
+		json += ",\"t\": " + std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(now).count());
+	}
+	if (traceMessages) {
+		if (origin.set)
+			json += ",\"f\": " + std::to_string(origin.frame);
+		json += ",\"ts\": " + std::to_string(origin.set ? origin.sampledAt : start);
+	}
+	json += "}";
+
+	auto &metrics = getBroadcastMetrics()[op];
+
+	metrics.messages.add();
+	metrics.size.observe(json.size());
+	HookTimer::noteOpcode(op);
+	if (!batching)
+		broadcast(json, op, audience);
+	else if (audience == AUDIENCE_ALL) {
+		addToBatch(batches[0], json, op);
+		if (batchSplit)
+			addToBatch(batches[1], json, op);
+	} else {
+		if (!batchSplit) {
+			// Everything batched so far was for both
+			batches[1].json = batches[0].json;
+			batches[1].size = batches[0].size;
+			batches[1].op = batches[0].op;
+			batchSplit = true;
+		}
+		addToBatch(batches[audience == AUDIENCE_DELTAS], json, op);
+	}
+	duration.observe(Metrics::now() - start);
 }
@@ -7,7 +7,6 @@
 
 
 #include "WebServer.hpp"
-#include "package.hpp"
 
 enum Opcodes {
 	STATE_UPDATE,   // 0
@@ -24,22 +23,49 @@ enum Opcodes {
 	GAME_STARTED,   //11
 	SESSION_ENDED,  //12
 	SESSION_STARTED,//13
+	COMMAND_ACK,    //14
+	COMMAND_ERROR,  //15
+	STATE_DELTA,    //16
+};
+
+//! @brief Clients a broadcast is meant for.
+//! Clients get the per-side update opcodes until they ask for STATE_DELTA instead with {"deltas": true}.
+enum Audience {
+	AUDIENCE_ALL,
+	AUDIENCE_LEGACY,
+	AUDIENCE_DELTAS,
 };
 
-Socket::HttpResponse root(const Socket::HttpRequest &requ);
 Socket::HttpResponse state(const Socket::HttpRequest &requ);
-Socket::HttpResponse getCharName(const Socket::HttpRequest &requ);
-Socket::HttpResponse getCharNames(const Socket::HttpRequest &requ);
-Socket::HttpResponse connectRoute(const Socket::HttpRequest &requ);
-Socket::HttpResponse loadSkillSheet(const Socket::HttpRequest &requ);
-Socket::HttpResponse loadInternalAsset(const Socket::HttpRequest &requ);
+Socket::HttpResponse setups(const Socket::HttpRequest &requ);
+Socket::HttpResponse setupState(const Socket::HttpRequest &requ);
+Socket::HttpResponse history(const Socket::HttpRequest &requ);
+Socket::HttpResponse matchHistory(const Socket::HttpRequest &requ);
+//! @brief Every recorded metric, in the Prometheus text format.
+Socket::HttpResponse metrics(const Socket::HttpRequest &requ);
+//! @brief The last hooks which went over the stall budget.
+Socket::HttpResponse stalls(const Socket::HttpRequest &requ);
+//! @brief Trace the server for the number of seconds given in the query. Must be added as a slow route.
+Socket::HttpResponse trace(const Socket::HttpRequest &requ);
+//! @brief The memory used by each subsystem.
+Socket::HttpResponse memory(const Socket::HttpRequest &requ);
 void onNewWebSocket(WebSocket &s);
+void onWebSocketMessage(WebSocket &s, const std::string &msg);
+void onWebSocketClose(WebSocket &s);
 void sendOpcode(WebSocket &s, Opcodes op, const std::string &data);
-void broadcastOpcode(Opcodes op, const std::string &data);
-
-extern char profilePath[1024 + MAX_PATH];
-extern char parentPath[1024 + MAX_PATH];
-extern wchar_t soku2Path[1024 + MAX_PATH];
-extern std::vector<unsigned> availableCharacters;
+void broadcastOpcode(Opcodes op, const std::string &data, Audience audience = AUDIENCE_ALL);
+//! @brief When set, broadcastOpcode adds the time it was called at to the messages ("t", in microseconds since the epoch).
+extern bool timestampMessages;
+//! @brief Hold all the following broadcastOpcode calls of this thread
+//! until endBroadcastBatch, which sends them all in a single message.
+void beginBroadcastBatch();
+void endBroadcastBatch();
+//! @brief When set, broadcastOpcode adds the frame ("f") of the sample which caused the message, if any,
+//! and the server monotonic time in nanoseconds ("ts") at which it was sampled, or at which the message was made.
+//! Clients sending that time back as {"ack": ts} get their round trip time measured.
+extern bool traceMessages;
+//! @brief Mark the following broadcasts of this thread as caused by a sample, until clearBroadcastOrigin.
+void setBroadcastOrigin(unsigned frame, long long sampledAt);
+void clearBroadcastOrigin();
 
 #endif //SWRSTOYS_HANDLERS_HPP
@@ -2,10 +2,15 @@
 // Created by Gegel85 on 05/04/2019.
 //
 
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
 #include <cstring>
 #include <sstream>
 #include "Socket.hpp"
 #include "../Exceptions.hpp"
+#include "../Metrics.hpp"
+#include "../Trace.hpp"
 
 #ifndef _WIN32
 #include <unistd.h>
@@ -19,9 +24,19 @@
 #	include <arpa/inet.h>
 #	include <sys/select.h>
 	typedef fd_set FD_SET;
+	typedef socklen_t SOCKLEN;
+#	define GetLastError() errno
+#else
+	typedef int SOCKLEN;
+	// Windows never raises a signal when the peer is gone
+#	define MSG_NOSIGNAL 0
+#	define SHUT_RDWR 2
 #endif
 
 
+static const Metrics::Counter receivedBytes = Metrics::counter("sokustreaming_network_received_bytes_total", "Bytes received on all the sockets.");
+static const Metrics::Counter sentBytes = Metrics::counter("sokustreaming_network_sent_bytes_total", "Bytes sent on all the sockets.");
+
 std::string getLastSocketError()
 {
 #ifdef _WIN32
@@ -52,6 +67,27 @@ std::string getLastSocketError()
 #endif
 }
 
+Socket::HttpRequest::HttpRequest(std::pmr::memory_resource *resource) :
+	httpVer(resource),
+	body(resource),
+	method(resource),
+	host(resource),
+	header(resource),
+	path(resource),
+	query(resource),
+	realPath(resource)
+{
+}
+
+Socket::HttpResponse::HttpResponse(std::pmr::memory_resource *resource) :
+	request(resource),
+	header(resource),
+	codeName(resource),
+	httpVer(resource),
+	body(resource)
+{
+}
+
 Socket::Socket()
 {
 #ifdef _WIN32
@@ -66,23 +102,47 @@ Socket::~Socket()
 	Socket::disconnect();
 }
 
-void Socket::connect(const std::string &host, unsigned short portno)
+unsigned Socket::resolve(const std::string &host)
 {
-	struct hostent	*server;
+#ifdef _WIN32
+	unsigned long ip = inet_addr(host.c_str());
 
-	if (this->isOpen())
-		throw AlreadyOpenedException("This socket is already opened");
+	if (ip != INADDR_NONE)
+		return ip;
 
-	/* create the socket */
-	this->_sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (this->_sockfd == INVALID_SOCKET)
-		throw SocketCreationErrorException(getLastSocketError());
+	// Winsock keeps the result in a buffer of the calling thread
+	struct hostent *server = gethostbyname(host.c_str());
 
-	/* lookup the ip address */
-	server = gethostbyname(host.c_str());
 	if (server == nullptr)
 		throw HostNotFoundException("Cannot find host '" + host + "'");
-	this->connect(*reinterpret_cast<unsigned *>(server->h_addr), portno);
+	return *reinterpret_cast<unsigned *>(server->h_addr);
+#else
+	struct in_addr addr;
+
+	if (inet_pton(AF_INET, host.c_str(), &addr) == 1)
+		return addr.s_addr;
+
+	// Unlike gethostbyname, getaddrinfo doesn't share its result between the threads
+	struct addrinfo hints = {};
+	struct addrinfo *result = nullptr;
+
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0 || result == nullptr)
+		throw HostNotFoundException("Cannot find host '" + host + "'");
+
+	unsigned ip = reinterpret_cast<sockaddr_in *>(result->ai_addr)->sin_addr.s_addr;
+
+	freeaddrinfo(result);
+	return ip;
+#endif
+}
+
+void Socket::connect(const std::string &host, unsigned short portno)
+{
+	if (this->isOpen())
+		throw AlreadyOpenedException("This socket is already opened");
+	this->connect(resolve(host), portno);
 }
 
 void Socket::connect(unsigned int ip, unsigned short portno)
@@ -92,14 +152,22 @@ void Socket::connect(unsigned int ip, unsigned short portno)
 	if (this->isOpen())
 		throw AlreadyOpenedException("This socket is already opened");
 
+	/* create the socket */
+	this->_sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (this->_sockfd == INVALID_SOCKET)
+		throw SocketCreationErrorException(getLastSocketError());
+
 	/* fill in the structure */
 	serv_addr.sin_family = AF_INET;
 	serv_addr.sin_port = htons(portno);
 	serv_addr.sin_addr.s_addr = ip;
 
 	/* connect the socket */
-	if (::connect(this->_sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+	if (::connect(this->_sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+		close(this->_sockfd);
+		this->_sockfd = INVALID_SOCKET;
 		throw ConnectException(std::string("Cannot connect to ") + inet_ntoa(serv_addr.sin_addr));
+	}
 	this->_opened = true;
 }
 
@@ -118,7 +186,8 @@ Socket::HttpResponse Socket::makeHttpRequest(const Socket::HttpRequest &request)
 	if (ip != INADDR_NONE)
 		this->connect(ip, request.portno);
 	else
-		this->connect(request.host, request.portno);
+		this->connect(std::string(request.host), request.portno);
+	this->send(requestString);
 
 	HttpResponse response = this->readHttpResponse();
 
@@ -137,42 +206,100 @@ void Socket::disconnect()
 	this->_opened = false;
 }
 
-std::string Socket::_read(int size, timeval *timeout)
+void Socket::_wait(timeval *timeout)
 {
 	FD_SET set;
-	std::string result;
 
 	FD_ZERO(&set);
 	FD_SET(this->_sockfd, &set);
 	if (select(this->_sockfd + 1, &set, nullptr, nullptr, timeout) <= 0)
 		throw EOFException(GetLastError() == 0 ? "End of file" : getLastSocketError());
+}
 
-	result.resize(size);
-
-	int bytes = recv(this->_sockfd, result.data(), size, 0);
+size_t Socket::_read(char *buffer, size_t size)
+{
+	int bytes = recv(this->_sockfd, buffer, size, 0);
 
-	if (bytes == 0 && !result.empty())
-		return result;
 	if (bytes == 0)
 		throw EOFException("End of file");
 	if (bytes < 0)
 		throw EOFException(getLastSocketError());
-	result.resize(bytes);
-	return result;
+	receivedBytes.add(bytes);
+	return bytes;
 }
 
-std::string Socket::read(int size, timeval *timeout)
+void Socket::_receive(timeval *timeout, size_t size)
+{
+	// Before borrowing the buffer, so the idle connections don't hold one
+	this->_wait(timeout);
+
+	// Move what wasn't read yet to the front to make room
+	if (this->_bufferStart) {
+		memmove(this->_buffer.data(), this->_buffer.data() + this->_bufferStart, this->_buffer.size() - this->_bufferStart);
+		this->_buffer.resize(this->_buffer.size() - this->_bufferStart);
+		this->_bufferStart = 0;
+	}
+	if (this->_buffer.capacity() < size)
+		this->_buffer.reserve(size);
+	else if (this->_buffer.size() == this->_buffer.capacity())
+		this->_buffer.reserve(std::max(this->_buffer.capacity() * 2, IOBuffer::smallSize));
+
+	size_t bytes;
+
+	try {
+		bytes = this->_read(this->_buffer.data() + this->_buffer.size(), this->_buffer.capacity() - this->_buffer.size());
+	} catch (...) {
+		// The connection is most likely closed, it won't need it anymore
+		this->_releaseBuffer();
+		throw;
+	}
+	this->_buffer.resize(this->_buffer.size() + bytes);
+}
+
+std::string_view Socket::_buffered() const
+{
+	return this->_buffer.view().substr(this->_bufferStart);
+}
+
+void Socket::_consume(size_t size)
+{
+	this->_bufferStart += size;
+}
+
+void Socket::_releaseBuffer()
 {
-	this->_mutex.lock();
-	if (this->_buffer.empty()) {
-		this->_mutex.unlock();
-		return this->_read(size, timeout);
+	if (this->_bufferStart < this->_buffer.size())
+		return;
+	this->_buffer.release();
+	this->_bufferStart = 0;
+}
+
+std::string_view Socket::_getline(const char *delim, timeval *timeout)
+{
+	size_t pos = this->_buffered().find_first_of(delim);
+
+	while (pos == std::string::npos) {
+		this->_receive(timeout);
+		pos = this->_buffered().find_first_of(delim);
 	}
 
-	std::string result = this->_buffer.substr(0, size);
+	auto line = this->_buffered().substr(0, pos + strlen(delim));
+
+	this->_consume(line.size());
+	return line;
+}
 
-	this->_buffer = this->_buffer.substr(size);
-	this->_mutex.unlock();
+std::string Socket::read(int size, timeval *timeout)
+{
+	std::lock_guard<std::mutex> lock{this->_mutex};
+
+	if (this->_buffered().empty())
+		this->_receive(timeout);
+
+	std::string result{this->_buffered().substr(0, size)};
+
+	this->_consume(result.size());
+	this->_releaseBuffer();
 	return result;
 }
 
@@ -181,89 +308,107 @@ std::string Socket::readExactly(int size, timeval *timeout)
 	if (size == 0)
 		return "";
 
-	this->_mutex.lock();
-	try {
-		while (size < this->_buffer.size())
-			this->_buffer += this->_read(1024, timeout);
+	std::lock_guard<std::mutex> lock{this->_mutex};
 
-		std::string result = this->_buffer.substr(0, size);
+	while (this->_buffered().size() < static_cast<size_t>(size))
+		this->_receive(timeout, size);
 
-		this->_buffer = this->_buffer.substr(size);
-		this->_mutex.unlock();
-		return result;
-	} catch (...) {
-		this->_mutex.unlock();
-		throw;
-	}
+	std::string result{this->_buffered().substr(0, size)};
+
+	this->_consume(size);
+	this->_releaseBuffer();
+	return result;
 }
 
 std::string Socket::getline(const char *delim, timeval *timeout)
 {
-	this->_mutex.lock();
-	try {
-		size_t pos = this->_buffer.find_first_of(delim);
+	std::lock_guard<std::mutex> lock{this->_mutex};
+	std::string result{this->_getline(delim, timeout)};
 
-		while (pos == std::string::npos) {
-			this->_buffer += this->_read(1024, timeout);
-			pos = this->_buffer.find_first_of(delim);
-		}
-
-		std::string result = this->_buffer.substr(0, pos + strlen(delim));
-
-		this->_buffer = this->_buffer.substr(pos + strlen(delim));
-		this->_mutex.unlock();
-		return result;
-	} catch (...) {
-		this->_mutex.unlock();
-		throw;
-	}
+	this->_releaseBuffer();
+	return result;
 }
 
-Socket::HttpRequest Socket::readHttpRequest(timeval *timeout)
+//! @brief Take the next word of a line, as operator>> would.
+//! @return An empty view if there are no words left.
+static std::string_view nextWord(std::string_view &line)
 {
-	auto line = this->getline("\r\n", timeout);
-	std::stringstream header(line);
-	HttpRequest request;
+	size_t start = 0;
 
-	header >> request.method;
-	header >> request.path;
-	header >> request.httpVer;
+	while (start < line.size() && std::isspace(line[start]))
+		start++;
 
-	if (header.fail())
-		throw InvalidHTTPAnswerException("Invalid HTTP request (Invalid first line)");
+	size_t end = start;
 
-	for (std::string str = this->getline("\r\n", timeout); str.length() > 2; str = this->getline("\r\n", timeout)) {
-		std::size_t pos = str.find(':');
+	while (end < line.size() && !std::isspace(line[end]))
+		end++;
 
-		if (pos == std::string::npos)
-			throw InvalidHTTPAnswerException("Invalid HTTP request (Invalid header line)");
+	auto word = line.substr(start, end - start);
 
-		std::string name = str.substr(0, pos);
-		size_t end = str.size() - 3;
+	line.remove_prefix(end);
+	return word;
+}
 
-		for (auto &c : name)
-			c = std::tolower(c);
+//! @brief Add a header line ending with \r\n to the fields, with its name in lowercase.
+//! @return false if it isn't a header line.
+static bool parseHeaderLine(std::string_view line, Socket::Fields &fields)
+{
+	std::size_t pos = line.find(':');
+
+	if (pos == std::string_view::npos)
+		return false;
+
+	Socket::String name{line.substr(0, pos), fields.get_allocator()};
+	size_t end = line.size() - 3;
+
+	for (auto &c : name)
+		c = std::tolower(c);
+	pos++;
+	while (pos < line.size() && std::isspace(line[pos]))
 		pos++;
-		while (pos < str.size() && std::isspace(str[pos]))
-			pos++;
-		while (pos < end && std::isspace(str[end]))
-			end--;
-		request.header[name] = str.substr(pos, end - pos + 1);
+	while (pos < end && std::isspace(line[end]))
+		end--;
+	fields[std::move(name)] = line.substr(pos, end - pos + 1);
+	return true;
+}
+
+Socket::HttpRequest Socket::readHttpRequest(timeval *timeout)
+{
+	HttpRequest request;
+
+	{
+		// The lines are parsed straight from the receive buffer
+		std::lock_guard<std::mutex> lock{this->_mutex};
+		std::string_view words = this->_getline("\r\n", timeout);
+
+		request.method = nextWord(words);
+		request.path = nextWord(words);
+		request.httpVer = nextWord(words);
+		if (request.httpVer.empty())
+			throw InvalidHTTPAnswerException("Invalid HTTP request (Invalid first line)");
+
+		for (auto line = this->_getline("\r\n", timeout); line.length() > 2; line = this->_getline("\r\n", timeout))
+			if (!parseHeaderLine(line, request.header))
+				throw InvalidHTTPAnswerException("Invalid HTTP request (Invalid header line)");
+		this->_releaseBuffer();
 	}
 
-	try {
-		request.host = request.header.at("host");
-	} catch (std::out_of_range &) {
+	auto host = request.header.find("host");
+
+	if (host == request.header.end())
 		throw InvalidHTTPAnswerException("Invalid HTTP request (no host)");
-	}
+	request.host = host->second;
+
+	auto length = request.header.find("content-length");
 
 	if (request.header.find("transfer-encoding") == request.header.end()) {
-		try {
-			request.body = this->readExactly(std::stoul(request.header.at("content-length")), timeout);
-		} catch (std::out_of_range &) {
-		} catch (std::exception &e) {
-			throw InvalidHTTPAnswerException("Invalid HTTP request (bad content-length)");
-		}
+		// Most requests have no body, so this doesn't throw for them
+		if (length != request.header.end())
+			try {
+				request.body = this->readExactly(std::stoul(std::string(length->second)), timeout);
+			} catch (std::exception &e) {
+				throw InvalidHTTPAnswerException("Invalid HTTP request (bad content-length)");
+			}
 	} else if (request.header["transfer-encoding"] == "chunked") {
 		try {
 			for (size_t size = std::stoul(this->getline("\r\n"), nullptr, 16); size; size = std::stoul(this->getline("\r\n"), nullptr, 16))
@@ -278,39 +423,34 @@ Socket::HttpRequest Socket::readHttpRequest(timeval *timeout)
 
 Socket::HttpResponse Socket::readHttpResponse(timeval *timeout)
 {
-	std::stringstream header(this->getline("\r\n", timeout));
 	HttpResponse response;
-	std::string str;
-
-	header >> response.httpVer;
-	header >> response.returnCode;
 
-	if (header.fail())
-		throw InvalidHTTPAnswerException("Invalid HTTP response (bad first line)");
+	{
+		std::lock_guard<std::mutex> lock{this->_mutex};
+		std::string_view words = this->_getline("\r\n", timeout);
 
-	response.codeName = response.codeName.substr(1, response.codeName.length() - 2);
-	for (std::string str = this->getline("\r\n", timeout); str.length() > 2; str = this->getline("\r\n", timeout)) {
-		std::size_t pos = str.find(':');
+		response.httpVer = nextWord(words);
 
-		if (pos == std::string::npos)
-			throw InvalidHTTPAnswerException("Invalid HTTP response (Invalid header line)");
+		auto code = nextWord(words);
+		auto result = std::from_chars(code.data(), code.data() + code.size(), response.returnCode);
 
-		std::string name = str.substr(0, pos);
-		size_t end = str.size() - 3;
+		if (response.httpVer.empty() || result.ec != std::errc() || result.ptr != code.data() + code.size())
+			throw InvalidHTTPAnswerException("Invalid HTTP response (bad first line)");
+		while (!words.empty() && std::isspace(static_cast<unsigned char>(words.front())))
+			words.remove_prefix(1);
+		while (!words.empty() && std::isspace(static_cast<unsigned char>(words.back())))
+			words.remove_suffix(1);
+		response.codeName = words;
 
-		for (auto &c : name)
-			c = std::tolower(c);
-		pos++;
-		while (pos < str.size() && std::isspace(str[pos]))
-			pos++;
-		while (pos < end && std::isspace(str[end]))
-			end--;
-		response.header[name] = str.substr(pos, end - pos + 1);
+		for (auto line = this->_getline("\r\n", timeout); line.length() > 2; line = this->_getline("\r\n", timeout))
+			if (!parseHeaderLine(line, response.header))
+				throw InvalidHTTPAnswerException("Invalid HTTP response (Invalid header line)");
+		this->_releaseBuffer();
 	}
 
 	if (response.header.find("transfer-encoding") == response.header.end()) {
 		try {
-			response.body = this->readExactly(std::stoul(response.header.at("content-length")), timeout);
+			response.body = this->readExactly(std::stoul(std::string(response.header.at("content-length"))), timeout);
 		} catch (std::out_of_range &) {
 		} catch (...) {
 			throw InvalidHTTPAnswerException("Invalid HTTP response (bad content-length)");
@@ -327,17 +467,19 @@ Socket::HttpResponse Socket::readHttpResponse(timeval *timeout)
 	return response;
 }
 
-void Socket::send(const std::string &msg)
+void Socket::send(std::string_view msg)
 {
+	Trace::Scope scope{"send", "socket"};
 	unsigned pos = 0;
 
 	while (pos < msg.length()) {
-		int bytes = ::send(this->_sockfd, &msg.c_str()[pos], msg.length() - pos, 0);
+		int bytes = ::send(this->_sockfd, &msg.data()[pos], msg.length() - pos, MSG_NOSIGNAL);
 
 		if (bytes <= 0)
 			throw EOFException(getLastSocketError());
 		pos += bytes;
 	}
+	sentBytes.add(pos);
 }
 
 bool	Socket::isOpen() const
@@ -388,7 +530,7 @@ const sockaddr_in &Socket::getRemote() const
 Socket Socket::accept()
 {
 	struct sockaddr_in serv_addr = {};
-	int size = sizeof(serv_addr);
+	SOCKLEN size = sizeof(serv_addr);
 	SOCKET fd = ::accept(this->_sockfd, reinterpret_cast<sockaddr *>(&serv_addr), &size);
 
 	if (fd == INVALID_SOCKET)
@@ -396,20 +538,42 @@ Socket Socket::accept()
 	return {fd, serv_addr};
 }
 
-std::string Socket::generateHttpResponse(const Socket::HttpResponse &res)
+void Socket::interrupt()
 {
-	auto response = res;
-	std::stringstream msg;
+	if (this->isOpen())
+		::shutdown(this->_sockfd, SHUT_RDWR);
+}
+
+Socket::String Socket::generateHttpResponse(const Socket::HttpResponse &response)
+{
+	String msg{Arena::current()};
+	char number[24];
+	int numberSize = snprintf(number, sizeof(number), "%d", response.returnCode);
+	size_t size = response.httpVer.size() + numberSize + response.codeName.size() + 4 + 2 + response.body.size();
+	bool addLength = response.header.find("Content-Length") == response.header.end() && !response.body.empty();
+	char length[24];
+	int lengthSize = addLength ? snprintf(length, sizeof(length), "%zu", response.body.size()) : 0;
 
-	if (response.header.find("Content-Length") == response.header.end() && !response.body.empty())
-		response.header["Content-Length"] = std::to_string(response.body.size());
+	for (auto &entry : response.header)
+		size += entry.first.size() + entry.second.size() + 4;
+	if (addLength)
+		size += strlen("Content-Length: \r\n") + lengthSize;
+	msg.reserve(size);
 
 	/* fill in the parameters */
-	msg << response.httpVer << " " << response.returnCode << " " << response.codeName << "\r\n";
-	for (auto &entry : response.header)
-		msg << entry.first << ": " << entry.second << "\r\n";
-	msg << "\r\n" << response.body;
-	return msg.str();
+	msg.append(response.httpVer).append(" ").append(number, numberSize).append(" ").append(response.codeName).append("\r\n");
+	for (auto &entry : response.header) {
+		// Kept in the same order as if it was in the map
+		if (addLength && entry.first > "Content-Length") {
+			msg.append("Content-Length: ").append(length, lengthSize).append("\r\n");
+			addLength = false;
+		}
+		msg.append(entry.first).append(": ").append(entry.second).append("\r\n");
+	}
+	if (addLength)
+		msg.append("Content-Length: ").append(length, lengthSize).append("\r\n");
+	msg.append("\r\n").append(response.body);
+	return msg;
 }
 
 std::string Socket::generateHttpRequest(const Socket::HttpRequest &req)
@@ -10,38 +10,54 @@
 #	include <winsock.h>
 #else
 #	include <sys/socket.h>
+#	include <netinet/in.h>
+#	include <arpa/inet.h>
 #	define INVALID_SOCKET -1
 	typedef int SOCKET;
 #endif
 #include <string>
+#include <string_view>
 #include <map>
+#include <memory_resource>
 #include <mutex>
+#include "../Utils/Arena.hpp"
+#include "../Utils/IOBuffer.hpp"
 
 //! @brief Define a Socket
 class Socket {
 public:
+	//! @brief Strings of the requests and responses, allocated from the arena they were constructed in.
+	using String = std::pmr::string;
+	using Fields = std::pmr::map<String, String, std::less<>>;
+
 	//! @brief Define a http request payload.
+	//! Constructed in the arena of the calling thread (see Arena::Scope), copies are made on the heap.
 	struct HttpRequest {
-		std::string httpVer; //!< The http version
-		std::string body; //!< The body of the request
-		std::string method; //!< The method of the request (put, get, etc.)
-		std::string host; //!< The host to contact
+		String httpVer; //!< The http version
+		String body; //!< The body of the request
+		String method; //!< The method of the request (put, get, etc.)
+		String host; //!< The host to contact
 		unsigned ip = 0;
 		int portno; //!< The port number to contact the host
-		std::map<std::string, std::string> header; //!< The header of the request (entry: value)
-		std::string path; //!< The url to fetch
-		std::map<std::string, std::string> query;
-		std::string realPath;
+		Fields header; //!< The header of the request (entry: value)
+		String path; //!< The url to fetch
+		Fields query;
+		String realPath;
+
+		HttpRequest(std::pmr::memory_resource *resource = Arena::current());
 	};
 
 	//! @brief Define a http response payload.
+	//! Constructed in the arena of the calling thread (see Arena::Scope), copies are made on the heap.
 	struct HttpResponse {
-		HttpRequest request; //!< The request payload
-		std::map<std::string, std::string> header; //!< The header of the request (entry: value)
+		HttpRequest request; //!< The request payload, only filled by makeHttpRequest
+		Fields header; //!< The header of the request (entry: value)
 		int returnCode; //!< The http-return code
-		std::string codeName; //!< The name of the return code
-		std::string httpVer; //!< The http version
-		std::string body; //!< The body of the response
+		String codeName; //!< The name of the return code
+		String httpVer; //!< The http version
+		String body; //!< The body of the response
+
+		HttpResponse(std::pmr::memory_resource *resource = Arena::current());
 	};
 
 	//! @brief Construct a Socket.
@@ -59,6 +75,12 @@ public:
 	//! @return The status of the Socket.
 	bool isOpen() const;
 
+	//! @brief Get the address of a host, numeric or not. Can be called from several threads at once.
+	//! @param host The host to look up.
+	//! @return The ip, in network byte order.
+	//! @throw HostNotFoundException The host couldn't be resolved.
+	static unsigned resolve(const std::string &host);
+
 	//! @brief Connect the Socket to a host.
 	//! @param host The host to connect to.
 	//! @param portno The port number used to connect to the host.
@@ -74,7 +96,7 @@ public:
 
 	//! @brief Send a message
 	//! @param msg The message to send.
-	virtual void send(const std::string &msg);
+	virtual void send(std::string_view msg);
 
 	std::string read(int size, timeval *timeout = nullptr);
 	std::string readExactly(int size, timeval *timeout = nullptr);
@@ -85,10 +107,10 @@ public:
 	//! @return std::string
 	static std::string generateHttpRequest(const HttpRequest &request);
 
-	//! @brief Generate a http payload from a HttpRequest
-	//! @param request The request to generate
-	//! @return std::string
-	static std::string generateHttpResponse(const HttpResponse &response);
+	//! @brief Generate a http payload from a HttpResponse, in the arena of the calling thread
+	//! @param response The response to generate
+	//! @return String
+	static String generateHttpResponse(const HttpResponse &response);
 
 	//! @brief Create a http response from a HttpRequest
 	//! @param request The request to generate
@@ -107,6 +129,10 @@ public:
 
 	Socket accept();
 
+	//! @brief Wake up the thread blocked in accept or read on the Socket, which then fails.
+	//! Closing the Socket isn't enough on Linux.
+	void interrupt();
+
 	//! @brief Return the socket value.
 	//! @return SOCKET
 	SOCKET getSockFd() const { return this->_sockfd; };
@@ -122,10 +148,29 @@ protected:
 	SOCKET _sockfd = INVALID_SOCKET; //!< The socket
 	mutable bool _opened = false; //!< The status of the socket.
 	struct sockaddr_in _remote;
-	std::string _buffer;
+	//! Received but not read yet, from _bufferStart to the end.
+	//! Given back to the pool once everything in it was read.
+	IOBuffer _buffer;
+	size_t _bufferStart = 0;
 	std::mutex _mutex;
 
-	virtual std::string _read(int size, timeval *timeout = nullptr);
+	//! @brief Wait until there is something to receive.
+	virtual void _wait(timeval *timeout);
+	//! @brief Receive what is available, once _wait returned.
+	//! @return The number of bytes received, at least 1.
+	virtual size_t _read(char *buffer, size_t size);
+	//! @brief Receive at least one byte in the buffer. _mutex must be locked.
+	//! @param size Bytes the caller needs in the buffer, so it is made big enough for all of them at once.
+	void _receive(timeval *timeout, size_t size = 0);
+	//! @return What was received but not read yet. Invalidated by _receive.
+	std::string_view _buffered() const;
+	//! @brief Mark the first bytes of the buffer as read.
+	void _consume(size_t size);
+	//! @brief Give the buffer back to the pool if it was fully read. The views taken from it are invalidated.
+	void _releaseBuffer();
+	//! @brief Read a line without copying it. _mutex must be locked.
+	//! @return The line with its delimiter, invalidated by _receive and _releaseBuffer.
+	std::string_view _getline(const char *delim, timeval *timeout);
 };
 
 #endif //DISC_ORD_SOCKET_HPP
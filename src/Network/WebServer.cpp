@@ -3,14 +3,24 @@
 //
 
 #include <csignal>
-#include <iostream>
+#include <cstring>
 #include <fstream>
 #include <regex>
 #include <filesystem>
 #include "WebServer.hpp"
 #include "../Exceptions.hpp"
+#include "../Memory.hpp"
+#include "../Trace.hpp"
 #include "nlohmann/json.hpp"
 
+static const Metrics::Counter httpConnections = Metrics::counter("sokustreaming_http_connections_total", "Connections accepted by the web server.");
+static const Metrics::Gauge activeHttpConnections = Metrics::gauge("sokustreaming_http_connections_active", "Connections whose request is being handled.");
+static const Metrics::Counter webSocketSessions = Metrics::counter("sokustreaming_websocket_sessions_total", "Websocket sessions opened.");
+static const Metrics::Gauge activeWebSocketSessions = Metrics::gauge("sokustreaming_websocket_sessions_active", "Websocket sessions currently open.");
+static const Metrics::Counter webSocketMessages = Metrics::counter("sokustreaming_websocket_received_messages_total", "Messages received from the websocket clients.");
+static const Metrics::Counter webSocketFrames = Metrics::counter("sokustreaming_websocket_sent_frames_total", "Frames broadcast to the websocket clients, one per client.");
+static const Metrics::Counter webSocketDrops = Metrics::counter("sokustreaming_websocket_send_failures_total", "Broadcasts a client failed to receive, after which it is disconnected.");
+
 const std::map<std::string, std::string> WebServer::types{
 	{"txt", "text/plain"},
 	{"js", "text/javascript"},
@@ -102,25 +112,57 @@ WebServer::WebServer(int staticAge) :
 {
 }
 
-void WebServer::addRoute(const std::string &&route, std::function<Socket::HttpResponse(const Socket::HttpRequest &)> &&fct)
+bool WebServer::Route::matches(std::string_view path) const
 {
-	std::cout << "Adding route " << route << std::endl;
-	this->_routes[route] = fct;
+	if (path.substr(0, this->prefix.size()) != this->prefix)
+		return false;
+	if (this->exact)
+		return path.size() == this->prefix.size();
+	// std::regex allocates each time it runs
+	return std::regex_match(path.begin(), path.end(), this->regex);
+}
+
+void WebServer::addRoute(const std::string &&route, std::function<Socket::HttpResponse(const Socket::HttpRequest &)> &&fct, bool slow)
+{
+	Route result{std::regex{route}, "", false, fct};
+	size_t i = !route.empty() && route.front() == '^';
+
+	LOG_INFO("Adding route %s", route.c_str());
+	// With an alternative the start of the pattern isn't the start of the path
+	if (route.find('|') == std::string::npos) {
+		for (; i < route.size() && !strchr("\\.[](){}*+?^$", route[i]); i++)
+			result.prefix += route[i];
+		if (i < route.size() && strchr("*+?{", route[i]) && !result.prefix.empty())
+			result.prefix.pop_back();
+		result.exact = i == route.size() || (i == route.size() - 1 && route[i] == '$');
+	}
+	this->_routes[route] = std::move(result);
+	if (slow)
+		this->_slowRoutes.insert(route);
 }
 
 void WebServer::addStaticFolder(const std::string &&route, const std::string &&path, bool discoverable)
 {
-	std::cout << "Adding static folder " << route << " -> " << path << std::endl;
+	LOG_INFO("Adding static folder %s -> %s", route.c_str(), path.c_str());
 	this->_folders[route] = {path, discoverable};
 }
 
 void WebServer::start(unsigned short port)
 {
 	this->_sock.bind(port);
-	std::cout << "Started server on port " << port << std::endl;
+	LOG_INFO("Started server on port %u", port);
 	this->_thread = std::thread([this]{
-		while (!this->_closed)
-			this->_serverLoop();
+		Trace::nameThread("Web server");
+		while (!this->_closed) {
+			try {
+				this->_serverLoop();
+			} catch (AcceptFailedException &) {
+				// Interrupted by stop
+				if (!this->_closed)
+					throw;
+			}
+			this->_arena.reset();
+		}
 	});
 }
 
@@ -130,6 +172,7 @@ void WebServer::stop()
 {
 	this->_closed = true;
 	auto old = signal(SIGINT, ___);
+	std::unique_lock<std::mutex> lock{this->_webSocksMutex};
 
 	std::for_each(
 		this->_webSocks.begin(),
@@ -140,10 +183,19 @@ void WebServer::stop()
 				s->thread.join();
 		}
 	);
+	lock.unlock();
 	raise(SIGINT); //Interrupt accept
 	signal(SIGINT, old);
+	// The signal only reaches this thread on Linux
+	this->_sock.interrupt();
 	if (this->_thread.joinable())
 		this->_thread.join();
+
+	std::unique_lock<std::mutex> slowLock{this->_slowMutex};
+
+	this->_slowCond.wait(slowLock, [this]{
+		return this->_slowRequests == 0;
+	});
 }
 
 WebServer::~WebServer()
@@ -151,42 +203,42 @@ WebServer::~WebServer()
 	this->stop();
 }
 
-void WebServer::_serverLoop()
+void WebServer::_recordRequest(const std::string &route, unsigned short code, long long start)
+{
+	std::lock_guard<std::mutex> lock{this->_metricsMutex};
+	auto it = this->_routeMetrics.find(route);
+
+	if (it == this->_routeMetrics.end()) {
+		auto labels = Metrics::label("route", route);
+
+		it = this->_routeMetrics.emplace(route, RouteMetrics{
+			Metrics::counter("sokustreaming_http_requests_total", "Requests handled, by route.", labels),
+			Metrics::histogram("sokustreaming_http_request_duration_seconds", "Time from accepting the connection to sending the response, by route.", Metrics::latencyBuckets, 1e-9, labels)
+		}).first;
+	}
+	it->second.requests.add();
+	it->second.duration.observe(Metrics::now() - start);
+
+	auto code_it = this->_responseMetrics.find(code);
+
+	if (code_it == this->_responseMetrics.end())
+		code_it = this->_responseMetrics.emplace(code, Metrics::counter(
+			"sokustreaming_http_responses_total",
+			"Responses sent, by status code.",
+			Metrics::label("code", std::to_string(code))
+		)).first;
+	code_it->second.add();
+}
+
+Socket::HttpResponse WebServer::_respond(const std::function<Socket::HttpResponse ()> &handler)
 {
-	Socket newConnection = this->_sock.accept();
 	Socket::HttpResponse response;
-	Socket::HttpRequest requ;
 
-#ifdef _DEBUG
-	std::cerr << "New connection from " << inet_ntoa(newConnection.getRemote().sin_addr) << ":" << newConnection.getRemote().sin_port << std::endl;
-#endif
 	try {
 		try {
-			timeval time = {1, 0};
-
-			requ = newConnection.readHttpRequest(&time);
-			requ.ip = newConnection.getRemote().sin_addr.s_addr;
-			requ.portno = newConnection.getRemote().sin_port;
-			if (requ.httpVer != "HTTP/1.1")
-				throw AbortConnectionException(505);
-			WebServer::_parsePath(requ);
-			if (requ.realPath == "/chat")
-				return this->_addWebSocket(newConnection, requ);
-			else {
-				auto it = std::find_if(this->_routes.begin(), this->_routes.end(), [&requ](auto &pair){
-					return std::regex_match(requ.realPath, std::regex{pair.first});
-				});
-
-				response.request = requ;
-				if (it != this->_routes.end())
-					response = it->second(requ);
-				else
-					response = this->_checkFolders(requ);
-			}
+			response = handler();
 		} catch (InvalidHTTPAnswerException &e) {
-		#ifdef _DEBUG
-			std::cout << e.what() << std::endl;
-		#endif
+			LOG_DEBUG("%s", e.what());
 			response = WebServer::_makeGenericPage(400);
 		} catch (NotImplementedException &) {
 			response = WebServer::_makeGenericPage(501);
@@ -204,38 +256,150 @@ void WebServer::_serverLoop()
 		response.codeName = WebServer::codes.at(response.returnCode);
 		response.header["Connection"] = "Close";
 	} catch (std::exception &e) {
-		std::cerr << e.what() << std::endl;
+		LOG_ERROR("%s", e.what());
 		response = WebServer::_makeGenericPage(500, e.what());
 	}
 	response.httpVer = "HTTP/1.1";
-#ifdef _DEBUG
-	std::cout << inet_ntoa(newConnection.getRemote().sin_addr) << ":" << newConnection.getRemote().sin_port << " ";
-	if (!requ.httpVer.empty())
-		std::cout << requ.path;
-	else
-		std::cout << "<Malformed HTTP request>";
-	std::cout << ": " << response.returnCode << std::endl;
-#endif
+	return response;
+}
+
+void WebServer::_sendResponse(Socket &connection, const Socket::HttpRequest &requ, const Socket::HttpResponse &response)
+{
+	LOG_DEBUG(
+		"%s:%u %s: %d",
+		inet_ntoa(connection.getRemote().sin_addr),
+		ntohs(connection.getRemote().sin_port),
+		requ.httpVer.empty() ? "<Malformed HTTP request>" : requ.path.c_str(),
+		response.returnCode
+	);
 	try {
-		newConnection.send(Socket::generateHttpResponse(response));
+		Trace::Scope scope{"send response", "http"};
+
+		connection.send(Socket::generateHttpResponse(response));
 	} catch (...) {}
-	newConnection.disconnect();
+	connection.disconnect();
+}
+
+void WebServer::_handleSlowRequest(Socket &connection, const Socket::HttpRequest &requ, const std::string &route, long long start)
+{
+	auto &handler = this->_routes.at(route).handler;
+
+	this->_slowMutex.lock();
+	this->_slowRequests++;
+	this->_slowMutex.unlock();
+	// The copy takes over the connection
+	std::thread([this, connection, requ, &route, &handler, start]() mutable {
+		Trace::nameThread("Request " + route);
+
+		auto response = WebServer::_respond([&]{
+			Trace::Scope scope{route.c_str(), "route"};
+
+			return handler(requ);
+		});
+
+		WebServer::_sendResponse(connection, requ, response);
+		this->_recordRequest(route, response.returnCode, start);
+		activeHttpConnections.dec();
+
+		std::lock_guard<std::mutex> lock{this->_slowMutex};
+
+		this->_slowRequests--;
+		this->_slowCond.notify_all();
+	}).detach();
+}
+
+void WebServer::_serverLoop()
+{
+	// Destroyed last, after everything allocated in the arena
+	Arena::Scope arena{this->_arena};
+	Socket newConnection = this->_sock.accept();
+	auto start = Metrics::now();
+	Socket::HttpRequest requ;
+	// Requests which fail before being routed
+	std::string route = "none";
+	bool handedOver = false;
+
+	LOG_DEBUG("New connection from %s:%u", inet_ntoa(newConnection.getRemote().sin_addr), ntohs(newConnection.getRemote().sin_port));
+	httpConnections.add();
+	activeHttpConnections.inc();
+
+	auto handle = [&]{
+		Socket::HttpResponse response;
+
+		{
+			Trace::Scope scope{"parse request", "http"};
+			timeval time = {1, 0};
+
+			requ = newConnection.readHttpRequest(&time);
+			requ.ip = newConnection.getRemote().sin_addr.s_addr;
+			requ.portno = newConnection.getRemote().sin_port;
+			if (requ.httpVer != "HTTP/1.1")
+				throw AbortConnectionException(505);
+			WebServer::parsePath(requ);
+		}
+		if (requ.realPath == "/chat") {
+			route = "chat";
+			this->_addWebSocket(newConnection, requ);
+			handedOver = true;
+			// Never sent, but _respond needs a known code
+			response.returnCode = 101;
+			return response;
+		}
+
+		auto it = std::find_if(this->_routes.begin(), this->_routes.end(), [&requ](auto &pair){
+			return pair.second.matches(requ.realPath);
+		});
+
+		if (it == this->_routes.end()) {
+			Trace::Scope scope{"static", "route"};
+
+			route = "static";
+			return this->_checkFolders(requ);
+		}
+		route = it->first;
+		if (this->_slowRoutes.count(route)) {
+			this->_handleSlowRequest(newConnection, requ, it->first, start);
+			handedOver = true;
+			response.returnCode = 202;
+			return response;
+		}
+
+		Trace::Scope scope{it->first.c_str(), "route"};
+
+		return it->second.handler(requ);
+	};
+	// By reference, the lambda is too big for std::function to hold it without allocating
+	auto response = WebServer::_respond(std::ref(handle));
+
+	if (handedOver) {
+		// The websocket answered the handshake itself, the slow routes are recorded once they answered.
+		if (route == "chat") {
+			this->_recordRequest(route, 101, start);
+			activeHttpConnections.dec();
+		}
+		return;
+	}
+	WebServer::_sendResponse(newConnection, requ, response);
+	this->_recordRequest(route, response.returnCode, start);
+	activeHttpConnections.dec();
 }
 
 Socket::HttpResponse WebServer::_makeGenericPage(unsigned short code)
 {
 	Socket::HttpResponse response;
 
+	auto &name = WebServer::codes.at(code);
+
 	response.returnCode = code;
-	response.codeName = WebServer::codes.at(response.returnCode);
+	response.codeName = name;
 	response.header["Content-Type"] = "text/html";
 	response.body = "<html>"
 		"<head>"
-			"<title>" + response.codeName + "</title>"
+			"<title>" + name + "</title>"
 		"</head>"
 		"<body style=\"text-align: center\">"
 			"<h1>" +
-				std::to_string(response.returnCode) + ": " + response.codeName +
+				std::to_string(response.returnCode) + ": " + name +
 			"</h1>"
 			"<hr>"
 		"</body>"
@@ -247,16 +411,18 @@ Socket::HttpResponse WebServer::_makeGenericPage(unsigned short code, const std:
 {
 	Socket::HttpResponse response;
 
+	auto &name = WebServer::codes.at(code);
+
 	response.returnCode = code;
-	response.codeName = WebServer::codes.at(response.returnCode);
+	response.codeName = name;
 	response.header["Content-Type"] = "text/html";
 	response.body = "<html>"
 		"<head>"
-			"<title>" + response.codeName + "</title>"
+			"<title>" + name + "</title>"
 		"</head>"
 		"<body style=\"text-align: center\">"
 			"<h1>" +
-				std::to_string(response.returnCode) + ": " + response.codeName + " (" + extra + ")"
+				std::to_string(response.returnCode) + ": " + name + " (" + extra + ")"
 			"</h1>"
 			"<hr>"
 		"</body>"
@@ -273,15 +439,15 @@ Socket::HttpResponse WebServer::_checkFolders(const Socket::HttpRequest &request
 	for (auto &[key, folder] : this->_folders) {
 		if (request.realPath.size() < key.length())
 			continue;
-		if (request.realPath.size() == key.length() && request.realPath != key)
+		if (request.realPath.size() == key.length() && std::string_view(request.realPath) != key)
 			continue;
 		if (request.realPath.size() > key.length() && (
-			request.realPath.substr(0, key.length()) != key ||
+			std::string_view(request.realPath).substr(0, key.length()) != key ||
 			request.realPath[key.size()] != '/'
 		))
 			continue;
 
-		auto url = request.realPath.substr(key.length());
+		std::string url{std::string_view(request.realPath).substr(key.length())};
 
 		// TODO: Handle this case better
 		if (url.find("/../") != std::string::npos)
@@ -291,11 +457,13 @@ Socket::HttpResponse WebServer::_checkFolders(const Socket::HttpRequest &request
 
 		if (realPath.empty() || realPath.back() != '/' || !folder.second) {
 			std::string type = WebServer::_getContentType(request.realPath);
-			int i = std::ifstream::in;
+			std::ios_base::openmode i = std::ifstream::in;
 
 			if (type.substr(0, 5) != "text/")
 				i |= std::ifstream::binary;
 
+			Trace::Scope scope{"read file", "asset"};
+			Memory::Scope memory{Memory::TAG_ASSETS};
 			std::ifstream stream{realPath, i};
 
 			if (stream.fail())
@@ -303,7 +471,7 @@ Socket::HttpResponse WebServer::_checkFolders(const Socket::HttpRequest &request
 			response.returnCode = 200;
 			response.header["Cache-Control"] = "private, immutable, max-age=" + std::to_string(this->_staticAge);
 			response.header["Content-Type"] = type;
-			response.body = {std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()};
+			response.body.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
 			return response;
 		} else {
 			std::error_code err;
@@ -361,7 +529,7 @@ Socket::HttpResponse WebServer::_checkFolders(const Socket::HttpRequest &request
 	throw AbortConnectionException(404);
 }
 
-std::string WebServer::_getContentType(const std::string &path)
+std::string WebServer::_getContentType(std::string_view path)
 {
 	//TODO: Fix bug if URL contains a .
 	size_t pos = path.find_last_of('.');
@@ -373,10 +541,11 @@ std::string WebServer::_getContentType(const std::string &path)
 	if (pos == std::string::npos)
 		return "application/octet-stream";
 
-	auto it = WebServer::types.find(path.substr(pos + 1));
+	std::string extension{path.substr(pos + 1)};
+	auto it = WebServer::types.find(extension);
 
 	if (it == WebServer::types.end())
-		return "application/" + path.substr(pos + 1);
+		return "application/" + extension;
 	return it->second;
 }
 
@@ -386,8 +555,10 @@ void WebServer::_addWebSocket(Socket &sock, const Socket::HttpRequest &requ)
 	std::shared_ptr<WebSocketConnection> wsock;
 	std::weak_ptr<WebSocketConnection> wsock_weak;
 
-	this->_webSocks.push_back(std::make_shared<WebSocketConnection>(sock));
+	this->_webSocksMutex.lock();
+	this->_webSocks.push_back(std::allocate_shared<WebSocketConnection>(Memory::Allocator<WebSocketConnection, Memory::TAG_WEBSOCKET>(), sock));
 	wsock_weak = wsock = this->_webSocks.back();
+	this->_webSocksMutex.unlock();
 	wsock->wsock.needsMask(false);
 	response.httpVer = "HTTP/1.1";
 	response.codeName = WebServer::codes.at(response.returnCode);
@@ -395,11 +566,16 @@ void WebServer::_addWebSocket(Socket &sock, const Socket::HttpRequest &requ)
 	if (this->_onConnect)
 		this->_onConnect(wsock->wsock);
 	wsock->isThreadFinished = false;
+	webSocketSessions.add();
+	activeWebSocketSessions.inc();
+	this->_clientCount++;
 	wsock->thread = std::thread([this, wsock_weak]{
+		Trace::nameThread("Websocket " + std::string(inet_ntoa(wsock_weak.lock()->wsock.getRemote().sin_addr)) + ":" + std::to_string(ntohs(wsock_weak.lock()->wsock.getRemote().sin_port)));
 		try {
 			while (wsock_weak.lock()->wsock.isOpen()) {
 				std::string msg = wsock_weak.lock()->wsock.getAnswer();
 
+				webSocketMessages.add();
 				if (this->_onMessage)
 					this->_onMessage(wsock_weak.lock()->wsock, msg);
 			}
@@ -408,15 +584,27 @@ void WebServer::_addWebSocket(Socket &sock, const Socket::HttpRequest &requ)
 			if (this->_onError)
 				this->_onError(wsock_weak.lock()->wsock, e);
 		}
+		if (this->_onClose)
+			this->_onClose(wsock_weak.lock()->wsock);
+		activeWebSocketSessions.dec();
+		this->_clientCount--;
 		wsock_weak.lock()->isThreadFinished = true;
 	});
-#ifdef _DEBUG
-	std::cout << inet_ntoa(sock.getRemote().sin_addr) << ":" << sock.getRemote().sin_port << " " << requ.path << ": " << response.returnCode << std::endl;
-#endif
+	LOG_DEBUG("%s:%u %s: %d", inet_ntoa(sock.getRemote().sin_addr), ntohs(sock.getRemote().sin_port), requ.path.c_str(), response.returnCode);
 }
 
 void WebServer::broadcast(const std::string &msg)
 {
+	this->broadcast(msg, [](WebSocket &){
+		return true;
+	});
+}
+
+void WebServer::broadcast(const std::string &msg, const std::function<bool (WebSocket &sock)> &filter)
+{
+	Trace::Scope scope{"broadcast", "websocket"};
+	std::lock_guard<std::mutex> lock{this->_webSocksMutex};
+
 	this->_webSocks.erase(
 		std::remove_if(
 			this->_webSocks.begin(),
@@ -429,12 +617,21 @@ void WebServer::broadcast(const std::string &msg)
 	);
 	for (auto &wsock : this->_webSocks)
 		try {
-			wsock->wsock.send(msg);
+			if (filter(wsock->wsock)) {
+				wsock->wsock.send(msg);
+				webSocketFrames.add();
+			}
 		} catch (...) {
+			webSocketDrops.add();
 			wsock->wsock.disconnect();
 		}
 }
 
+unsigned WebServer::getClientCount() const
+{
+	return this->_clientCount.load(std::memory_order_relaxed);
+}
+
 void WebServer::onWebSocketConnect(const std::function<void(WebSocket &)> & fct)
 {
 	this->_onConnect = fct;
@@ -450,33 +647,14 @@ void WebServer::onWebSocketError(const std::function<void(WebSocket &, const std
 	this->_onError = fct;
 }
 
-void WebServer::_parsePath(Socket::HttpRequest &req)
+void WebServer::onWebSocketClose(const std::function<void(WebSocket &)> & fct)
 {
-	auto pos = req.path.find_first_of('?');
-
-	req.realPath = WebServer::_decodeURIComponent(req.path.substr(0, pos));
-	if (pos != std::string::npos) {
-		std::string queryString = req.path.substr(pos + 1);
-
-		while (true) {
-			size_t equ = queryString.find_first_of('=');
-			std::string key = queryString.substr(0, equ);
-			size_t end = queryString.find('&');
-
-			if (equ != std::string::npos)
-				req.query[key] = queryString.substr(equ + 1);
-			else if (!queryString.empty() && end != 0)
-				req.query[key] = "";
-			if (end == std::string::npos)
-				break;
-			queryString = queryString.substr(end + 1);
-		}
-	}
+	this->_onClose = fct;
 }
 
-std::string WebServer::_decodeURIComponent(const std::string &elem)
+template<typename T>
+static void decodeURIComponent(std::string_view elem, T &result)
 {
-	std::string result;
 	char digits[] = "0123456789ABCDEF";
 
 	result.reserve(elem.size());
@@ -499,5 +677,37 @@ std::string WebServer::_decodeURIComponent(const std::string &elem)
 		} else
 			result.push_back(elem[i]);
 	}
+}
+
+void WebServer::parsePath(Socket::HttpRequest &req)
+{
+	std::string_view path = req.path;
+	auto pos = path.find_first_of('?');
+
+	req.realPath.clear();
+	::decodeURIComponent(path.substr(0, pos), req.realPath);
+	if (pos == std::string_view::npos)
+		return;
+
+	auto queryString = path.substr(pos + 1);
+
+	while (true) {
+		size_t end = queryString.find('&');
+		auto param = queryString.substr(0, end);
+		size_t equ = param.find('=');
+
+		if (!param.empty())
+			req.query[Socket::String{param.substr(0, equ), req.query.get_allocator()}] = equ == std::string_view::npos ? "" : param.substr(equ + 1);
+		if (end == std::string_view::npos)
+			break;
+		queryString.remove_prefix(end + 1);
+	}
+}
+
+std::string WebServer::decodeURIComponent(std::string_view elem)
+{
+	std::string result;
+
+	::decodeURIComponent(elem, result);
 	return result;
 }
@@ -6,12 +6,19 @@
 #define SWRSTOYS_WEBSERVER_HPP
 
 
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <set>
 #include <thread>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <regex>
 #include "Socket.hpp"
 #include "WebSocket.hpp"
+#include "../Logger.hpp"
+#include "../Metrics.hpp"
 
 class WebServer {
 private:
@@ -21,40 +28,87 @@ private:
 		bool isThreadFinished;
 
 		WebSocketConnection(const Socket &sock) : wsock(sock) {};
-		~WebSocketConnection() { puts("~WebSocketConnection"); if (this->thread.joinable()) this->thread.join(); };
+		~WebSocketConnection() { LOG_DEBUG("~WebSocketConnection"); if (this->thread.joinable()) this->thread.join(); };
+	};
+
+	struct Route {
+		std::regex regex;
+		//! The paths matching the route start with it, checked before running the regex.
+		std::string prefix;
+		//! The route is only its prefix, so the regex isn't needed.
+		bool exact;
+		std::function<Socket::HttpResponse (const Socket::HttpRequest &request)> handler;
+
+		bool matches(std::string_view path) const;
+	};
+
+	struct RouteMetrics {
+		Metrics::Counter requests;
+		Metrics::Histogram duration;
 	};
 
 	std::function<void (WebSocket &sock)> _onConnect;
 	std::function<void (WebSocket &sock, const std::string &msg)> _onMessage;
 	std::function<void (WebSocket &sock, const std::exception &e)> _onError;
-	bool _closed = false;
+	std::function<void (WebSocket &sock)> _onClose;
+	std::atomic<bool> _closed{false};
 	int _staticAge;
 	Socket _sock;
 	std::thread _thread;
+	std::mutex _webSocksMutex;
 	std::vector<std::shared_ptr<WebSocketConnection>> _webSocks;
+	//! Websocket threads still running, so it can be read without _webSocksMutex.
+	std::atomic<unsigned> _clientCount{0};
 	std::map<std::string, std::pair<std::string, bool>> _folders;
-	std::map<std::string, std::function<Socket::HttpResponse (const Socket::HttpRequest &request)>> _routes;
+	std::map<std::string, Route> _routes;
+	//! Routes answered from their own thread, see addRoute.
+	std::set<std::string> _slowRoutes;
+	std::mutex _slowMutex;
+	std::condition_variable _slowCond;
+	unsigned _slowRequests = 0;
+	std::mutex _metricsMutex;
+	//! Indexed by route or by "chat", "static" and "none".
+	std::map<std::string, RouteMetrics> _routeMetrics;
+	std::map<unsigned short, Metrics::Counter> _responseMetrics;
+	//! Holds the requests of the server loop, reset after each response.
+	Arena _arena;
 
 	void _serverLoop();
+	void _handleSlowRequest(Socket &connection, const Socket::HttpRequest &requ, const std::string &route, long long start);
+	void _recordRequest(const std::string &route, unsigned short code, long long start);
+	//! @brief Call the handler, turning the exceptions it throws into error pages.
+	static Socket::HttpResponse _respond(const std::function<Socket::HttpResponse ()> &handler);
+	static void _sendResponse(Socket &connection, const Socket::HttpRequest &requ, const Socket::HttpResponse &response);
 	void _addWebSocket(Socket &sock, const Socket::HttpRequest &requ);
 	Socket::HttpResponse _checkFolders(const Socket::HttpRequest &request);
-	static std::string _getContentType(const std::string &path);
+	static std::string _getContentType(std::string_view path);
 	static Socket::HttpResponse _makeGenericPage(unsigned short code);
 	static Socket::HttpResponse _makeGenericPage(unsigned short code, const std::string &extra);
-	static void _parsePath(Socket::HttpRequest &req);
-	static std::string _decodeURIComponent(const std::string &elem);
 
 public:
 	static const std::map<std::string, std::string> types;
 	static const std::map<unsigned short, std::string> codes;
 
+	//! @brief Fill realPath and query from the raw path of the request.
+	//! @throw AbortConnectionException The path is malformed.
+	static void parsePath(Socket::HttpRequest &req);
+	//! @throw AbortConnectionException The component is malformed.
+	static std::string decodeURIComponent(std::string_view elem);
+
 	WebServer(int staticAge);
 	~WebServer();
 	void broadcast(const std::string &msg);
+	void broadcast(const std::string &msg, const std::function<bool (WebSocket &sock)> &filter);
+	//! @brief Number of websocket clients still connected. Never blocks.
+	unsigned getClientCount() const;
 	void onWebSocketConnect(const std::function<void (WebSocket &sock)> &fct);
 	void onWebSocketMessage(const std::function<void (WebSocket &sock, const std::string &msg)> &fct);
 	void onWebSocketError(const std::function<void (WebSocket &sock, const std::exception &e)> &fct);
-	void addRoute(const std::string &&route, std::function<Socket::HttpResponse (const Socket::HttpRequest &request)> &&fct);
+	//! @brief Called once a client is gone, whether it closed the connection, timed out or failed.
+	//! The socket is still valid during the call but is freed right after, so anything keyed on it must be dropped.
+	void onWebSocketClose(const std::function<void (WebSocket &sock)> &fct);
+	//! @param slow The route takes a while to answer, so it is answered from its own thread instead of holding up the other requests.
+	void addRoute(const std::string &&route, std::function<Socket::HttpResponse (const Socket::HttpRequest &request)> &&fct, bool slow = false);
 	void addStaticFolder(const std::string &&route, const std::string &&path, bool discoverable);
 	void start(unsigned short port);
 	void stop();
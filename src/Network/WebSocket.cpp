@@ -2,16 +2,17 @@
 // Created by Gegel85 on 06/04/2019.
 //
 
-#include <windows.h>
-#include <Wincrypt.h>
-#include <sstream>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include "../Exceptions.hpp"
+#include "../Trace.hpp"
+#include "../Utils/Sha1.hpp"
 #include "WebSocket.hpp"
 #include "base64.hpp"
 
 #define WEBSOCKET_CODE(code) ((code - 1000 < 0 || code - 1000 > 15) ? ("???") : (codesStrings[code - 1000]))
-#define SHA1LEN 20
+#define HANDSHAKE_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
 
 const char * const WebSocket::codesStrings[] = {
 	"Normal Closure",
@@ -38,6 +39,7 @@ void WebSocket::_establishHandshake(const std::string &host)
 	Socket::HttpResponse	response;
 
 	request.host = host;
+	request.httpVer = "HTTP/1.1";
 	request.path = "/chat";
 	request.method = "GET";
 	request.header = {
@@ -55,53 +57,56 @@ void WebSocket::_establishHandshake(const std::string &host)
 	}
 }
 
-void WebSocket::send(const std::string &value)
+void WebSocket::send(std::string_view value)
 {
-	std::stringstream stream;
-	std::string	result = value;
-	unsigned	random_value = this->_rand();
-	std::string	key = std::string("") +
-		static_cast<char>((random_value >> 24U) & 0xFFU) +
-		static_cast<char>((random_value >> 16U) & 0xFFU) +
-		static_cast<char>((random_value >> 8U) & 0xFFU) +
-		static_cast<char>(random_value & 0xFFU);
-
-	if (this->_masks)
-		for (unsigned i = 0; i < result.size(); i++)
-			result[i] = result[i] ^ key[i % 4];
-	stream << static_cast<char>(0x81);
-	stream << static_cast<char>(0x80 * this->_masks + (value.size() <= 125 ? value.size() : (126 + (value.size() > 65535))));
-	if (value.size() > 65535) {
-		stream << static_cast<char>(value.size() >> 24U);
-		stream << static_cast<char>(value.size() >> 16U);
-		stream << static_cast<char>(value.size() >> 8U);
-		stream << static_cast<char>(value.size());
-	} else if (value.size() > 125) {
-		stream << static_cast<char>(value.size() >> 8U);
-		stream << static_cast<char>(value.size());
-	}
-	if (this->_masks)
-		stream << key;
-	stream << result;
-	Socket::send(stream.str());
+	Trace::Scope scope{"frame", "websocket"};
+	uint64_t size = value.size();
+	size_t lengthSize = size > 65535 ? 8 : size > 125 ? 2 : 0;
+	IOBuffer frame{2 + lengthSize + 4 * this->_masks + value.size()};
+	char *ptr = frame.data();
+
+	*ptr++ = static_cast<char>(0x81);
+	*ptr++ = static_cast<char>(0x80 * this->_masks + (size <= 125 ? size : (126 + (size > 65535))));
+	for (size_t i = lengthSize; i > 0; i--)
+		*ptr++ = static_cast<char>(size >> (8U * (i - 1)));
+	if (this->_masks) {
+		unsigned random_value = this->_rand();
+		char key[4] = {
+			static_cast<char>((random_value >> 24U) & 0xFFU),
+			static_cast<char>((random_value >> 16U) & 0xFFU),
+			static_cast<char>((random_value >> 8U) & 0xFFU),
+			static_cast<char>(random_value & 0xFFU)
+		};
+
+		memcpy(ptr, key, sizeof(key));
+		ptr += sizeof(key);
+		for (size_t i = 0; i < value.size(); i++)
+			ptr[i] = value[i] ^ key[i % 4];
+	} else
+		memcpy(ptr, value.data(), value.size());
+	frame.resize(ptr - frame.data() + value.size());
+
+	// Frames may be sent from several threads (broadcasts, command answers) so they must not interleave.
+	std::lock_guard<std::mutex> lock{this->_sendMutex};
+
+	Socket::send(frame.view());
 }
 
 void WebSocket::_pong(const std::string &validator)
 {
-	std::stringstream stream;
-	unsigned char byte = 0x8A;
+	char frame[2];
 
 	if (validator.size() > 125)
 		throw InvalidPongException("Pong validator cannot be longer than 125B");
-	stream << byte;
-	byte = 0x80 + validator.size();
-	stream << byte;
-	Socket::send(stream.str());
+	frame[0] = static_cast<char>(0x8A);
+	frame[1] = static_cast<char>(0x80 + validator.size());
+	Socket::send({frame, sizeof(frame)});
 }
 
 std::string WebSocket::strictRead(size_t i)
 {
-	std::string result = this->read(i);
+	// A frame can be split between several packets
+	std::string result = this->readExactly(i);
 
 	if (i != result.size())
 		throw EOFException("EOFException");
@@ -131,11 +136,13 @@ std::string WebSocket::getAnswer()
 	if (length == 126)
 		length = (static_cast<unsigned char>(this->strictRead(1)[0]) << 8U) +
 			static_cast<unsigned char>(this->strictRead(1)[0]);
-	else if (length == 127)
-		length = (static_cast<unsigned char>(this->strictRead(1)[0]) << 24U) +
-			(static_cast<unsigned char>(this->strictRead(1)[0]) << 16U) +
-			(static_cast<unsigned char>(this->strictRead(1)[0]) << 8U) +
-			static_cast<unsigned char>(this->strictRead(1)[0]);
+	else if (length == 127) {
+		auto bytes = this->strictRead(8);
+
+		length = 0;
+		for (unsigned char byte : bytes)
+			length = (length << 8U) | byte;
+	}
 
 	if (isMasked)
 		key = this->strictRead(4);
@@ -165,19 +172,18 @@ std::string WebSocket::getAnswer()
 void WebSocket::disconnect()
 {
 	try {
-		std::stringstream stream;
-		std::string result = "\x03\xe8";
+		// Close frame with the code 1000, masked
+		char frame[8] = {static_cast<char>(0x88), static_cast<char>(0x82)};
+		const char code[2] = {0x03, static_cast<char>(0xE8)};
 		unsigned random_value = this->_rand();
-		std::string key = std::string() +
-				  static_cast<char>((random_value >> 24U) & 0xFFU) +
-				  static_cast<char>((random_value >> 16U) & 0xFFU) +
-				  static_cast<char>((random_value >> 8U) & 0xFFU) +
-				  static_cast<char>(random_value & 0xFFU);
 
-		for (unsigned i = 0; i < result.size(); i++)
-			result[i] = result[i] ^ key[i % 4];
-		stream << "\x88\x82" << key << result;
-		Socket::send(stream.str());
+		frame[2] = static_cast<char>((random_value >> 24U) & 0xFFU);
+		frame[3] = static_cast<char>((random_value >> 16U) & 0xFFU);
+		frame[4] = static_cast<char>((random_value >> 8U) & 0xFFU);
+		frame[5] = static_cast<char>(random_value & 0xFFU);
+		for (unsigned i = 0; i < sizeof(code); i++)
+			frame[6 + i] = code[i] ^ frame[2 + i % 4];
+		Socket::send({frame, sizeof(frame)});
 		Socket::disconnect();
 	} catch (...) {
 		Socket::disconnect();
@@ -197,6 +203,12 @@ void WebSocket::connect(const std::string &host, unsigned short portno)
 	this->_establishHandshake(host);
 }
 
+void WebSocket::connect(unsigned int ip, unsigned short portno, const std::string &host)
+{
+	Socket::connect(ip, portno);
+	this->_establishHandshake(host);
+}
+
 WebSocket::WebSocket(const Socket &sock) :
 	Socket(sock)
 {
@@ -209,64 +221,45 @@ WebSocket::WebSocket(const Socket &&sock) :
 
 Socket::HttpResponse WebSocket::solveHandshake(const Socket::HttpRequest &request)
 {
-	Socket::HttpRequest requ = request;
 	HttpResponse response;
+	auto field = [&request](const char *name) -> std::string_view {
+		auto it = request.header.find(name);
+
+		return it == request.header.end() ? std::string_view{} : it->second;
+	};
 
 	if (request.method != "GET")
 		throw AbortConnectionException(405);
-	if (requ.header["upgrade"] != "websocket")
+	if (field("upgrade") != "websocket")
 		throw AbortConnectionException(400);
-	if (requ.header["connection"].find("Upgrade") == std::string::npos)
+	if (field("connection").find("Upgrade") == std::string::npos)
 		throw AbortConnectionException(400);
 	response.returnCode = 101;
 	response.header["Upgrade"] = "websocket";
 	response.header["Connection"] = "Upgrade";
-	response.header["Sec-WebSocket-Accept"] = _solveHandshakeToken(requ.header["sec-websocket-key"]);
+	response.header["Sec-WebSocket-Accept"] = _solveHandshakeToken(field("sec-websocket-key"));
 	return response;
 }
 
-std::string WebSocket::_solveHandshakeToken(const std::string &token)
+std::string WebSocket::_solveHandshakeToken(std::string_view token)
 {
+	Sha1 sha1;
+	unsigned char digest[Sha1::digestSize];
+
 	if (token.empty())
 		throw AbortConnectionException(400);
-	return base64::encode(hashString(token + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+	sha1.update(token.data(), token.size());
+	sha1.update(HANDSHAKE_GUID, strlen(HANDSHAKE_GUID));
+	sha1.finish(digest);
+	return base64::encode(digest, sizeof(digest));
 }
 
 std::vector<unsigned char> WebSocket::hashString(const std::string &str)
 {
-	HCRYPTPROV hProv = 0;
-	HCRYPTHASH hHash = 0;
-	DWORD cbRead = 0;
-	BYTE rgbHash[SHA1LEN];
-	DWORD cbHash = 0;
-	// Logic to check usage goes here.
-
-	// Get handle to the crypto provider
-	if (!CryptAcquireContext(&hProv, nullptr, nullptr, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT))
-		throw CryptFailedException("CryptAcquireContext failed");
-
-	if (!CryptCreateHash(hProv, CALG_SHA1, 0, 0, &hHash)) {
-		CryptReleaseContext(hProv, 0);
-		throw CryptFailedException("CryptCreateHash failed");
-	}
-
-	if (!CryptHashData(hHash, reinterpret_cast<const BYTE *>(str.c_str()), str.size(), 0)) {
-		CryptReleaseContext(hProv, 0);
-		CryptDestroyHash(hHash);
-		throw CryptFailedException("CryptHashData failed");
-	}
-
-	cbHash = SHA1LEN;
-	if (!CryptGetHashParam(hHash, HP_HASHVAL, rgbHash, &cbHash, 0)) {
-		CryptDestroyHash(hHash);
-		CryptReleaseContext(hProv, 0);
-		throw CryptFailedException("CryptGetHashParam failed");
-	}
-
-	CryptDestroyHash(hHash);
-	CryptReleaseContext(hProv, 0);
+	unsigned char digest[Sha1::digestSize];
 
-	return {rgbHash, rgbHash + 20};
+	Sha1::hash(str.data(), str.size(), digest);
+	return {digest, digest + sizeof(digest)};
 }
 
 WebSocket &WebSocket::operator=(const WebSocket &s)
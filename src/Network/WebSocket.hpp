@@ -13,10 +13,11 @@ class WebSocket : public Socket {
 private:
 	bool _masks = true;
 	std::random_device _rand;
+	std::mutex _sendMutex;
 
 	void _establishHandshake(const std::string &host);
 	void _pong(const std::string &validator);
-	static std::string _solveHandshakeToken(const std::string &token);
+	static std::string _solveHandshakeToken(std::string_view token);
 
 public:
 	static const char * const codesStrings[];
@@ -29,9 +30,12 @@ public:
 
 	void needsMask(bool masks);
 
-	void send(const std::string &value) override;
+	void send(std::string_view value) override;
 	void disconnect() override;
 	void connect(const std::string &host, unsigned short portno) override;
+	//! @brief Connect to an already resolved host.
+	//! @param host The host, for the handshake.
+	void connect(unsigned int ip, unsigned short portno, const std::string &host);
 	void sendHttpRequest(const HttpRequest &request);
 	std::string getAnswer();
 	std::string strictRead(size_t i);
@@ -12,15 +12,15 @@ namespace base64
 
 	using byte = std::uint8_t;
 
-	inline std::string encode(const std::vector<byte>& input)
+	inline std::string encode(const byte *input, std::size_t size)
 	{
 		std::string encoded;
-		encoded.reserve(((input.size() / 3) + (input.size() % 3 > 0)) * 4);
+		encoded.reserve(((size / 3) + (size % 3 > 0)) * 4);
 
 		std::uint32_t temp{};
-		auto it = input.begin();
+		auto it = input;
 
-		for(std::size_t i = 0; i < input.size() / 3; ++i)
+		for(std::size_t i = 0; i < size / 3; ++i)
 		{
 			temp  = (*it++) << 16;
 			temp += (*it++) << 8;
@@ -31,7 +31,7 @@ namespace base64
 			encoded.append(1, kEncodeLookup[(temp & 0x0000003F)      ]);
 		}
 
-		switch(input.size() % 3)
+		switch(size % 3)
 		{
 		case 1:
 			temp = (*it++) << 16;
@@ -52,7 +52,12 @@ namespace base64
 		return encoded;
 	}
 
-	std::vector<byte> decode(const std::string& input)
+	inline std::string encode(const std::vector<byte>& input)
+	{
+		return encode(input.data(), input.size());
+	}
+
+	inline std::vector<byte> decode(const std::string& input)
 	{
 		if(input.length() % 4)
 			throw std::runtime_error("Invalid base64 length!");
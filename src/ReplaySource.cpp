@@ -0,0 +1,349 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <random>
+#include "ReplaySource.hpp"
+#include "Timeline.hpp"
+#include "Utils/ShiftJISDecoder.hpp"
+
+static const char *listNames[] = {"deck", "hand", "used"};
+static const char *statNames[] = {"doll", "rod", "grimoire", "fan", "drops", "special"};
+
+static unsigned char findName(const std::string &name, const char * const *names, unsigned count)
+{
+	for (unsigned i = 0; i < count; i++)
+		if (name == names[i])
+			return i;
+	throw std::invalid_argument("Unknown name " + name);
+}
+
+void ReplaySource::load(const nlohmann::json &session)
+{
+	std::vector<Event> events;
+	unsigned frames = 0;
+
+	try {
+		for (auto &json : session.at("events")) {
+			std::string type = json.at("type");
+			Event event{};
+
+			event.frame = json.at("frame");
+			if (type == "score")
+				// Scores are computed from the KOs, just like in the game.
+				continue;
+			if (type == "roundStart")
+				event.type = Event::ROUND_START;
+			else if (type == "ko") {
+				event.type = Event::KO;
+				event.rounds[0] = json.at("leftRounds");
+				event.rounds[1] = json.at("rightRounds");
+			} else if (type == "weather") {
+				event.type = Event::WEATHER;
+				event.value = json.at("weather");
+				event.kind = json.value("cardsHidden", false);
+			} else {
+				event.left = json.at("side") == "left";
+				if (type == "cards") {
+					event.type = Event::CARDS;
+					event.kind = findName(json.at("list"), listNames, 3);
+					for (auto &card : json.at("cards"))
+						event.cards.push_back(card.get<unsigned short>());
+				} else if (type == "stat") {
+					event.type = Event::STAT;
+					event.kind = findName(json.at("stat"), statNames, 6);
+					event.value = json.at("value");
+				} else if (type == "skills") {
+					event.type = Event::SKILLS;
+					for (auto &skill : event.skills)
+						skill.notUsed = true;
+					for (auto &skill : json.at("skills").items()) {
+						auto index = std::stoul(skill.key());
+
+						if (index >= 16)
+							throw std::invalid_argument("Invalid skill " + skill.key());
+						event.skills[index].level = skill.value();
+						event.skills[index].notUsed = false;
+					}
+				} else
+					throw std::invalid_argument("Unknown event type " + type);
+			}
+			frames = (std::max)(frames, event.frame + 1);
+			events.push_back(event);
+		}
+		this->_initial = BattleSample{};
+		this->_initial.left = session.at("left");
+		this->_initial.right = session.at("right");
+		// Profile names are in Shift-JIS in the game
+		this->_initial.leftProfile = convertUTF8ToShiftJis(session.value("leftName", "Left").c_str(), NameString::capacity());
+		this->_initial.rightProfile = convertUTF8ToShiftJis(session.value("rightName", "Right").c_str(), NameString::capacity());
+		frames = (std::max)(frames, session.value("frames", 0U));
+	} catch (nlohmann::detail::exception &e) {
+		throw std::invalid_argument(e.what());
+	}
+	std::stable_sort(events.begin(), events.end(), [](const Event &a, const Event &b){
+		return a.frame < b.frame;
+	});
+	this->_events = std::move(events);
+	this->_frames = frames;
+	this->rewind();
+}
+
+nlohmann::json ReplaySource::loadTimeline(const std::string &path, unsigned match)
+{
+	auto timeline = Timeline::load(path);
+
+	for (auto &info : timeline->getMatches())
+		if (info["id"] == match)
+			return {
+				{"left", info["left"]},
+				{"right", info["right"]},
+				{"frames", info["frames"].get<unsigned>() + 1},
+				{"events", timeline->getEvents(match, 0, UINT_MAX)}
+			};
+	throw std::out_of_range("No match with id " + std::to_string(match));
+}
+
+nlohmann::json ReplaySource::generate(unsigned seed, unsigned roundFrames)
+{
+	// The distributions of the standard library are not the same everywhere, so stick to the raw generator.
+	std::mt19937 random{seed};
+	auto pick = [&random](unsigned max){
+		return static_cast<unsigned>(random() % max);
+	};
+	nlohmann::json events = nlohmann::json::array();
+	unsigned rounds[2] = {0, 0};
+	unsigned frame = 0;
+	unsigned left = pick(20);
+	unsigned right = pick(20);
+	CardList decks[2];
+	const char *sides[2] = {"left", "right"};
+
+	for (unsigned side = 0; side < 2; side++) {
+		unsigned character = side ? right : left;
+
+		// System cards and the character's own cards
+		while (decks[side].size() < CardList::capacity())
+			decks[side].push_back(pick(2) ? pick(21) : 100 + character * 100 + pick(20));
+		std::sort(decks[side].begin(), decks[side].end());
+	}
+	while (rounds[0] < 2 && rounds[1] < 2) {
+		CardList deck[2] = {decks[0], decks[1]};
+		CardList hand[2];
+		CardList used[2];
+		unsigned stats[2][6] = {};
+		unsigned char levels[2][4] = {};
+		unsigned end = frame + roundFrames / 2 + pick(roundFrames + 1);
+		auto cards = [&](unsigned side, unsigned list){
+			auto &cardList = list == 0 ? deck[side] : list == 1 ? hand[side] : used[side];
+
+			events.push_back({
+				{"frame", frame},
+				{"type", "cards"},
+				{"side", sides[side]},
+				{"list", listNames[list]},
+				{"cards", std::vector<unsigned short>(cardList.begin(), cardList.end())}
+			});
+		};
+
+		events.push_back({{"frame", frame}, {"type", "roundStart"}});
+		for (unsigned side = 0; side < 2; side++)
+			for (unsigned list = 0; list < 3; list++)
+				cards(side, list);
+		for (frame += 20 + pick(80); frame < end; frame += 20 + pick(80)) {
+			unsigned side = pick(2);
+			unsigned action = pick(10);
+
+			if (action < 4 && !deck[side].empty() && hand[side].size() < 5) {
+				unsigned index = pick(deck[side].size());
+
+				hand[side].push_back(deck[side][index]);
+				std::copy(deck[side].begin() + index + 1, deck[side].end(), deck[side].begin() + index);
+				deck[side].resize(deck[side].size() - 1);
+				cards(side, 0);
+				cards(side, 1);
+			} else if (action < 7 && !hand[side].empty()) {
+				used[side].push_back(hand[side][0]);
+				std::copy(hand[side].begin() + 1, hand[side].end(), hand[side].begin());
+				hand[side].resize(hand[side].size() - 1);
+				std::sort(used[side].begin(), used[side].end());
+				cards(side, 1);
+				cards(side, 2);
+			} else if (action < 8) {
+				unsigned stat = pick(6);
+
+				stats[side][stat] = (std::min)(stats[side][stat] + 1, 4U);
+				events.push_back({
+					{"frame", frame},
+					{"type", "stat"},
+					{"side", sides[side]},
+					{"stat", statNames[stat]},
+					{"value", stats[side][stat]}
+				});
+			} else if (action < 9) {
+				auto &level = levels[side][pick(4)];
+				nlohmann::json skills;
+
+				level = (std::min)(level + 1, 4);
+				for (unsigned i = 0; i < 4; i++)
+					skills[std::to_string(i)] = levels[side][i];
+				events.push_back({
+					{"frame", frame},
+					{"type", "skills"},
+					{"side", sides[side]},
+					{"skills", skills}
+				});
+			} else
+				events.push_back({
+					{"frame", frame},
+					{"type", "weather"},
+					{"weather", pick(21)},
+					{"cardsHidden", pick(10) == 0}
+				});
+		}
+		frame = end;
+		rounds[pick(2)]++;
+		events.push_back({
+			{"frame", frame},
+			{"type", "ko"},
+			{"leftRounds", rounds[0]},
+			{"rightRounds", rounds[1]}
+		});
+	}
+	return {
+		{"left", left},
+		{"right", right},
+		{"frames", frame + 1},
+		{"events", events}
+	};
+}
+
+void ReplaySource::_updateDeckCopy(bool left)
+{
+	auto &side = left ? this->_sample.leftSide : this->_sample.rightSide;
+
+	// The game's copy of the deck is the whole deck, the used cards are computed back from it.
+	side.deckCopy.clear();
+	for (auto card : side.deck)
+		side.deckCopy.push_back(card);
+	for (auto card : side.hand)
+		side.deckCopy.push_back(card);
+	for (auto card : this->_used[left ? 0 : 1])
+		side.deckCopy.push_back(card);
+}
+
+void ReplaySource::_apply(const Event &event)
+{
+	auto &side = event.left ? this->_sample.leftSide : this->_sample.rightSide;
+
+	switch (event.type) {
+	case Event::ROUND_START:
+		onRoundStart();
+		break;
+	case Event::KO:
+		this->_rounds[0] = event.rounds[0];
+		this->_rounds[1] = event.rounds[1];
+		onKO();
+		break;
+	case Event::CARDS:
+		if (event.kind == Timeline::LIST_DECK)
+			side.deck = event.cards;
+		else if (event.kind == Timeline::LIST_HAND)
+			side.hand = event.cards;
+		else
+			this->_used[event.left ? 0 : 1] = event.cards;
+		this->_updateDeckCopy(event.left);
+		break;
+	case Event::STAT:
+		switch (event.kind) {
+		case Timeline::STAT_DOLL:
+			side.stats.doll = event.value;
+			break;
+		case Timeline::STAT_ROD:
+			side.stats.rod = event.value;
+			break;
+		case Timeline::STAT_GRIMOIRE:
+			side.stats.grimoire = event.value;
+			break;
+		case Timeline::STAT_FAN:
+			side.stats.fan = event.value;
+			break;
+		case Timeline::STAT_DROPS:
+			side.stats.drops = event.value;
+			break;
+		default:
+			side.stats.specialValue = event.value;
+			break;
+		}
+		break;
+	case Event::SKILLS:
+		memcpy(side.stats.skillMap, event.skills, sizeof(side.stats.skillMap));
+		break;
+	case Event::WEATHER:
+		this->_sample.weather = event.value;
+		this->_sample.cardsHidden = event.kind;
+		break;
+	}
+}
+
+bool ReplaySource::step()
+{
+	if (this->_frame >= this->_frames) {
+		this->_inBattle = false;
+		return false;
+	}
+	this->_inBattle = true;
+	while (this->_next < this->_events.size() && this->_events[this->_next].frame <= this->_frame)
+		this->_apply(this->_events[this->_next++]);
+	updateCache(false);
+	this->_frame++;
+	return true;
+}
+
+void ReplaySource::rewind()
+{
+	this->_sample = this->_initial;
+	this->_used[0].clear();
+	this->_used[1].clear();
+	this->_rounds[0] = 0;
+	this->_rounds[1] = 0;
+	this->_next = 0;
+	this->_frame = 0;
+}
+
+unsigned ReplaySource::getFrame() const
+{
+	return this->_frame;
+}
+
+unsigned ReplaySource::getFrameCount() const
+{
+	return this->_frames;
+}
+
+void ReplaySource::capture(BattleSample &sample, bool isMultiplayer)
+{
+	sample = this->_sample;
+	sample.isMultiplayer = isMultiplayer;
+	// Keeps the scores between the games as long as the names don't change.
+	sample.isReplay = true;
+}
+
+void ReplaySource::getRounds(unsigned &left, unsigned &right)
+{
+	left = this->_rounds[0];
+	right = this->_rounds[1];
+}
+
+bool ReplaySource::isInBattle()
+{
+	return this->_inBattle;
+}
+
+unsigned char ReplaySource::getPalette(bool)
+{
+	return 0;
+}
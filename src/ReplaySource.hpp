@@ -0,0 +1,82 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_REPLAYSOURCE_HPP
+#define SWRSTOYS_REPLAYSOURCE_HPP
+
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "BattleSource.hpp"
+#include "nlohmann/json.hpp"
+
+//! @brief Plays a game from a list of events instead of reading it from the game.
+//! A session is a json object with the characters ("left" and "right"), the number of "frames"
+//! and the "events", in the format of the timeline (see Timeline::getEvents).
+//! Optional "leftName" and "rightName" give the profile names.
+class ReplaySource : public BattleSource {
+private:
+	struct Event {
+		unsigned frame;
+		enum Type {
+			ROUND_START,
+			KO,
+			CARDS,
+			STAT,
+			SKILLS,
+			WEATHER,
+		} type;
+		bool left;
+		unsigned char kind;
+		double value;
+		unsigned rounds[2];
+		CardList cards;
+		Skill skills[16];
+	};
+
+	//! Sample before the first event, only the names and the characters are set.
+	BattleSample _initial{};
+	BattleSample _sample{};
+	CardList _used[2];
+	unsigned _rounds[2] = {0, 0};
+	std::vector<Event> _events;
+	size_t _next = 0;
+	unsigned _frame = 0;
+	unsigned _frames = 0;
+	//! Read by the server threads when serializing the state.
+	std::atomic<bool> _inBattle{false};
+
+	void _apply(const Event &event);
+	void _updateDeckCopy(bool left);
+
+public:
+	//! @brief Replace the session played and go back to its first frame.
+	//! @throw std::invalid_argument The session is malformed.
+	void load(const nlohmann::json &session);
+
+	//! @brief Make a session out of a match recorded in a timeline.
+	//! @throw FileMappingException The file doesn't exist or is not a timeline, it is left untouched.
+	//! @throw std::out_of_range The match doesn't exist.
+	static nlohmann::json loadTimeline(const std::string &path, unsigned match);
+	//! @brief Make up a game. The same seed always gives the same game.
+	//! @param roundFrames Average length of a round.
+	static nlohmann::json generate(unsigned seed, unsigned roundFrames);
+
+	//! @brief Play the next frame: the round starts and KOs of this frame, then one updateCache.
+	//! @return false once every frame was played.
+	bool step();
+	//! @brief Go back to the first frame.
+	void rewind();
+	unsigned getFrame() const;
+	unsigned getFrameCount() const;
+
+	void capture(BattleSample &sample, bool isMultiplayer) override;
+	void getRounds(unsigned &left, unsigned &right) override;
+	bool isInBattle() override;
+	unsigned char getPalette(bool left) override;
+};
+
+
+#endif //SWRSTOYS_REPLAYSOURCE_HPP
@@ -3,458 +3,907 @@
 //
 
 #include "State.hpp"
+#include "BattleSource.hpp"
+#include "HookTimer.hpp"
+#include "Memory.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include "Timeline.hpp"
 #include "Network/Handlers.hpp"
-#include "Utils/InputBox.hpp"
+#include "Utils/JsonWriter.hpp"
+#include "Utils/SeqLock.hpp"
 #include "Utils/ShiftJISDecoder.hpp"
-#include "nlohmann/json.hpp"
-#include <SokuLib.hpp>
-#include <dinput.h>
+#include "Utils/SpscRing.hpp"
+#include <condition_variable>
+#include <cstring>
 #include <iostream>
-
-#define checkKey(key) (GetKeyState(keys[key]) & 0x8000)
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <zlib.h>
 
 unsigned short port;
-std::vector<unsigned> keys(TOTAL_NB_OF_KEYS);
 std::unique_ptr<WebServer> webServer;
+std::unique_ptr<BattleSource> battleSource;
 struct CachedMatchData _cache;
-bool needReset;
-bool needRefresh;
-int (SokuLib::BattleManager::*s_origCBattleManager_Render)();
-int (SokuLib::BattleManager::*s_origCBattleManager_Start)();
-int (SokuLib::BattleManager::*s_origCBattleManager_KO)();
-int (SokuLib::LoadingWatch::*s_origCLoadingWatch_Process)();
-int (SokuLib::BattleWatch::*s_origCBattleWatch_Process)();
-int (SokuLib::Loading::*s_origCLoading_Process)();
-int (SokuLib::Battle::*s_origCBattle_Process)();
-int (SokuLib::Title::*s_origCTitle_Process)();;
-HWND myWindow;
-
-const char *jpTitle = "ôîò√ö±æzôVæÑ ü` Æ┤£WïëâMâjâçâïé╠ôΣé≡Æ╟éª Ver1.10a";
-
-bool threadUsed = false;
-std::thread thread;
-std::vector<bool> oldState;
+std::atomic<bool> needReset;
+std::atomic<bool> needRefresh;
+std::atomic<bool> recvScores;
+
+// Last serialized state, shared by everything that needs the full state.
+static struct {
+	std::mutex mutex;
+	bool valid = false;
+	unsigned version;
+	bool isPlaying;
+	unsigned char leftPalette;
+	unsigned char rightPalette;
+	Memory::String<Memory::TAG_STATE> json;
+	Memory::String<Memory::TAG_STATE> compressed;
+} snapshot;
+
+static const char *cacheHelp = "Lookups of the serialized state, by cache and result.";
+static const Metrics::Counter stateHits = Metrics::counter("sokustreaming_cache_lookups_total", cacheHelp, Metrics::label("cache", "state") + "," + Metrics::label("result", "hit"));
+static const Metrics::Counter stateMisses = Metrics::counter("sokustreaming_cache_lookups_total", cacheHelp, Metrics::label("cache", "state") + "," + Metrics::label("result", "miss"));
+static const Metrics::Counter gzipHits = Metrics::counter("sokustreaming_cache_lookups_total", cacheHelp, Metrics::label("cache", "state_gzip") + "," + Metrics::label("result", "hit"));
+static const Metrics::Counter gzipMisses = Metrics::counter("sokustreaming_cache_lookups_total", cacheHelp, Metrics::label("cache", "state_gzip") + "," + Metrics::label("result", "miss"));
+
+// Lets other threads take a copy of the whole cache at once.
+static_assert(std::is_trivially_copyable<CachedMatchData>::value, "CachedMatchData must stay trivially copyable");
+
+// Timeline event coming from outside of the samples.
+struct TimelineEvent {
+	enum Type {
+		ROUND_START,
+		KO,
+		SCORE
+	} type;
+	unsigned frame;
+	unsigned first;
+	unsigned second;
+};
+
+// Turns the samples taken by the game thread into state updates.
+static struct {
+	//! Every sample is applied, so the timeline gets all the frames. About a second of them.
+	SpscRing<BattleSample, 64> samples;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable cond;
+	//! Notified each time a sample is applied.
+	std::condition_variable idle;
+	//! Frame after the last sample published.
+	std::atomic<unsigned> published{0};
+	//! Frame after the last sample published or skipped.
+	std::atomic<unsigned> taken{0};
+	//! The other threads' timeline events, written by the worker in frame order with the samples.
+	std::mutex eventsMutex;
+	std::vector<TimelineEvent> events;
+	//! Set with each sample or event, the worker clears it when it wakes up.
+	std::atomic<bool> hasNew{false};
+	//! Set under mutex right before the worker checks hasNew and waits.
+	std::atomic<bool> sleeping{false};
+	//! Frame after the last sample applied.
+	unsigned applied = 0;
+	bool closed = false;
+	//! Changes applied but not broadcast yet, the worker only broadcasts once it caught up.
+	bool pendingRefresh = false;
+	bool pendingHiddenChanged = false;
+} worker;
+
+static const Metrics::Counter droppedSamples = Metrics::counter("sokustreaming_state_dropped_samples_total", "Frames not sampled because the state worker was too far behind. They are missing from the timeline.");
+
+std::mutex cacheMutex;
+static SeqLock<CachedMatchData> publishedCache;
+// Counts the frames given to updateCache, the timeline events are placed with it.
+static std::atomic<unsigned> battleFrame{0};
+// Scores last written in the timeline, the scores can change from anywhere so they are checked on each write.
+static unsigned recordedScores[2] = {~0U, ~0U};
+
+// Only locks when the worker is waiting or about to, and it then only holds the lock to check hasNew.
+// hasNew and sleeping are both sequentially consistent: either the worker sees hasNew before it waits,
+// or we see sleeping and wait for the worker to be in cond.wait() before notifying it.
+static void wakeStateWorker()
+{
+	worker.hasNew = true;
+	if (worker.sleeping) {
+		worker.mutex.lock();
+		worker.mutex.unlock();
+	}
+	worker.cond.notify_one();
+}
+
+// The worker may still be on older samples, it writes the event once it applied them.
+static void queueTimelineEvent(TimelineEvent::Type type, unsigned first = 0, unsigned second = 0)
+{
+	{
+		std::lock_guard<std::mutex> lock{worker.eventsMutex};
+
+		worker.events.push_back({type, battleFrame, first, second});
+	}
+	wakeStateWorker();
+}
+
+// Writes the queued events which happened before the given frame was sampled.
+static void flushTimelineEvents(unsigned frame)
+{
+	std::lock_guard<std::mutex> lock{worker.eventsMutex};
+	auto it = worker.events.begin();
+
+	for (; it != worker.events.end() && it->frame <= frame; it++)
+		switch (it->type) {
+		case TimelineEvent::ROUND_START:
+			timeline->roundStart(it->frame);
+			break;
+		case TimelineEvent::KO:
+			timeline->ko(it->frame, it->first, it->second);
+			break;
+		case TimelineEvent::SCORE:
+			timeline->score(it->frame, static_cast<Timeline::Side>(it->first), it->second);
+			break;
+		}
+	worker.events.erase(worker.events.begin(), it);
+}
+
+CacheWriteLock::~CacheWriteLock()
+{
+	if (timeline) {
+		if (recordedScores[0] != _cache.leftScore)
+			queueTimelineEvent(TimelineEvent::SCORE, Timeline::SIDE_LEFT, _cache.leftScore);
+		if (recordedScores[1] != _cache.rightScore)
+			queueTimelineEvent(TimelineEvent::SCORE, Timeline::SIDE_RIGHT, _cache.rightScore);
+		recordedScores[0] = _cache.leftScore;
+		recordedScores[1] = _cache.rightScore;
+	}
+	publishedCache.store(_cache);
+}
+
+CachedMatchData readCache()
+{
+	return publishedCache.load();
+}
 bool isPlaying = false;
 
-void checkKeyInputs()
+// The scene and the palettes are not part of the cache, they are read from the source when serializing.
+static bool isInBattle()
 {
-	std::vector<bool> isPressed;
+	return battleSource && battleSource->isInBattle();
+}
 
-	if (!threadUsed && thread.joinable())
-		thread.join();
+static unsigned char getPalette(bool left)
+{
+	return battleSource ? battleSource->getPalette(left) : 0;
+}
 
-	if (GetForegroundWindow() != SokuLib::window)
-		return;
+// Skill slots in the order nlohmann::json sorts their keys
+static const unsigned char skillOrder[16] = {0, 1, 10, 11, 12, 13, 14, 15, 2, 3, 4, 5, 6, 7, 8, 9};
+static const char *skillNames[16] = {"0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "10", "11", "12", "13", "14", "15"};
 
-	isPressed.reserve(TOTAL_NB_OF_KEYS);
-	oldState.resize(TOTAL_NB_OF_KEYS);
-	for (int i = 0; i < TOTAL_NB_OF_KEYS; i++) {
-		auto val = checkKey(i);
+static void writeSkills(JsonWriter &writer, const Stats &stats)
+{
+	writer.beginObject();
+	for (auto i : skillOrder)
+		if (!stats.skillMap[i].notUsed)
+			writer.key(skillNames[i]).value(static_cast<unsigned>(stats.skillMap[i].level));
+	writer.endObject();
+}
 
-		isPressed.push_back(val && !oldState[i]);
-		oldState[i] = val;
-	}
+static void writeStats(JsonWriter &writer, const Stats &stats)
+{
+	writer.beginObject();
+	writer.key("doll").value(static_cast<double>(stats.doll));
+	writer.key("drops").value(static_cast<unsigned>(stats.drops));
+	writer.key("fan").value(static_cast<unsigned>(stats.fan));
+	writer.key("grimoire").value(static_cast<unsigned>(stats.grimoire));
+	writer.key("rod").value(static_cast<double>(stats.rod));
+	writer.key("skills");
+	writeSkills(writer, stats);
+	writer.key("special").value(stats.specialValue);
+	writer.endObject();
+}
 
-	if (isPressed[KEY_DECREASE_L_SCORE]) {
-		_cache.leftScore--;
-		broadcastOpcode(L_SCORE_UPDATE, std::to_string(_cache.leftScore));
-	}
-	if (isPressed[KEY_DECREASE_R_SCORE]) {
-		_cache.rightScore--;
-		broadcastOpcode(R_SCORE_UPDATE, std::to_string(_cache.rightScore));
-	}
-	if (isPressed[KEY_INCREASE_L_SCORE]) {
-		_cache.leftScore++;
-		broadcastOpcode(L_SCORE_UPDATE, std::to_string(_cache.leftScore));
-	}
-	if (isPressed[KEY_INCREASE_R_SCORE]) {
-		_cache.rightScore++;
-		broadcastOpcode(R_SCORE_UPDATE, std::to_string(_cache.rightScore));
-	}
-	if (isPressed[KEY_CHANGE_L_NAME]) {
-		if (!threadUsed) {
-			threadUsed = true;
-			if (thread.joinable())
-				thread.join();
-			thread = std::thread{[] {
-				auto answer = InputBox("Change left player name", "Left name", _cache.leftName);
-
-				if (answer.empty()) {
-					threadUsed = false;
-					return;
-				}
-				_cache.leftName = answer;
-				broadcastOpcode(L_NAME_UPDATE, "\"" + answer + "\"");
-				threadUsed = false;
-			}};
-		}
-	}
-	if (isPressed[KEY_CHANGE_ROUND]) {
-		if (!threadUsed) {
-			threadUsed = true;
-			if (thread.joinable())
-				thread.join();
-			thread = std::thread{[] {
-				auto answer = InputBox("Change round name", "Round name", _cache.round);
-
-				if (answer.empty()) {
-					threadUsed = false;
-					return;
-				}
-				_cache.round = answer;
-				broadcastOpcode(STATE_UPDATE, cacheToJson(_cache));
-				threadUsed = false;
-			}};
-		}
-	}
-	if (isPressed[KEY_CHANGE_R_NAME]) {
-		if (!threadUsed) {
-			threadUsed = true;
-			if (thread.joinable())
-				thread.join();
-			thread = std::thread{[] {
-				auto answer = InputBox("Change right player name", "Right name", _cache.rightName);
-
-				if (answer.empty()) {
-					threadUsed = false;
-					return;
-				}
-				_cache.rightName = answer;
-				broadcastOpcode(R_NAME_UPDATE, "\"" + answer + "\"");
-				threadUsed = false;
-			}};
+// Under mountain vapor, the whole deck and the hand are hidden behind card 21.
+static void writeDeck(JsonWriter &writer, const CardList &cards, const CardList &hand, bool hidden)
+{
+	if (hidden)
+		writer.repeat(21U, cards.size() + hand.size());
+	else
+		writer.array(cards.data(), cards.size());
+}
+
+static void writeHand(JsonWriter &writer, const CardList &hand, bool hidden)
+{
+	writer.array(hand.data(), hidden ? 0 : hand.size());
+}
+
+static void writeCards(JsonWriter &writer, const CachedMatchData &cache, bool left)
+{
+	bool hidden = cache.cardsHidden;
+	auto &hand = left ? cache.leftHand : cache.rightHand;
+	auto &used = left ? cache.leftUsed : cache.rightUsed;
+
+	writer.beginObject();
+	writer.key("deck");
+	writeDeck(writer, left ? cache.leftCards : cache.rightCards, hand, hidden);
+	writer.key("hand");
+	writeHand(writer, hand, hidden);
+	writer.key("used").array(used.data(), used.size());
+	writer.endObject();
+}
+
+static void writeSide(JsonWriter &writer, const CachedMatchData &cache, bool left)
+{
+	bool hidden = cache.cardsHidden;
+	auto &hand = left ? cache.leftHand : cache.rightHand;
+	auto &used = left ? cache.leftUsed : cache.rightUsed;
+
+	writer.beginObject();
+	writer.key("character").value(static_cast<int>(left ? cache.left : cache.right));
+	writer.key("deck");
+	writeDeck(writer, left ? cache.leftCards : cache.rightCards, hand, hidden);
+	writer.key("hand");
+	writeHand(writer, hand, hidden);
+	writer.key("name").value((left ? cache.leftUtf8Name : cache.rightUtf8Name).c_str());
+	writer.key("palette").value(static_cast<unsigned>(getPalette(left)));
+	writer.key("score").value(left ? cache.leftScore : cache.rightScore);
+	writer.key("stats");
+	writeStats(writer, left ? cache.leftStats : cache.rightStats);
+	writer.key("used").array(used.data(), used.size());
+	writer.endObject();
+}
+
+// Each thread serializes in its own buffer, which keeps its capacity between calls.
+static JsonWriter &getWriter()
+{
+	thread_local JsonWriter writer;
+
+	writer.clear();
+	return writer;
+}
+
+static unsigned diffStats(const Stats &oldStats, const Stats &newStats)
+{
+	unsigned dirty = 0;
+
+	if (oldStats.rod != newStats.rod)
+		dirty |= DIRTY_ROD;
+	if (oldStats.doll != newStats.doll)
+		dirty |= DIRTY_DOLL;
+	if (oldStats.grimoire != newStats.grimoire)
+		dirty |= DIRTY_GRIMOIRE;
+	if (oldStats.fan != newStats.fan)
+		dirty |= DIRTY_FAN;
+	if (oldStats.drops != newStats.drops)
+		dirty |= DIRTY_DROPS;
+	if (oldStats.specialValue != newStats.specialValue)
+		dirty |= DIRTY_SPECIAL;
+	if (memcmp(oldStats.skillMap, newStats.skillMap, sizeof(oldStats.skillMap)) != 0)
+		dirty |= DIRTY_SKILLS;
+	return dirty;
+}
+
+// Card ids are used as indexes in the histograms. Anything higher is ignored.
+static const unsigned MAX_CARD_ID = 1024;
+
+// FNV-1a of everything the card lists are computed from.
+static uint64_t fingerprintCards(const SideSample &side)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	auto mix = [&hash](const CardList &list){
+		hash = (hash ^ list.size()) * 0x100000001B3ULL;
+		for (auto card : list)
+			hash = (hash ^ card) * 0x100000001B3ULL;
+	};
+
+	mix(side.deck);
+	mix(side.deckCopy);
+	mix(side.hand);
+	return hash;
+}
+
+// Write the cards counted in the histogram in list, in increasing order.
+// Returns whether the list changed.
+static bool fillFromHistogram(CardList &list, const unsigned char (&counts)[MAX_CARD_ID])
+{
+	size_t pos = 0;
+	bool changed = false;
+
+	for (unsigned id = 0; id < MAX_CARD_ID; id++)
+		for (unsigned n = counts[id]; n && pos < CardList::capacity(); n--, pos++) {
+			if (pos == list.size())
+				list.push_back(id);
+			else if (list[pos] != id)
+				list[pos] = id;
+			else
+				continue;
+			changed = true;
 		}
+	if (pos != list.size()) {
+		list.resize(pos);
+		changed = true;
 	}
-	if (isPressed[KEY_RESET_SCORES]) {
-		_cache.leftScore = 0;
-		_cache.rightScore = 0;
-		broadcastOpcode(L_SCORE_UPDATE, std::to_string(_cache.leftScore));
-		broadcastOpcode(R_SCORE_UPDATE, std::to_string(_cache.rightScore));
-	}
-	if (isPressed[KEY_RESET_STATE]) {
-		_cache = CachedMatchData();
-		broadcastOpcode(STATE_UPDATE, cacheToJson(_cache));
-		needRefresh = true;
-		needReset = true;
-	}
+	return changed;
 }
 
-nlohmann::json statsToJson(const Stats &stats)
+static void updateCards(
+	const SideSample &side,
+	uint64_t &hash,
+	CardList &cards,
+	CardList &handCards,
+	CardList &used,
+	unsigned &dirty
+)
 {
-	nlohmann::json result = {
-		{"doll",     stats.doll},
-		{"rod",      stats.rod},
-		{"grimoire", stats.grimoire},
-		{"fan",      stats.fan},
-		{"drops",    stats.drops},
-		{"special",  stats.specialValue}
-	};
-	std::map<std::string, unsigned char> skillMap;
+	uint64_t newHash = fingerprintCards(side);
 
-	for (int i = 0; i < 16; i++) {
-		if (!stats.skillMap[i].notUsed)
-			skillMap[std::to_string(i)] = stats.skillMap[i].level;
+	if (newHash == hash)
+		return;
+	hash = newHash;
+
+	unsigned char deckCounts[MAX_CARD_ID] = {0};
+	unsigned char handCounts[MAX_CARD_ID] = {0};
+	unsigned char usedCounts[MAX_CARD_ID] = {0};
+
+	// Used cards are the ones from the original deck that are neither in the deck nor in the hand anymore.
+	for (auto card : side.deckCopy)
+		if (card < MAX_CARD_ID)
+			usedCounts[card]++;
+	for (auto card : side.deck)
+		if (card < MAX_CARD_ID)
+			deckCounts[card]++;
+	for (auto card : side.hand)
+		if (card < MAX_CARD_ID)
+			handCounts[card]++;
+	for (unsigned id = 0; id < MAX_CARD_ID; id++) {
+		unsigned taken = deckCounts[id] + handCounts[id];
+
+		usedCounts[id] = usedCounts[id] > taken ? usedCounts[id] - taken : 0;
 	}
 
-	result["skills"] = skillMap;
-	return result;
+	if (fillFromHistogram(cards, deckCounts))
+		dirty |= DIRTY_DECK;
+	if (fillFromHistogram(handCards, handCounts))
+		dirty |= DIRTY_HAND;
+	if (fillFromHistogram(used, usedCounts))
+		dirty |= DIRTY_USED;
 }
 
-std::string statsToString(const Stats &stats)
+static void recordSide(unsigned frame, Timeline::Side side, const CardList *lists[3], const Stats &stats, unsigned dirty, bool hidden)
 {
-	return statsToJson(stats).dump(-1, ' ', true);
+	static const unsigned listBits[3] = {DIRTY_DECK, DIRTY_HAND, DIRTY_USED};
+
+	// Hidden cards stay out of the history too, they are recorded once the weather changes.
+	for (unsigned i = 0; i < 3 && !hidden; i++)
+		if (dirty & listBits[i])
+			timeline->cards(frame, side, static_cast<Timeline::CardListType>(i), lists[i]->data(), lists[i]->size());
+	if (dirty & DIRTY_DOLL)
+		timeline->stat(frame, side, Timeline::STAT_DOLL, stats.doll);
+	if (dirty & DIRTY_ROD)
+		timeline->stat(frame, side, Timeline::STAT_ROD, stats.rod);
+	if (dirty & DIRTY_GRIMOIRE)
+		timeline->stat(frame, side, Timeline::STAT_GRIMOIRE, stats.grimoire);
+	if (dirty & DIRTY_FAN)
+		timeline->stat(frame, side, Timeline::STAT_FAN, stats.fan);
+	if (dirty & DIRTY_DROPS)
+		timeline->stat(frame, side, Timeline::STAT_DROPS, stats.drops);
+	if (dirty & DIRTY_SPECIAL)
+		timeline->stat(frame, side, Timeline::STAT_SPECIAL, stats.specialValue);
+	if (dirty & DIRTY_SKILLS) {
+		unsigned char levels[16];
+		unsigned used = 0;
+
+		for (unsigned i = 0; i < 16; i++) {
+			levels[i] = stats.skillMap[i].level;
+			if (!stats.skillMap[i].notUsed)
+				used |= 1U << i;
+		}
+		timeline->skills(frame, side, levels, used);
+	}
 }
 
-void updateCache(bool isMultiplayer)
+static void recordSample(const BattleSample &sample, bool newMatch, bool weatherChanged, unsigned leftDirty, unsigned rightDirty)
 {
-	if (!isPlaying)
-		return;
+	const CardList *left[3] = {&_cache.leftCards, &_cache.leftHand, &_cache.leftUsed};
+	const CardList *right[3] = {&_cache.rightCards, &_cache.rightHand, &_cache.rightUsed};
+	bool hidden = _cache.cardsHidden;
+
+	if (newMatch) {
+		timeline->startMatch(sample.frame, sample.left, sample.right);
+		// The round started before the match was created, see onRoundStart.
+		timeline->roundStart(sample.frame);
+		// Make sure the scores are in the new match
+		recordedScores[0] = recordedScores[1] = ~0U;
+	}
+	if (newMatch || weatherChanged)
+		timeline->weather(sample.frame, _cache.weather, _cache.cardsHidden);
+	recordSide(sample.frame, Timeline::SIDE_LEFT, left, _cache.leftStats, newMatch ? ~0U : leftDirty, hidden);
+	recordSide(sample.frame, Timeline::SIDE_RIGHT, right, _cache.rightStats, newMatch ? ~0U : rightDirty, hidden);
+}
+
+// The same changes as the STATE_DELTA, for the clients which didn't ask for it.
+static void broadcastLegacyUpdates(const CachedMatchData &cache, bool hiddenChanged)
+{
+	if (hiddenChanged)
+		broadcastOpcode(CARDS_UPDATE, generateCardsJson(cache), AUDIENCE_LEGACY);
+	else {
+		if (cache.leftDirty & DIRTY_CARDS)
+			broadcastOpcode(L_CARDS_UPDATE, generateLeftCardsJson(cache), AUDIENCE_LEGACY);
+		if (cache.rightDirty & DIRTY_CARDS)
+			broadcastOpcode(R_CARDS_UPDATE, generateRightCardsJson(cache), AUDIENCE_LEGACY);
+	}
+	if (cache.leftDirty & DIRTY_STATS)
+		broadcastOpcode(L_STATS_UPDATE, generateStatsJson(cache.leftStats), AUDIENCE_LEGACY);
+	if (cache.rightDirty & DIRTY_STATS)
+		broadcastOpcode(R_STATS_UPDATE, generateStatsJson(cache.rightStats), AUDIENCE_LEGACY);
+}
 
-	auto &battleMgr = SokuLib::getBattleMgr();
+// Does everything updateCache used to do on the game thread, from a sample instead of the game memory.
+// Without broadcast, the changes are only recorded and wait for the next sample broadcasting them.
+static void applySample(const BattleSample &sample, bool broadcast)
+{
+	Trace::Scope scope{"apply sample", "state"};
+	bool weatherChanged = _cache.weather != sample.weather;
+	bool hiddenChanged = false;
+	// Only the changes of this sample, for the timeline
+	unsigned leftDirty = 0;
+	unsigned rightDirty = 0;
+	// Cleared right away, a refresh asked for while this sample is applied is for the next one.
+	bool refresh = needRefresh.exchange(false);
 
 	if (needReset) {
 		if (_cache.noReset);
-		else if (isMultiplayer) {
-			auto &netObj = SokuLib::getNetObject();
-
-			if (_cache.realLeftName != netObj.profile1name || _cache.realRightName != netObj.profile2name) {
-				if (!_cache.recvScores) {
+		else if (sample.isMultiplayer) {
+			if (_cache.realLeftName != sample.leftProfile.c_str() || _cache.realRightName != sample.rightProfile.c_str()) {
+				if (!recvScores) {
 					_cache.leftScore = 0;
 					_cache.rightScore = 0;
 				}
-				_cache.leftName = netObj.profile1name;
-				_cache.rightName = netObj.profile2name;
-				_cache.realLeftName = netObj.profile1name;
-				_cache.realRightName = netObj.profile2name;
+				setName(_cache, true, sample.leftProfile.c_str());
+				setName(_cache, false, sample.rightProfile.c_str());
+				_cache.realLeftName = sample.leftProfile.c_str();
+				_cache.realRightName = sample.rightProfile.c_str();
+				_cache.version++;
 			}
 		} else if (
-			_cache.realLeftName != SokuLib::profile1.name.operator char *() ||
-			_cache.realRightName != SokuLib::profile2.name.operator char *() ||
-			SokuLib::subMode != SokuLib::BATTLE_SUBMODE_REPLAY
+			_cache.realLeftName != sample.leftProfile.c_str() ||
+			_cache.realRightName != sample.rightProfile.c_str() ||
+			!sample.isReplay
 		) {
 			_cache.leftScore = 0;
 			_cache.rightScore = 0;
-			_cache.leftName = static_cast<const char *>(SokuLib::profile1.name);
-			_cache.rightName = static_cast<const char *>(SokuLib::profile2.name);
-			_cache.realLeftName = static_cast<const char *>(SokuLib::profile1.name);
-			_cache.realRightName = static_cast<const char *>(SokuLib::profile2.name);
+			setName(_cache, true, sample.leftProfile.c_str());
+			setName(_cache, false, sample.rightProfile.c_str());
+			_cache.realLeftName = sample.leftProfile.c_str();
+			_cache.realRightName = sample.rightProfile.c_str();
+			_cache.version++;
 		}
 		needReset = false;
 	}
 	_cache.noReset = false;
 
-	auto oldLeftHand = _cache.leftHand;
-	auto oldRightHand = _cache.rightHand;
-
-	_cache.leftCards.clear();
-	_cache.rightCards.clear();
-	_cache.leftHand.clear();
-	_cache.rightHand.clear();
-	_cache.leftUsed.clear();
-	_cache.rightUsed.clear();
-
-	auto &leftDeck = battleMgr.leftCharacterManager.deckInfo;
-	auto &rightDeck = battleMgr.rightCharacterManager.deckInfo;
-	auto &leftHand = battleMgr.leftCharacterManager.hand;
-	auto &rightHand = battleMgr.rightCharacterManager.hand;
-
-	// Left remaining cards
-	for (int i = 0; i < leftDeck.deckCopy.size; i++)
-		_cache.leftUsed.push_back(leftDeck.deckCopy[i]);
-	for (int i = 0; i < leftDeck.deck.size; i++) {
-		_cache.leftUsed.erase(std::find(_cache.leftUsed.begin(), _cache.leftUsed.end(), leftDeck.deck[i]));
-		_cache.leftCards.push_back(leftDeck.deck[i]);
-	}
-	std::sort(_cache.leftCards.begin(), _cache.leftCards.end());
-
-	// Right remaining cards
-	for (int i = 0; i < rightDeck.deckCopy.size; i++)
-		_cache.rightUsed.push_back(rightDeck.deckCopy[i]);
-	for (int i = 0; i < rightDeck.deck.size; i++) {
-		_cache.rightUsed.erase(std::find(_cache.rightUsed.begin(), _cache.rightUsed.end(), rightDeck.deck[i]));
-		_cache.rightCards.push_back(rightDeck.deck[i]);
+	updateCards(sample.leftSide, _cache.leftCardsHash, _cache.leftCards, _cache.leftHand, _cache.leftUsed, leftDirty);
+	updateCards(sample.rightSide, _cache.rightCardsHash, _cache.rightCards, _cache.rightHand, _cache.rightUsed, rightDirty);
+
+	if (weatherChanged) {
+		_cache.weather = sample.weather;
+		if (_cache.cardsHidden != sample.cardsHidden) {
+			hiddenChanged = true;
+			_cache.cardsHidden = sample.cardsHidden;
+			leftDirty |= DIRTY_CARDS;
+			rightDirty |= DIRTY_CARDS;
+		}
 	}
-	std::sort(_cache.rightCards.begin(), _cache.rightCards.end());
 
-	// Hands
-	for (int i = 0; i < battleMgr.leftCharacterManager.cardCount; i++) {
-		_cache.leftHand.push_back(leftHand.handCardBase[(i + leftHand.selectedCard) % leftHand.handCardMax]->id);
-		_cache.leftUsed.erase(std::find(_cache.leftUsed.begin(), _cache.leftUsed.end(), _cache.leftHand.back()));
+	leftDirty |= diffStats(_cache.leftStats, sample.leftSide.stats);
+	_cache.leftStats = sample.leftSide.stats;
+	rightDirty |= diffStats(_cache.rightStats, sample.rightSide.stats);
+	_cache.rightStats = sample.rightSide.stats;
+
+	if (refresh) {
+		_cache.left = sample.left;
+		_cache.right = sample.right;
 	}
-	for (int i = 0; i < battleMgr.rightCharacterManager.cardCount; i++) {
-		_cache.rightHand.push_back(rightHand.handCardBase[(i + rightHand.selectedCard) % rightHand.handCardMax]->id);
-		_cache.rightUsed.erase(std::find(_cache.rightUsed.begin(), _cache.rightUsed.end(), _cache.rightHand.back()));
+	if (refresh || leftDirty || rightDirty)
+		_cache.version++;
+	if (timeline)
+		recordSample(sample, refresh, weatherChanged, leftDirty, rightDirty);
+	_cache.leftDirty |= leftDirty;
+	_cache.rightDirty |= rightDirty;
+	worker.pendingRefresh |= refresh;
+	worker.pendingHiddenChanged |= hiddenChanged;
+	if (!broadcast)
+		return;
+
+	if (worker.pendingRefresh)
+		broadcastOpcode(STATE_UPDATE, getStateJson(_cache));
+	else if (_cache.leftDirty || _cache.rightDirty) {
+		broadcastOpcode(STATE_DELTA, generateDeltaJson(_cache), AUDIENCE_DELTAS);
+		broadcastLegacyUpdates(_cache, worker.pendingHiddenChanged);
 	}
-	std::sort(_cache.leftHand.begin(), _cache.leftHand.end());
-	std::sort(_cache.rightHand.begin(), _cache.rightHand.end());
-	std::sort(_cache.leftUsed.begin(), _cache.leftUsed.end());
-	std::sort(_cache.rightUsed.begin(), _cache.rightUsed.end());
-
-	if (_cache.leftHand.size() != oldLeftHand.size() && !needRefresh)
-		broadcastOpcode(L_CARDS_UPDATE, generateLeftCardsJson(_cache));
-	if (_cache.rightHand.size() != oldRightHand.size() && !needRefresh)
-		broadcastOpcode(R_CARDS_UPDATE, generateRightCardsJson(_cache));
-
-	if (_cache.weather != SokuLib::activeWeather) {
-		auto old = _cache.weather;
-
-		_cache.weather = SokuLib::activeWeather;
-		if (old == SokuLib::WEATHER_MOUNTAIN_VAPOR || SokuLib::activeWeather == SokuLib::WEATHER_MOUNTAIN_VAPOR)
-			if (!needRefresh)
-				broadcastOpcode(CARDS_UPDATE, generateCardsJson(_cache));
+	_cache.leftDirty = 0;
+	_cache.rightDirty = 0;
+	worker.pendingRefresh = false;
+	worker.pendingHiddenChanged = false;
+}
+
+static void stateWorkerLoop()
+{
+	while (true) {
+		std::unique_lock<std::mutex> lock{worker.mutex};
+
+		// hasNew is cleared here, so events that can't be written before the next sample don't keep the worker spinning.
+		worker.sleeping = true;
+		worker.cond.wait(lock, []{
+			return worker.closed || worker.hasNew.exchange(false);
+		});
+		worker.sleeping = false;
+		if (worker.closed)
+			return;
+		lock.unlock();
+
+		// When behind, the samples in between are only recorded and the last one broadcasts all their changes.
+		while (!worker.samples.empty()) {
+			auto &sample = worker.samples.front();
+			bool last = worker.samples.size() == 1;
+			unsigned frame = sample.frame;
+
+			if (timeline)
+				flushTimelineEvents(frame);
+			if (last) {
+				setBroadcastOrigin(sample.frame, sample.sampledAt);
+				beginBroadcastBatch();
+			}
+			{
+				CacheWriteLock cacheLock;
+
+				applySample(sample, last);
+			}
+			if (last) {
+				endBroadcastBatch();
+				clearBroadcastOrigin();
+			}
+			worker.samples.pop();
+			lock.lock();
+			worker.applied = frame + 1;
+			lock.unlock();
+			worker.idle.notify_all();
+		}
+		if (timeline)
+			flushTimelineEvents(worker.taken);
 	}
+}
 
-	Stats newStats;
-
-	newStats.doll =     battleMgr.leftCharacterManager.sacrificialDolls;
-	newStats.drops =    battleMgr.leftCharacterManager.drops;
-	newStats.rod =      battleMgr.leftCharacterManager.controlRod;
-	newStats.fan =      battleMgr.leftCharacterManager.tenguFans;
-	newStats.grimoire = battleMgr.leftCharacterManager.grimoires;
-	if (SokuLib::leftChar == SokuLib::CHARACTER_YUYUKO)
-		newStats.specialValue = battleMgr.leftCharacterManager.resurrectionButterfliesUsed;
-	else if (SokuLib::leftChar == SokuLib::CHARACTER_REISEN)
-		newStats.specialValue = battleMgr.leftCharacterManager.elixirUsed;
-	else
-		newStats.specialValue = 0;
-	std::memcpy(newStats.skillMap, battleMgr.leftCharacterManager.skillMap, sizeof(newStats.skillMap));
-	if (memcmp(&newStats, &_cache.leftStats, sizeof(newStats)) != 0) {
-		std::memcpy(&_cache.leftStats, &newStats, sizeof(newStats));
-		if (!needRefresh)
-			broadcastOpcode(L_STATS_UPDATE, statsToString(newStats));
+void startStateWorker()
+{
+	worker.closed = false;
+	worker.thread = std::thread([]{
+		Trace::nameThread("State worker");
+		stateWorkerLoop();
+	});
+}
+
+void stopStateWorker()
+{
+	worker.mutex.lock();
+	worker.closed = true;
+	worker.mutex.unlock();
+	worker.cond.notify_all();
+	worker.idle.notify_all();
+	if (worker.thread.joinable())
+		worker.thread.join();
+	if (timeline)
+		flushTimelineEvents(~0U);
+}
+
+void waitStateWorker()
+{
+	std::unique_lock<std::mutex> lock{worker.mutex};
+
+	worker.idle.wait(lock, []{
+		return worker.closed || worker.applied == worker.published;
+	});
+}
+
+void updateCache(bool isMultiplayer)
+{
+	static const auto duration = Metrics::histogram("sokustreaming_update_cache_duration_seconds", "Time spent sampling the battle on the game thread.", getHookBuckets(), 1e-9);
+
+	if (!isPlaying)
+		return;
+
+	auto start = Metrics::now();
+	Trace::Scope scope{"sample", "state"};
+
+	// The frame is still counted, so the timeline shows the gap.
+	if (worker.samples.full()) {
+		worker.taken = ++battleFrame;
+		droppedSamples.add();
+		return;
 	}
+	auto &sample = worker.samples.back();
+
+	// Only take a copy of the game state here, the worker does the rest.
+	battleSource->capture(sample, isMultiplayer);
+	sample.frame = battleFrame++;
+	HookTimer::noteSample(sample.frame);
+	sample.sampledAt = start;
+	worker.samples.publish();
+	worker.published = sample.frame + 1;
+	worker.taken = sample.frame + 1;
+	wakeStateWorker();
+	duration.observe(Metrics::now() - start);
+}
+
+void setName(CachedMatchData &cache, bool left, const char *shiftJis)
+{
+	auto &name = left ? cache.leftName : cache.rightName;
+
+	name = shiftJis;
+	(left ? cache.leftUtf8Name : cache.rightUtf8Name) = convertShiftJisToUTF8(name.c_str());
+}
+
+// Valid until the next serialization on this thread
+static std::string_view writeStateJson(const CachedMatchData &cache)
+{
+	Trace::Scope scope{"state json", "json"};
+	auto &writer = getWriter();
+
+	writer.beginObject();
+	writer.key("isPlaying").value(isInBattle());
+	writer.key("left");
+	writeSide(writer, cache, true);
+	writer.key("right");
+	writeSide(writer, cache, false);
+	writer.key("round").value(cache.round.c_str());
+	writer.endObject();
+	return writer.str();
+}
+
+std::string cacheToJson(const CachedMatchData &cache)
+{
+	return std::string(writeStateJson(cache));
+}
+
+static void compressGzip(std::string_view data, Memory::String<Memory::TAG_STATE> &result)
+{
+	z_stream stream{};
 
-	newStats.doll =     battleMgr.rightCharacterManager.sacrificialDolls;
-	newStats.drops =    battleMgr.rightCharacterManager.drops;
-	newStats.rod =      battleMgr.rightCharacterManager.controlRod;
-	newStats.fan =      battleMgr.rightCharacterManager.tenguFans;
-	newStats.grimoire = battleMgr.rightCharacterManager.grimoires;
-	if (SokuLib::rightChar == SokuLib::CHARACTER_YUYUKO)
-		newStats.specialValue = battleMgr.rightCharacterManager.resurrectionButterfliesUsed;
-	else if (SokuLib::rightChar == SokuLib::CHARACTER_REISEN)
-		newStats.specialValue = battleMgr.rightCharacterManager.elixirUsed;
+	result.clear();
+	if (deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return;
+	result.resize(deflateBound(&stream, data.size()));
+	stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+	stream.avail_in = data.size();
+	stream.next_out = reinterpret_cast<Bytef *>(result.data());
+	stream.avail_out = result.size();
+	if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+		result.clear();
 	else
-		newStats.specialValue = 0;
-	std::memcpy(newStats.skillMap, battleMgr.rightCharacterManager.skillMap, sizeof(newStats.skillMap));
-	if (memcmp(&newStats, &_cache.rightStats, sizeof(newStats)) != 0) {
-		std::memcpy(&_cache.rightStats, &newStats, sizeof(newStats));
-		if (!needRefresh)
-			broadcastOpcode(R_STATS_UPDATE, statsToString(newStats));
-	}
+		result.resize(stream.total_out);
+	deflateEnd(&stream);
+}
 
-	if (needRefresh) {
-		_cache.left = SokuLib::leftChar;
-		_cache.right = SokuLib::rightChar;
-		needRefresh = false;
-		broadcastOpcode(STATE_UPDATE, cacheToJson(_cache));
-	}
-	checkKeyInputs();
+static bool checkSnapshot(const CachedMatchData &cache)
+{
+	bool isPlaying = isInBattle();
+	unsigned char leftPalette = getPalette(true);
+	unsigned char rightPalette = getPalette(false);
+
+	// The palettes and the scene are not part of the cache but still end up in the json.
+	if (
+		snapshot.valid &&
+		snapshot.version == cache.version &&
+		snapshot.isPlaying == isPlaying &&
+		snapshot.leftPalette == leftPalette &&
+		snapshot.rightPalette == rightPalette
+	)
+		return true;
+	snapshot.valid = true;
+	snapshot.version = cache.version;
+	snapshot.isPlaying = isPlaying;
+	snapshot.leftPalette = leftPalette;
+	snapshot.rightPalette = rightPalette;
+	snapshot.json = writeStateJson(cache);
+	snapshot.compressed.clear();
+	return false;
 }
 
-std::string cacheToJson(CachedMatchData cache)
+template<typename T>
+static void copyStateJson(const CachedMatchData &cache, T &out)
 {
-	nlohmann::json result;
-	std::vector<unsigned short> leftDeck;
-	std::vector<unsigned short> rightDeck;
-	std::vector<unsigned short> leftHand;
-	std::vector<unsigned short> rightHand;
+	std::lock_guard<std::mutex> lock{snapshot.mutex};
 
-	if (cache.weather == SokuLib::WEATHER_MOUNTAIN_VAPOR) {
-		leftDeck.resize(cache.leftCards.size() + cache.leftHand.size(), 21);
-		rightDeck.resize(cache.rightCards.size() + cache.rightHand.size(), 21);
-	} else {
-		leftDeck = cache.leftCards;
-		rightDeck = cache.rightCards;
-		leftHand = cache.leftHand;
-		rightHand = cache.rightHand;
-	}
+	(checkSnapshot(cache) ? stateHits : stateMisses).add();
+	out.assign(snapshot.json);
+}
 
-	result["isPlaying"] = SokuLib::sceneId == SokuLib::SCENE_BATTLE ||
-			      SokuLib::sceneId == SokuLib::SCENE_BATTLECL ||
-			      SokuLib::sceneId == SokuLib::SCENE_BATTLESV ||
-			      SokuLib::sceneId == SokuLib::SCENE_BATTLEWATCH;
-	result["left"] = {
-		{ "palette",   SokuLib::leftPlayerInfo.palette },
-		{ "character", cache.left },
-		{ "score",     cache.leftScore },
-		{ "name",      convertShiftJisToUTF8(cache.leftName.c_str()) },
-		{ "used",      cache.leftUsed },
-		{ "deck",      leftDeck },
-		{ "hand",      leftHand },
-		{ "stats",     statsToJson(cache.leftStats) }
-	};
-	result["right"] = {
-		{ "palette",   SokuLib::rightPlayerInfo.palette },
-		{ "character", cache.right },
-		{ "score",     cache.rightScore },
-		{ "name",      convertShiftJisToUTF8(cache.rightName.c_str()) },
-		{ "used",      cache.rightUsed },
-		{ "deck",      rightDeck },
-		{ "hand",      rightHand },
-		{ "stats",     statsToJson(cache.rightStats) }
-	};
-	result["round"] = cache.round;
-	return result.dump(-1, ' ', true);
-}
-
-std::string generateCardsJson(CachedMatchData cache)
-{
-	nlohmann::json result;
-	std::vector<unsigned short> leftDeck;
-	std::vector<unsigned short> rightDeck;
-	std::vector<unsigned short> leftHand;
-	std::vector<unsigned short> rightHand;
-
-	if (cache.weather == SokuLib::WEATHER_MOUNTAIN_VAPOR) {
-		leftDeck.resize(cache.leftCards.size() + cache.leftHand.size(), 21);
-		rightDeck.resize(cache.rightCards.size() + cache.rightHand.size(), 21);
-	} else {
-		leftDeck = cache.leftCards;
-		rightDeck = cache.rightCards;
-		leftHand = cache.leftHand;
-		rightHand = cache.rightHand;
-	}
+template<typename T>
+static void copyCompressedStateJson(const CachedMatchData &cache, T &out)
+{
+	std::lock_guard<std::mutex> lock{snapshot.mutex};
 
-	result["left"] = {
-		{ "used", cache.leftUsed },
-		{ "deck", leftDeck },
-		{ "hand", leftHand },
-	};
-	result["right"] = {
-		{ "used", cache.rightUsed },
-		{ "deck", rightDeck },
-		{ "hand", rightHand },
-	};
-	return result.dump(-1, ' ', true);
+	(checkSnapshot(cache) ? stateHits : stateMisses).add();
+	if (snapshot.compressed.empty()) {
+		Trace::Scope scope{"gzip state", "json"};
+
+		gzipMisses.add();
+		compressGzip(snapshot.json, snapshot.compressed);
+	} else
+		gzipHits.add();
+	out.assign(snapshot.compressed);
 }
 
-std::string generateRightCardsJson(CachedMatchData cache)
+std::string getStateJson(const CachedMatchData &cache)
 {
-	nlohmann::json result;
-	std::vector<unsigned short> rightDeck;
-	std::vector<unsigned short> rightHand;
+	std::string result;
 
-	if (cache.weather == SokuLib::WEATHER_MOUNTAIN_VAPOR)
-		rightDeck.resize(cache.rightCards.size() + cache.rightHand.size(), 21);
-	else {
-		rightDeck = cache.rightCards;
-		rightHand = cache.rightHand;
-	}
+	copyStateJson(cache, result);
+	return result;
+}
 
-	result = {
-		{ "used", cache.rightUsed },
-		{ "deck", rightDeck },
-		{ "hand", rightHand },
-	};
-	return result.dump(-1, ' ', true);
+std::string getCompressedStateJson(const CachedMatchData &cache)
+{
+	std::string result;
+
+	copyCompressedStateJson(cache, result);
+	return result;
 }
 
-std::string generateLeftCardsJson(CachedMatchData cache)
+void getStateJson(const CachedMatchData &cache, Socket::String &out)
 {
-	nlohmann::json result;
-	std::vector<unsigned short> leftDeck;
-	std::vector<unsigned short> leftHand;
+	copyStateJson(cache, out);
+}
 
-	if (cache.weather == SokuLib::WEATHER_MOUNTAIN_VAPOR)
-		leftDeck.resize(cache.leftCards.size() + cache.leftHand.size(), 21);
-	else {
-		leftDeck = cache.leftCards;
-		leftHand = cache.leftHand;
-	}
+void getCompressedStateJson(const CachedMatchData &cache, Socket::String &out)
+{
+	copyCompressedStateJson(cache, out);
+}
+
+std::string generateCardsJson(const CachedMatchData &cache)
+{
+	auto &writer = getWriter();
+
+	writer.beginObject();
+	writer.key("left");
+	writeCards(writer, cache, true);
+	writer.key("right");
+	writeCards(writer, cache, false);
+	writer.endObject();
+	return std::string(writer.str());
+}
+
+std::string generateStatsJson(const Stats &stats)
+{
+	auto &writer = getWriter();
+
+	writeStats(writer, stats);
+	return std::string(writer.str());
+}
+
+std::string generateRightCardsJson(const CachedMatchData &cache)
+{
+	auto &writer = getWriter();
+
+	writeCards(writer, cache, false);
+	return std::string(writer.str());
+}
+
+std::string generateLeftCardsJson(const CachedMatchData &cache)
+{
+	auto &writer = getWriter();
+
+	writeCards(writer, cache, true);
+	return std::string(writer.str());
+}
 
-	result = {
-		{ "used", cache.leftUsed },
-		{ "deck", leftDeck },
-		{ "hand", leftHand },
+static void generateSideDelta(JsonWriter &writer, const CachedMatchData &cache, bool left)
+{
+	bool hidden = cache.cardsHidden;
+	unsigned dirty = left ? cache.leftDirty : cache.rightDirty;
+	auto &cards = left ? cache.leftCards : cache.rightCards;
+	auto &hand = left ? cache.leftHand : cache.rightHand;
+	auto &used = left ? cache.leftUsed : cache.rightUsed;
+	auto &stats = left ? cache.leftStats : cache.rightStats;
+	auto replace = [&writer, left](const char *field) -> JsonWriter & {
+		char path[32];
+
+		snprintf(path, sizeof(path), "/%s/%s", left ? "left" : "right", field);
+		writer.beginObject();
+		writer.key("op").value("replace");
+		writer.key("path").value(path);
+		return writer.key("value");
 	};
-	return result.dump(-1, ' ', true);
+
+	if (dirty & DIRTY_DECK || (hidden && dirty & DIRTY_HAND)) {
+		writeDeck(replace("deck"), cards, hand, hidden);
+		writer.endObject();
+	}
+	if (dirty & DIRTY_HAND) {
+		writeHand(replace("hand"), hand, hidden);
+		writer.endObject();
+	}
+	if (dirty & DIRTY_USED)
+		replace("used").array(used.data(), used.size()).endObject();
+	if (dirty & DIRTY_ROD)
+		replace("stats/rod").value(static_cast<double>(stats.rod)).endObject();
+	if (dirty & DIRTY_DOLL)
+		replace("stats/doll").value(static_cast<double>(stats.doll)).endObject();
+	if (dirty & DIRTY_GRIMOIRE)
+		replace("stats/grimoire").value(static_cast<unsigned>(stats.grimoire)).endObject();
+	if (dirty & DIRTY_FAN)
+		replace("stats/fan").value(static_cast<unsigned>(stats.fan)).endObject();
+	if (dirty & DIRTY_DROPS)
+		replace("stats/drops").value(static_cast<unsigned>(stats.drops)).endObject();
+	if (dirty & DIRTY_SPECIAL)
+		replace("stats/special").value(stats.specialValue).endObject();
+	if (dirty & DIRTY_SKILLS) {
+		writeSkills(replace("stats/skills"), stats);
+		writer.endObject();
+	}
+}
+
+std::string generateDeltaJson(const CachedMatchData &cache)
+{
+	Trace::Scope scope{"delta json", "json"};
+	auto &writer = getWriter();
+
+	writer.beginArray();
+	generateSideDelta(writer, cache, true);
+	generateSideDelta(writer, cache, false);
+	writer.endArray();
+	return std::string(writer.str());
 }
 
 void onRoundStart()
 {
+	CacheWriteLock lock;
+
 	isPlaying = true;
 	_cache.oldLeftScore = 0;
 	_cache.oldRightScore = 0;
+	// The first round of a match is recorded with the match itself, once the worker started it.
+	if (timeline && !needRefresh)
+		queueTimelineEvent(TimelineEvent::ROUND_START);
 }
 
 void onKO()
 {
-	auto &battleMgr = SokuLib::getBattleMgr();
+	unsigned leftRounds;
+	unsigned rightRounds;
 
-	isPlaying = false;
+	battleSource->getRounds(leftRounds, rightRounds);
 
-	if (
-		_cache.oldLeftScore != battleMgr.leftCharacterManager.score ||
-		_cache.oldRightScore != battleMgr.rightCharacterManager.score
-	) {
-		if (battleMgr.leftCharacterManager.score == 2) {
-			_cache.leftScore++;
-			broadcastOpcode(L_SCORE_UPDATE, std::to_string(_cache.leftScore));
-		} else if (battleMgr.rightCharacterManager.score == 2) {
-			_cache.rightScore++;
-			broadcastOpcode(R_SCORE_UPDATE, std::to_string(_cache.rightScore));
+	Opcodes op;
+	std::string score;
+
+	{
+		CacheWriteLock lock;
+
+		isPlaying = false;
+
+		if (
+			_cache.oldLeftScore != leftRounds ||
+			_cache.oldRightScore != rightRounds
+		) {
+			if (leftRounds == 2) {
+				_cache.leftScore++;
+				_cache.version++;
+				op = L_SCORE_UPDATE;
+				score = std::to_string(_cache.leftScore);
+			} else if (rightRounds == 2) {
+				_cache.rightScore++;
+				_cache.version++;
+				op = R_SCORE_UPDATE;
+				score = std::to_string(_cache.rightScore);
+			}
+			_cache.oldLeftScore = leftRounds;
+			_cache.oldRightScore = rightRounds;
 		}
-		_cache.oldLeftScore = battleMgr.leftCharacterManager.score;
-		_cache.oldRightScore = battleMgr.rightCharacterManager.score;
+		if (timeline)
+			queueTimelineEvent(TimelineEvent::KO, leftRounds, rightRounds);
 	}
+	// Not under the lock, the fan-out can take a while
+	if (!score.empty())
+		broadcastOpcode(op, score);
 }
@@ -6,23 +6,33 @@
 #define SWRSTOYS_STATE_HPP
 
 
-#include <SokuLib.hpp>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include "Network/WebServer.hpp"
+#include "Utils/FixedString.hpp"
+#include "Utils/FixedVector.hpp"
 
-#include "Network/WebServer.hpp"
-#include <SokuLib.hpp>
-
-enum Keys {
-	KEY_DECREASE_L_SCORE,
-	KEY_DECREASE_R_SCORE,
-	KEY_INCREASE_L_SCORE,
-	KEY_INCREASE_R_SCORE,
-	KEY_CHANGE_L_NAME,
-	KEY_CHANGE_R_NAME,
-	KEY_RESET_SCORES,
-	KEY_RESET_STATE,
-	KEY_CHANGE_ROUND,
-	TOTAL_NB_OF_KEYS
+//! Fields of one side of CachedMatchData that changed since the last broadcast.
+enum DirtyFields : unsigned {
+	DIRTY_DECK     = 1U << 0U,
+	DIRTY_HAND     = 1U << 1U,
+	DIRTY_USED     = 1U << 2U,
+	DIRTY_ROD      = 1U << 3U,
+	DIRTY_DOLL     = 1U << 4U,
+	DIRTY_GRIMOIRE = 1U << 5U,
+	DIRTY_FAN      = 1U << 6U,
+	DIRTY_DROPS    = 1U << 7U,
+	DIRTY_SPECIAL  = 1U << 8U,
+	DIRTY_SKILLS   = 1U << 9U,
+	DIRTY_CARDS    = DIRTY_DECK | DIRTY_HAND | DIRTY_USED,
+	DIRTY_STATS    = DIRTY_ROD | DIRTY_DOLL | DIRTY_GRIMOIRE | DIRTY_FAN | DIRTY_DROPS | DIRTY_SPECIAL | DIRTY_SKILLS,
+};
+
+//! Same fields as SokuLib::Skill, so the state doesn't depend on the game.
+struct Skill {
+	unsigned char level;
+	bool notUsed;
 };
 
 struct Stats {
@@ -31,54 +41,128 @@ struct Stats {
 	unsigned short grimoire;
 	unsigned short fan;
 	unsigned short drops;
-	SokuLib::Skill skillMap[16];
+	Skill skillMap[16];
 	unsigned int specialValue;
 };
 
+//! Decks hold 20 cards, so no list of cards can be bigger.
+typedef FixedVector<unsigned short, 20> CardList;
+//! Names are in Shift-JIS, like the game gives them.
+typedef FixedString<64> NameString;
+//! UTF-8 form of a NameString, each Shift-JIS byte takes up to 3 bytes.
+typedef FixedString<3 * NameString::capacity() + 1> Utf8NameString;
+typedef FixedString<128> RoundString;
+
+//! Raw copy of one side of the battle, taken by the game thread each frame.
+struct SideSample {
+	CardList deck;
+	CardList deckCopy;
+	//! Cards in hand, starting from the selected one.
+	CardList hand;
+	Stats stats;
+};
+
+//! Raw copy of everything the cache is computed from.
+struct BattleSample {
+	//! Number of battle frames processed when the sample was taken.
+	unsigned frame;
+	//! Metrics::now() when the sample was taken.
+	long long sampledAt;
+	bool isMultiplayer;
+	bool isReplay;
+	unsigned weather;
+	//! Whether the weather hides the cards (mountain vapor).
+	bool cardsHidden;
+	unsigned left;
+	unsigned right;
+	NameString leftProfile;
+	NameString rightProfile;
+	SideSample leftSide;
+	SideSample rightSide;
+};
+
 extern unsigned short port;
-extern std::vector<unsigned> keys;
 extern std::unique_ptr<WebServer> webServer;
 extern struct CachedMatchData {
-	bool recvScores;
-	SokuLib::Weather weather;
-	SokuLib::Character left;
-	SokuLib::Character right;
-	std::vector<unsigned short> leftCards;
-	std::vector<unsigned short> rightCards;
-	std::vector<unsigned short> leftHand;
-	std::vector<unsigned short> rightHand;
-	std::vector<unsigned short> leftUsed;
-	std::vector<unsigned short> rightUsed;
-	std::string leftName;
-	std::string rightName;
-	std::string realLeftName;
-	std::string realRightName;
-	std::string round;
+	unsigned weather;
+	bool cardsHidden;
+	unsigned left;
+	unsigned right;
+	CardList leftCards;
+	CardList rightCards;
+	CardList leftHand;
+	CardList rightHand;
+	CardList leftUsed;
+	CardList rightUsed;
+	NameString leftName;
+	NameString rightName;
+	//! Converted once by setName, not on each serialization.
+	Utf8NameString leftUtf8Name;
+	Utf8NameString rightUtf8Name;
+	NameString realLeftName;
+	NameString realRightName;
+	RoundString round;
 	unsigned int oldLeftScore;
 	unsigned int oldRightScore;
 	unsigned int leftScore;
 	unsigned int rightScore;
 	Stats leftStats;
 	Stats rightStats;
+	unsigned leftDirty;
+	unsigned rightDirty;
+	//! Fingerprints of the game's deck and hand when the card lists were last computed.
+	uint64_t leftCardsHash;
+	uint64_t rightCardsHash;
+	//! Incremented each time something in the cache changes.
+	unsigned version;
 	bool noReset;
 } _cache;
-extern bool needReset;
-extern bool needRefresh;
-extern int (SokuLib::BattleManager::*s_origCBattleManager_Render)();
-extern int (SokuLib::BattleManager::*s_origCBattleManager_Start)();
-extern int (SokuLib::BattleManager::*s_origCBattleManager_KO)();
-extern int (SokuLib::LoadingWatch::*s_origCLoadingWatch_Process)();
-extern int (SokuLib::BattleWatch::*s_origCBattleWatch_Process)();
-extern int (SokuLib::Loading::*s_origCLoading_Process)();
-extern int (SokuLib::Battle::*s_origCBattle_Process)();
-extern int (SokuLib::Title::*s_origCTitle_Process)();
+//! Serializes everything that modifies _cache.
+extern std::mutex cacheMutex;
+
+//! @brief Locks cacheMutex, and makes _cache visible to readCache once released.
+//! Must be held while modifying _cache.
+class CacheWriteLock {
+private:
+	std::lock_guard<std::mutex> _lock{cacheMutex};
+
+public:
+	~CacheWriteLock();
+};
+
+//! @brief Get a coherent copy of the cache, as of the last CacheWriteLock released.
+//! Never blocks the writers, so it can be called from any thread.
+CachedMatchData readCache();
+extern std::atomic<bool> needReset;
+extern std::atomic<bool> needRefresh;
+//! Set when the scores came from the host of the netplay game, so they aren't reset with the names.
+//! Outside of _cache so the title screen can clear it each frame without taking the lock.
+extern std::atomic<bool> recvScores;
 
+//! @brief Start the thread turning the samples taken by updateCache into state updates.
+void startStateWorker();
+void stopStateWorker();
+//! @brief Wait until the worker applied every sample taken so far.
+//! The game never waits, this is for the replays to apply every single frame.
+void waitStateWorker();
+//! @brief Sample the battle from battleSource. Only meant to be called from the thread driving the battle.
 void updateCache(bool isMultiplayer);
-std::string generateLeftCardsJson(CachedMatchData cache);
-std::string generateRightCardsJson(CachedMatchData cache);
-std::string generateCardsJson(CachedMatchData cache);
-std::string cacheToJson(CachedMatchData cache);
-void checkKeyInputs();
+//! @brief Set the name of a side, and its UTF-8 form.
+void setName(CachedMatchData &cache, bool left, const char *shiftJis);
+std::string generateLeftCardsJson(const CachedMatchData &cache);
+std::string generateRightCardsJson(const CachedMatchData &cache);
+std::string generateCardsJson(const CachedMatchData &cache);
+std::string generateStatsJson(const Stats &stats);
+std::string cacheToJson(const CachedMatchData &cache);
+std::string generateDeltaJson(const CachedMatchData &cache);
+//! @brief Same as cacheToJson but only serializes again when the state changed.
+std::string getStateJson(const CachedMatchData &cache);
+//! @brief Same as getStateJson but gzip compressed. Empty if the compression failed.
+std::string getCompressedStateJson(const CachedMatchData &cache);
+//! @brief Same as getStateJson, written in a response body instead of a new string.
+void getStateJson(const CachedMatchData &cache, Socket::String &out);
+//! @brief Same as getCompressedStateJson, written in a response body instead of a new string.
+void getCompressedStateJson(const CachedMatchData &cache, Socket::String &out);
 void onRoundStart();
 void onKO();
 
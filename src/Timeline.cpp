@@ -0,0 +1,444 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include "Timeline.hpp"
+#include "Exceptions.hpp"
+
+#define CHECKPOINT_INTERVAL 64
+
+std::unique_ptr<Timeline> timeline;
+
+static const unsigned char header[8] = {'S', 'K', 'T', 'L', 1, 0, 0, 0};
+static const char *sideNames[] = {"left", "right"};
+static const char *listNames[] = {"deck", "hand", "used"};
+static const char *statNames[] = {"doll", "rod", "grimoire", "fan", "drops", "special"};
+
+static bool readVarint(const unsigned char *&ptr, const unsigned char *end, uint64_t &value)
+{
+	value = 0;
+	for (unsigned shift = 0; shift < 64; shift += 7) {
+		if (ptr == end)
+			return false;
+
+		unsigned char byte = *ptr++;
+
+		value |= static_cast<uint64_t>(byte & 0x7FU) << shift;
+		if (!(byte & 0x80U))
+			return true;
+	}
+	return false;
+}
+
+Timeline::Timeline(const std::string &path, size_t windowSize) :
+	_path(path),
+	_file(windowSize)
+{
+	this->_record.reserve(256);
+	this->_recover();
+}
+
+std::unique_ptr<Timeline> Timeline::load(const std::string &path)
+{
+	std::unique_ptr<Timeline> result{new Timeline()};
+	std::vector<unsigned char> data = _readFile(path);
+
+	result->_path = path;
+	if (data.empty())
+		throw FileMappingException(path + " doesn't exist or is empty");
+	result->_scan(data);
+	return result;
+}
+
+std::vector<unsigned char> Timeline::_readFile(const std::string &path)
+{
+	std::ifstream stream{path, std::ifstream::binary};
+	std::vector<unsigned char> data;
+
+	if (stream)
+		data.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+	return data;
+}
+
+void Timeline::_recover()
+{
+	std::vector<unsigned char> data = _readFile(this->_path);
+
+	if (data.empty()) {
+		this->_file.open(this->_path, 0);
+		this->_file.append(header, sizeof(header));
+		return;
+	}
+	this->_file.open(this->_path, this->_scan(data));
+}
+
+uint64_t Timeline::_scan(const std::vector<unsigned char> &data)
+{
+	if (data.size() < sizeof(header) || memcmp(data.data(), header, sizeof(header)) != 0)
+		throw FileMappingException(this->_path + " is not a timeline file");
+
+	const unsigned char *ptr = data.data() + sizeof(header);
+	const unsigned char *end = data.data() + data.size();
+	const unsigned char *valid = ptr;
+	Record record;
+
+	// Everything after the first record we can't read is what was left when the game closed without closing the file.
+	while (valid != end && *valid && _readRecord(ptr, end, record)) {
+		uint64_t offset = valid - data.data();
+
+		valid = ptr;
+		if (record.type == RECORD_MATCH_START) {
+			this->_matches.push_back({
+				static_cast<unsigned>(record.values[0]),
+				record.values[1],
+				static_cast<unsigned>(record.values[2]),
+				static_cast<unsigned>(record.values[3]),
+				0, 0, {{0, offset}}
+			});
+		} else if (this->_matches.empty())
+			continue;
+		else if (record.type == RECORD_CHECKPOINT) {
+			this->_matches.back().lastFrame = record.values[1];
+			this->_matches.back().checkpoints.push_back({this->_matches.back().lastFrame, offset});
+		} else
+			this->_matches.back().lastFrame += record.frameDelta;
+		this->_matches.back().end = valid - data.data();
+	}
+	return valid - data.data();
+}
+
+bool Timeline::_readRecord(const unsigned char *&ptr, const unsigned char *end, Record &record)
+{
+	uint64_t delta;
+	uint64_t mask;
+	unsigned count = 0;
+
+	if (ptr == end || !*ptr || *ptr > RECORD_WEATHER)
+		return false;
+	record.type = static_cast<RecordType>(*ptr++);
+	if (!readVarint(ptr, end, delta))
+		return false;
+	record.frameDelta = delta;
+	switch (record.type) {
+	case RECORD_MATCH_START:
+		count = 4;
+		break;
+	case RECORD_CARDS:
+	case RECORD_STAT:
+		count = 3;
+		break;
+	case RECORD_CHECKPOINT:
+	case RECORD_KO:
+	case RECORD_SCORE:
+	case RECORD_SKILLS:
+	case RECORD_WEATHER:
+		count = 2;
+		break;
+	default:
+		break;
+	}
+	for (unsigned i = 0; i < count; i++)
+		if (!readVarint(ptr, end, record.values[i]))
+			return false;
+	if (record.type == RECORD_CARDS) {
+		unsigned short card = 0;
+
+		if (record.values[2] > 1024)
+			return false;
+		record.cards.clear();
+		for (unsigned i = 0; i < record.values[2]; i++) {
+			if (!readVarint(ptr, end, delta))
+				return false;
+			card += delta;
+			record.cards.push_back(card);
+		}
+	} else if (record.type == RECORD_SKILLS) {
+		mask = record.values[1];
+		for (unsigned i = 0; i < 16; i++) {
+			record.levels[i] = 0;
+			if (!(mask & (1U << i)))
+				continue;
+			if (!readVarint(ptr, end, delta))
+				return false;
+			record.levels[i] = delta;
+		}
+	}
+	return true;
+}
+
+nlohmann::json Timeline::_recordToJson(const Record &record, unsigned frame)
+{
+	nlohmann::json result = {{"frame", frame}};
+
+	switch (record.type) {
+	case RECORD_ROUND_START:
+		result["type"] = "roundStart";
+		break;
+	case RECORD_KO:
+		result["type"] = "ko";
+		result["leftRounds"] = record.values[0];
+		result["rightRounds"] = record.values[1];
+		break;
+	case RECORD_SCORE:
+		result["type"] = "score";
+		result["side"] = sideNames[record.values[0] & 1U];
+		result["score"] = record.values[1];
+		break;
+	case RECORD_CARDS:
+		result["type"] = "cards";
+		result["side"] = sideNames[record.values[0] & 1U];
+		result["list"] = listNames[(std::min)(record.values[1], static_cast<uint64_t>(LIST_USED))];
+		result["cards"] = record.cards;
+		break;
+	case RECORD_STAT:
+		result["type"] = "stat";
+		result["side"] = sideNames[record.values[0] & 1U];
+		result["stat"] = statNames[(std::min)(record.values[1], static_cast<uint64_t>(STAT_SPECIAL))];
+		if (record.values[2] % 100)
+			result["value"] = record.values[2] / 100.;
+		else
+			result["value"] = record.values[2] / 100;
+		break;
+	case RECORD_SKILLS:
+		result["type"] = "skills";
+		result["side"] = sideNames[record.values[0] & 1U];
+		result["skills"] = nlohmann::json::object();
+		for (unsigned i = 0; i < 16; i++)
+			if (record.values[1] & (1U << i))
+				result["skills"][std::to_string(i)] = record.levels[i];
+		break;
+	case RECORD_WEATHER:
+		result["type"] = "weather";
+		result["weather"] = record.values[0];
+		result["cardsHidden"] = record.values[1] != 0;
+		break;
+	default:
+		break;
+	}
+	return result;
+}
+
+void Timeline::_write(uint64_t value)
+{
+	while (value >= 0x80) {
+		this->_record.push_back(0x80U | (value & 0x7FU));
+		value >>= 7;
+	}
+	this->_record.push_back(value);
+}
+
+bool Timeline::_beginRecord(RecordType type, unsigned frame)
+{
+	if (!this->_recording)
+		return false;
+
+	auto &match = this->_matches.back();
+	// The frame counter may have been reset, never go back in time.
+	unsigned relative = frame >= this->_matchStart ? frame - this->_matchStart : 0;
+
+	relative = (std::max)(relative, match.lastFrame);
+	if (this->_recordsSinceCheckpoint >= CHECKPOINT_INTERVAL) {
+		match.checkpoints.push_back({match.lastFrame, this->_file.size()});
+		this->_record.clear();
+		this->_record.push_back(RECORD_CHECKPOINT);
+		this->_write(0);
+		this->_write(match.id);
+		this->_write(match.lastFrame);
+		this->_file.append(this->_record.data(), this->_record.size());
+		this->_recordsSinceCheckpoint = 0;
+	}
+	this->_record.clear();
+	this->_record.push_back(type);
+	this->_write(relative - match.lastFrame);
+	match.lastFrame = relative;
+	return true;
+}
+
+void Timeline::_endRecord()
+{
+	this->_file.append(this->_record.data(), this->_record.size());
+	this->_matches.back().end = this->_file.size();
+	this->_recordsSinceCheckpoint++;
+}
+
+void Timeline::startMatch(unsigned frame, unsigned left, unsigned right)
+{
+	std::lock_guard<std::mutex> lock(this->_mutex);
+
+	if (!this->_file.isOpen())
+		return;
+
+	unsigned id = this->_matches.empty() ? 0 : this->_matches.back().id + 1;
+	uint64_t time = std::time(nullptr);
+	uint64_t offset = this->_file.size();
+
+	this->_matches.push_back({id, time, left, right, 0, offset, {{0, offset}}});
+	this->_matchStart = frame;
+	this->_recordsSinceCheckpoint = 0;
+	this->_recording = true;
+	this->_beginRecord(RECORD_MATCH_START, frame);
+	this->_write(id);
+	this->_write(time);
+	this->_write(left);
+	this->_write(right);
+	this->_endRecord();
+}
+
+void Timeline::roundStart(unsigned frame)
+{
+	std::lock_guard<std::mutex> lock(this->_mutex);
+
+	if (!this->_beginRecord(RECORD_ROUND_START, frame))
+		return;
+	this->_endRecord();
+}
+
+void Timeline::ko(unsigned frame, unsigned leftRounds, unsigned rightRounds)
+{
+	std::lock_guard<std::mutex> lock(this->_mutex);
+
+	if (!this->_beginRecord(RECORD_KO, frame))
+		return;
+	this->_write(leftRounds);
+	this->_write(rightRounds);
+	this->_endRecord();
+}
+
+void Timeline::score(unsigned frame, Side side, unsigned score)
+{
+	std::lock_guard<std::mutex> lock(this->_mutex);
+
+	if (!this->_beginRecord(RECORD_SCORE, frame))
+		return;
+	this->_write(side);
+	this->_write(score);
+	this->_endRecord();
+}
+
+void Timeline::cards(unsigned frame, Side side, CardListType list, const unsigned short *cards, size_t size)
+{
+	std::lock_guard<std::mutex> lock(this->_mutex);
+	unsigned short last = 0;
+
+	if (!this->_beginRecord(RECORD_CARDS, frame))
+		return;
+	size = (std::min)(size, static_cast<size_t>(1024));
+	this->_write(side);
+	this->_write(list);
+	this->_write(size);
+	// Wraps around for unsorted lists, the reader wraps the same way.
+	for (size_t i = 0; i < size; i++) {
+		this->_write(static_cast<unsigned short>(cards[i] - last));
+		last = cards[i];
+	}
+	this->_endRecord();
+}
+
+void Timeline::stat(unsigned frame, Side side, Stat stat, double value)
+{
+	std::lock_guard<std::mutex> lock(this->_mutex);
+
+	if (!this->_beginRecord(RECORD_STAT, frame))
+		return;
+	this->_write(side);
+	this->_write(stat);
+	this->_write(std::llround((std::max)(value, 0.) * 100));
+	this->_endRecord();
+}
+
+void Timeline::skills(unsigned frame, Side side, const unsigned char (&levels)[16], unsigned used)
+{
+	std::lock_guard<std::mutex> lock(this->_mutex);
+
+	if (!this->_beginRecord(RECORD_SKILLS, frame))
+		return;
+	used &= 0xFFFFU;
+	this->_write(side);
+	this->_write(used);
+	for (unsigned i = 0; i < 16; i++)
+		if (used & (1U << i))
+			this->_write(levels[i]);
+	this->_endRecord();
+}
+
+void Timeline::weather(unsigned frame, unsigned weather, bool cardsHidden)
+{
+	std::lock_guard<std::mutex> lock(this->_mutex);
+
+	if (!this->_beginRecord(RECORD_WEATHER, frame))
+		return;
+	this->_write(weather);
+	this->_write(cardsHidden);
+	this->_endRecord();
+}
+
+nlohmann::json Timeline::getMatches()
+{
+	std::lock_guard<std::mutex> lock(this->_mutex);
+	nlohmann::json result = nlohmann::json::array();
+
+	for (auto &match : this->_matches)
+		result.push_back({
+			{"id", match.id},
+			{"time", match.time},
+			{"left", match.left},
+			{"right", match.right},
+			{"frames", match.lastFrame}
+		});
+	return result;
+}
+
+nlohmann::json Timeline::getEvents(unsigned match, unsigned from, unsigned to)
+{
+	Checkpoint start;
+	uint64_t end;
+
+	{
+		std::lock_guard<std::mutex> lock(this->_mutex);
+		auto it = std::find_if(this->_matches.begin(), this->_matches.end(), [match](const MatchInfo &info){
+			return info.id == match;
+		});
+
+		if (it == this->_matches.end())
+			throw std::out_of_range("No match with id " + std::to_string(match));
+
+		// The first checkpoint is at frame 0, so there is always one.
+		auto checkpoint = std::upper_bound(it->checkpoints.begin(), it->checkpoints.end(), from, [](unsigned frame, const Checkpoint &c){
+			return frame < c.frame;
+		});
+
+		start = *std::prev(checkpoint);
+		end = it->end;
+	}
+
+	// What has been written is never modified again so we don't need to hold the lock while reading it.
+	std::ifstream stream{this->_path, std::ifstream::binary};
+	std::vector<unsigned char> data(end - start.offset);
+	nlohmann::json result = nlohmann::json::array();
+	unsigned frame = start.frame;
+	Record record;
+
+	stream.seekg(start.offset);
+	stream.read(reinterpret_cast<char *>(data.data()), data.size());
+	data.resize(stream.gcount());
+
+	const unsigned char *ptr = data.data();
+
+	while (_readRecord(ptr, data.data() + data.size(), record)) {
+		if (record.type == RECORD_CHECKPOINT) {
+			frame = record.values[1];
+			continue;
+		}
+		frame += record.frameDelta;
+		if (frame > to)
+			break;
+		if (frame >= from && record.type != RECORD_MATCH_START)
+			result.push_back(_recordToJson(record, frame));
+	}
+	return result;
+}
@@ -0,0 +1,143 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_TIMELINE_HPP
+#define SWRSTOYS_TIMELINE_HPP
+
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Utils/MappedFile.hpp"
+#include "nlohmann/json.hpp"
+
+//! @brief Records every change of the match state in a compact binary log, and answers range queries on it.
+//! Frames are counted from the start of each match.
+//!
+//! The file starts with an 8 bytes header and then holds records made of
+//! a type byte, the number of frames since the previous record as a varint, and the payload.
+//! All numbers are LEB128 varints. A checkpoint with the absolute frame is written
+//! every few records, so a range query only has to decode from the closest one.
+class Timeline {
+public:
+	enum Side : unsigned char {
+		SIDE_LEFT,
+		SIDE_RIGHT
+	};
+
+	enum CardListType : unsigned char {
+		LIST_DECK,
+		LIST_HAND,
+		LIST_USED
+	};
+
+	enum Stat : unsigned char {
+		STAT_DOLL,
+		STAT_ROD,
+		STAT_GRIMOIRE,
+		STAT_FAN,
+		STAT_DROPS,
+		STAT_SPECIAL
+	};
+
+	//! 0 is never a valid type so the zeroes at the end of the mapped file mark the end of the data.
+	enum RecordType : unsigned char {
+		RECORD_MATCH_START = 1, // id, unix time, left character, right character
+		RECORD_CHECKPOINT,      // match id, frame
+		RECORD_ROUND_START,
+		RECORD_KO,              // left rounds won, right rounds won
+		RECORD_SCORE,           // side, score
+		RECORD_CARDS,           // side, list type, count, card ids as differences from the previous one
+		RECORD_STAT,            // side, stat, value in hundredths
+		RECORD_SKILLS,          // side, bit mask of the skills present, their levels
+		RECORD_WEATHER,         // weather id, whether it hides the cards
+	};
+
+private:
+	struct Checkpoint {
+		unsigned frame;
+		uint64_t offset;
+	};
+
+	struct MatchInfo {
+		unsigned id;
+		uint64_t time;
+		unsigned left;
+		unsigned right;
+		unsigned lastFrame;
+		//! Offset right after the last record of the match.
+		uint64_t end;
+		//! Where to start decoding, the first one is the match start.
+		std::vector<Checkpoint> checkpoints;
+	};
+
+	struct Record {
+		RecordType type;
+		unsigned frameDelta;
+		uint64_t values[4];
+		std::vector<unsigned short> cards;
+		unsigned char levels[16];
+	};
+
+	std::mutex _mutex;
+	std::string _path;
+	MappedFile _file;
+	std::vector<MatchInfo> _matches;
+	//! Whether the last match is the one being played. Matches recovered from the file are never appended to.
+	bool _recording = false;
+	//! Frame counter of the game when the current match started.
+	unsigned _matchStart = 0;
+	unsigned _recordsSinceCheckpoint = 0;
+	std::vector<unsigned char> _record;
+
+	Timeline() = default;
+	static std::vector<unsigned char> _readFile(const std::string &path);
+	void _recover();
+	//! @brief Rebuild the list of matches from the content of the file.
+	//! @return Size of the part of the file that holds complete records.
+	//! @throw FileMappingException The data is not a timeline.
+	uint64_t _scan(const std::vector<unsigned char> &data);
+	static bool _readRecord(const unsigned char *&ptr, const unsigned char *end, Record &record);
+	static nlohmann::json _recordToJson(const Record &record, unsigned frame);
+	void _write(uint64_t value);
+	//! @return Whether a match is being recorded.
+	bool _beginRecord(RecordType type, unsigned frame);
+	void _endRecord();
+
+public:
+	//! @param path File to append the records to. Existing records are kept.
+	//! @param windowSize Size of the mapped part of the file.
+	//! @throw FileMappingException The file couldn't be opened.
+	explicit Timeline(const std::string &path, size_t windowSize = 1024 * 1024);
+
+	//! @brief Open an existing timeline only to query it. The file is never created nor modified.
+	//! @throw FileMappingException The file doesn't exist or is not a timeline.
+	static std::unique_ptr<Timeline> load(const std::string &path);
+
+	//! @param frame Frame counter of the game, the events' frames are relative to it.
+	//! Does nothing on a timeline opened with load().
+	void startMatch(unsigned frame, unsigned left, unsigned right);
+	void roundStart(unsigned frame);
+	void ko(unsigned frame, unsigned leftRounds, unsigned rightRounds);
+	void score(unsigned frame, Side side, unsigned score);
+	//! @param cards Card ids, in any order. Sorted lists take less space.
+	void cards(unsigned frame, Side side, CardListType list, const unsigned short *cards, size_t size);
+	//! @param value Stored with a precision of 1/100.
+	void stat(unsigned frame, Side side, Stat stat, double value);
+	//! @param used Bit mask of the skills in levels that are present.
+	void skills(unsigned frame, Side side, const unsigned char (&levels)[16], unsigned used);
+	void weather(unsigned frame, unsigned weather, bool cardsHidden);
+
+	nlohmann::json getMatches();
+	//! @brief Get the events of a match between two frames, included.
+	//! @throw std::out_of_range The match doesn't exist.
+	nlohmann::json getEvents(unsigned match, unsigned from, unsigned to);
+};
+
+extern std::unique_ptr<Timeline> timeline;
+
+
+#endif //SWRSTOYS_TIMELINE_HPP
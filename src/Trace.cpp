@@ -0,0 +1,183 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "Trace.hpp"
+#include "nlohmann/json.hpp"
+
+namespace Trace
+{
+	std::atomic<bool> enabled{false};
+
+	struct Event {
+		const char *name;
+		const char *category;
+		long long start;
+		long long end;
+	};
+
+	constexpr size_t ringSize = 4096;
+
+	//! Only written by the thread owning it. When it is full the oldest events are overwritten.
+	struct Ring {
+		unsigned id;
+		std::string name;
+		//! Number of events ever written.
+		std::atomic<uint64_t> head{0};
+		//! Set when the thread ended during a capture, the ring is removed once the capture is done.
+		bool ended = false;
+		Event events[ringSize];
+	};
+
+	struct Registry {
+		std::mutex mutex;
+		std::vector<std::shared_ptr<Ring>> rings;
+		unsigned nextId = 1;
+		bool capturing = false;
+	};
+
+	// Never destroyed, the threads may still be recording while the statics are destroyed.
+	static Registry &registry()
+	{
+		static Registry *registry = new Registry();
+
+		return *registry;
+	}
+
+	static thread_local std::string threadName;
+	static std::mutex captureMutex;
+
+	struct RingHolder {
+		std::shared_ptr<Ring> ring = std::make_shared<Ring>();
+
+		RingHolder()
+		{
+			auto &reg = registry();
+			std::lock_guard<std::mutex> lock{reg.mutex};
+
+			this->ring->id = reg.nextId++;
+			this->ring->name = threadName.empty() ? "Thread " + std::to_string(this->ring->id) : threadName;
+			reg.rings.push_back(this->ring);
+		}
+
+		~RingHolder()
+		{
+			auto &reg = registry();
+			std::lock_guard<std::mutex> lock{reg.mutex};
+
+			if (reg.capturing)
+				this->ring->ended = true;
+			else
+				reg.rings.erase(std::find(reg.rings.begin(), reg.rings.end(), this->ring));
+		}
+	};
+
+	void record(const char *name, const char *category, long long start, long long end)
+	{
+		// Only created the first time the thread records something, so only the threads which are traced have a ring.
+		thread_local RingHolder holder;
+		auto &ring = *holder.ring;
+		auto head = ring.head.load(std::memory_order_relaxed);
+
+		ring.events[head % ringSize] = {name, category, start, end};
+		ring.head.store(head + 1, std::memory_order_release);
+	}
+
+	void nameThread(const std::string &name)
+	{
+		threadName = name;
+	}
+
+	//! @brief Copy the events of a ring written after the given index.
+	//! Those overwritten while copying are left out.
+	static void readRing(Ring &ring, uint64_t from, std::vector<Event> &events)
+	{
+		auto head = ring.head.load(std::memory_order_acquire);
+		auto first = (std::max<uint64_t>)(from, head > ringSize ? head - ringSize : 0);
+		std::vector<Event> copy;
+
+		for (auto i = first; i < head; i++)
+			copy.push_back(ring.events[i % ringSize]);
+
+		auto after = ring.head.load(std::memory_order_acquire);
+		auto valid = after > ringSize ? after - ringSize : 0;
+
+		for (auto i = first; i < head; i++)
+			if (i >= valid)
+				events.push_back(copy[i - first]);
+	}
+
+	std::string capture(unsigned milliseconds)
+	{
+		std::unique_lock<std::mutex> captureLock{captureMutex, std::try_to_lock};
+		auto &reg = registry();
+		std::map<Ring *, uint64_t> starts;
+		std::vector<std::shared_ptr<Ring>> rings;
+		nlohmann::json events = nlohmann::json::array();
+
+		if (!captureLock)
+			throw std::logic_error("A capture is already running");
+		reg.mutex.lock();
+		reg.capturing = true;
+		// Only keep what happens from now on
+		for (auto &ring : reg.rings)
+			starts[ring.get()] = ring->head.load(std::memory_order_acquire);
+		reg.mutex.unlock();
+
+		auto start = Metrics::now();
+
+		enabled = true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+		enabled = false;
+		// Give the scopes which started during the capture a chance to end
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+		reg.mutex.lock();
+		reg.capturing = false;
+		rings = reg.rings;
+		reg.rings.erase(std::remove_if(reg.rings.begin(), reg.rings.end(), [](std::shared_ptr<Ring> &ring){
+			return ring->ended;
+		}), reg.rings.end());
+		reg.mutex.unlock();
+
+		for (auto &ring : rings) {
+			std::vector<Event> ringEvents;
+			auto it = starts.find(ring.get());
+
+			readRing(*ring, it == starts.end() ? 0 : it->second, ringEvents);
+			if (ringEvents.empty())
+				continue;
+			events.push_back({
+				{"name", "thread_name"},
+				{"ph",   "M"},
+				{"pid",  1},
+				{"tid",  ring->id},
+				{"args", {{"name", ring->name}}}
+			});
+			for (auto &event : ringEvents)
+				events.push_back({
+					{"name", event.name},
+					{"cat",  event.category},
+					{"ph",   "X"},
+					{"pid",  1},
+					{"tid",  ring->id},
+					// In microseconds
+					{"ts",   (event.start - start) / 1000.},
+					{"dur",  (event.end - event.start) / 1000.}
+				});
+		}
+		return nlohmann::json{
+			{"traceEvents",     events},
+			{"displayTimeUnit", "ms"}
+		}.dump();
+	}
+}
@@ -0,0 +1,61 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_TRACE_HPP
+#define SWRSTOYS_TRACE_HPP
+
+
+#include <atomic>
+#include <string>
+#include "Metrics.hpp"
+
+//! @brief Records how long the probed parts of the code take, only while a capture is running.
+//! Each thread writes to its own ring buffer, without locking.
+//! The events are exported in the Chrome trace event format, to be opened in chrome://tracing or Perfetto.
+namespace Trace
+{
+	//! @brief Whether a capture is running.
+	extern std::atomic<bool> enabled;
+
+	//! @brief Add an event to the ring of the calling thread.
+	void record(const char *name, const char *category, long long start, long long end);
+
+	//! @brief Records its lifetime as an event. Costs a single branch when no capture is running.
+	//! @param name and category must outlive the capture, they are usually literals.
+	class Scope {
+	private:
+		const char *_name;
+		const char *_category;
+		long long _start;
+
+	public:
+		Scope(const char *name, const char *category) :
+			_name(name),
+			_category(category),
+			_start(enabled.load(std::memory_order_relaxed) ? Metrics::now() : 0)
+		{
+		}
+
+		~Scope()
+		{
+			if (this->_start)
+				record(this->_name, this->_category, this->_start, Metrics::now());
+		}
+
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+	};
+
+	//! @brief Name the calling thread in the captures.
+	void nameThread(const std::string &name);
+
+	//! @brief Record the events of all the threads for the given time.
+	//! Only one capture can run at a time.
+	//! @return The events, as a Chrome trace event json.
+	//! @throw std::logic_error Another capture is already running.
+	std::string capture(unsigned milliseconds);
+}
+
+
+#endif //SWRSTOYS_TRACE_HPP
@@ -0,0 +1,96 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <algorithm>
+#include <cstdint>
+#include "Arena.hpp"
+#include "../Memory.hpp"
+
+static thread_local std::pmr::memory_resource *currentArena = nullptr;
+
+// The blocks are counted with the network buffers
+static Memory::Allocator<char, Memory::TAG_NETWORK> blockAllocator;
+
+Arena::Scope::Scope(Arena &arena) :
+	_previous(currentArena)
+{
+	currentArena = &arena;
+}
+
+Arena::Scope::~Scope()
+{
+	currentArena = this->_previous;
+}
+
+Arena::Arena(size_t blockSize) :
+	_blockSize(blockSize)
+{
+}
+
+Arena::~Arena()
+{
+	for (auto &block : this->_blocks)
+		blockAllocator.deallocate(block.data, block.size);
+}
+
+void Arena::_addBlock(size_t size)
+{
+	this->_blocks.push_back({blockAllocator.allocate(size), size});
+}
+
+void *Arena::do_allocate(size_t bytes, size_t alignment)
+{
+	while (true) {
+		if (this->_current < this->_blocks.size()) {
+			auto &block = this->_blocks[this->_current];
+			auto address = reinterpret_cast<uintptr_t>(block.data) + this->_used;
+			size_t padding = (alignment - address % alignment) % alignment;
+
+			if (this->_used + padding + bytes <= block.size) {
+				this->_used += padding + bytes;
+				this->_total += padding + bytes;
+				return block.data + this->_used - bytes;
+			}
+			if (this->_current + 1 < this->_blocks.size()) {
+				this->_current++;
+				this->_used = 0;
+				continue;
+			}
+		}
+		this->_addBlock(std::max(this->_blockSize, bytes + alignment));
+		this->_current = this->_blocks.size() - 1;
+		this->_used = 0;
+	}
+}
+
+void Arena::do_deallocate(void *, size_t, size_t)
+{
+	// Everything is freed at once by reset
+}
+
+bool Arena::do_is_equal(const std::pmr::memory_resource &other) const noexcept
+{
+	return this == &other;
+}
+
+void Arena::reset()
+{
+	if (this->_current > 0) {
+		// Leave room for the alignment padding lost at the end of each block
+		size_t size = this->_total + this->_blocks.size() * alignof(std::max_align_t);
+
+		for (auto &block : this->_blocks)
+			blockAllocator.deallocate(block.data, block.size);
+		this->_blocks.clear();
+		this->_addBlock(std::max(this->_blockSize, size));
+	}
+	this->_current = 0;
+	this->_used = 0;
+	this->_total = 0;
+}
+
+std::pmr::memory_resource *Arena::current()
+{
+	return currentArena ? currentArena : std::pmr::new_delete_resource();
+}
@@ -0,0 +1,69 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_ARENA_HPP
+#define SWRSTOYS_ARENA_HPP
+
+
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+//! @brief Bump allocator for the data living as long as a request.
+//! Allocating only moves a pointer forward, nothing is freed until reset() is called.
+//! The memory is kept between resets, so once it grew big enough using it allocates nothing.
+//! Not thread safe.
+class Arena : public std::pmr::memory_resource {
+private:
+	struct Block {
+		char *data;
+		size_t size;
+	};
+
+	std::vector<Block> _blocks;
+	//! Block being allocated from.
+	size_t _current = 0;
+	//! Bytes used in the current block.
+	size_t _used = 0;
+	//! Bytes used since the last reset, in all the blocks.
+	size_t _total = 0;
+	size_t _blockSize;
+
+	void _addBlock(size_t size);
+
+protected:
+	void *do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+public:
+	//! @brief Makes the requests and responses constructed by the calling thread use an arena while it lives.
+	class Scope {
+	private:
+		std::pmr::memory_resource *_previous;
+
+	public:
+		explicit Scope(Arena &arena);
+		~Scope();
+
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+	};
+
+	explicit Arena(size_t blockSize = 16384);
+	~Arena() override;
+
+	Arena(const Arena &) = delete;
+	Arena &operator=(const Arena &) = delete;
+
+	//! @brief Free everything that was allocated.
+	//! If it didn't fit in one block, the blocks are replaced by a single one big enough for all of it.
+	void reset();
+
+	//! @brief The arena of the innermost Scope of the calling thread, or the heap outside of any.
+	static std::pmr::memory_resource *current();
+};
+
+
+#endif //SWRSTOYS_ARENA_HPP
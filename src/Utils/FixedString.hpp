@@ -0,0 +1,58 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_FIXEDSTRING_HPP
+#define SWRSTOYS_FIXEDSTRING_HPP
+
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+//! @brief Null terminated string stored inline, holding at most N - 1 characters.
+//! Longer strings are truncated, so the values coming from the clients are checked against capacity() first.
+template<size_t N>
+class FixedString {
+private:
+	char _data[N] = {};
+
+public:
+	static constexpr size_t capacity() { return N - 1; }
+
+	const char *c_str() const { return this->_data; }
+	size_t size() const { return strlen(this->_data); }
+	bool empty() const { return !*this->_data; }
+	std::string str() const { return this->_data; }
+
+	FixedString &assign(const char *str, size_t size)
+	{
+		size = std::min(size, N - 1);
+		memcpy(this->_data, str, size);
+		this->_data[size] = 0;
+		return *this;
+	}
+
+	FixedString &operator=(const char *str)
+	{
+		return this->assign(str, strlen(str));
+	}
+
+	FixedString &operator=(const std::string &str)
+	{
+		return this->assign(str.c_str(), strlen(str.c_str()));
+	}
+
+	bool operator==(const char *str) const
+	{
+		return strcmp(this->_data, str) == 0;
+	}
+
+	bool operator!=(const char *str) const
+	{
+		return !(*this == str);
+	}
+};
+
+
+#endif //SWRSTOYS_FIXEDSTRING_HPP
@@ -0,0 +1,67 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_FIXEDVECTOR_HPP
+#define SWRSTOYS_FIXEDVECTOR_HPP
+
+
+#include <algorithm>
+#include <cstddef>
+
+//! @brief Vector with a fixed capacity stored inline.
+//! It never allocates and is trivially copyable as long as T is.
+//! Elements pushed when it is full are dropped.
+template<typename T, size_t N>
+class FixedVector {
+private:
+	T _data[N];
+	size_t _size = 0;
+
+public:
+	static constexpr size_t capacity() { return N; }
+
+	size_t size() const { return this->_size; }
+	bool empty() const { return this->_size == 0; }
+	T *data() { return this->_data; }
+	const T *data() const { return this->_data; }
+	T *begin() { return this->_data; }
+	T *end() { return this->_data + this->_size; }
+	const T *begin() const { return this->_data; }
+	const T *end() const { return this->_data + this->_size; }
+	T &operator[](size_t index) { return this->_data[index]; }
+	const T &operator[](size_t index) const { return this->_data[index]; }
+
+	void clear()
+	{
+		this->_size = 0;
+	}
+
+	void push_back(const T &elem)
+	{
+		if (this->_size < N)
+			this->_data[this->_size++] = elem;
+	}
+
+	//! @brief Resize the vector. New elements are value initialized.
+	void resize(size_t size)
+	{
+		size = std::min(size, N);
+		for (size_t i = this->_size; i < size; i++)
+			this->_data[i] = T();
+		this->_size = size;
+	}
+
+	bool operator==(const FixedVector &other) const
+	{
+		return std::equal(this->begin(), this->end(), other.begin(), other.end());
+	}
+
+	bool operator!=(const FixedVector &other) const
+	{
+		return !(*this == other);
+	}
+};
+
+
+#endif //SWRSTOYS_FIXEDVECTOR_HPP
@@ -0,0 +1,237 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include "IOBuffer.hpp"
+#include "../Memory.hpp"
+#include "../Metrics.hpp"
+
+struct SizeClass {
+	size_t size;
+	//! Buffers cut from each slab.
+	size_t perSlab;
+	//! Free buffers each thread keeps for itself.
+	size_t cached;
+	const char *name;
+};
+
+constexpr int classCount = 2;
+static const SizeClass classes[classCount] = {
+	{IOBuffer::smallSize, 16, 8, "4096"},
+	{IOBuffer::largeSize, 4,  2, "65536"}
+};
+
+struct Pool {
+	std::mutex mutex;
+	std::vector<char *> free[classCount];
+};
+
+struct ThreadCache {
+	std::vector<char *> free[classCount];
+
+	ThreadCache();
+	~ThreadCache();
+};
+
+// Constant initialized, the buffers can be used by the other statics.
+static std::atomic<long long> created[classCount];
+static std::atomic<long long> used[classCount];
+static thread_local ThreadCache cache;
+// The buffers are counted with the network buffers
+static Memory::Allocator<char, Memory::TAG_NETWORK> allocator;
+static const Metrics::Counter oversizedBuffers = Metrics::counter("sokustreaming_io_buffers_oversized_total", "Buffers too big to be pooled, allocated on the heap instead.");
+
+static Metrics::Samples collect(const std::atomic<long long> *values)
+{
+	Metrics::Samples samples;
+
+	for (int i = 0; i < classCount; i++)
+		samples.emplace_back(Metrics::label("size", classes[i].name), values[i].load(std::memory_order_relaxed));
+	return samples;
+}
+
+static const bool registered = []{
+	Metrics::addCollector("sokustreaming_io_buffers", "Pooled buffers cut from the slabs so far, by size. They are never freed.", Metrics::GAUGE, []{
+		return collect(created);
+	});
+	Metrics::addCollector("sokustreaming_io_buffers_used", "Pooled buffers currently borrowed, by size.", Metrics::GAUGE, []{
+		return collect(used);
+	});
+	return true;
+}();
+
+// Never destroyed, the threads give their buffers back when they exit.
+static Pool &pool()
+{
+	static Pool *pool = new Pool();
+
+	return *pool;
+}
+
+ThreadCache::ThreadCache()
+{
+	// So they are never reallocated
+	for (int i = 0; i < classCount; i++)
+		this->free[i].reserve(classes[i].cached);
+}
+
+ThreadCache::~ThreadCache()
+{
+	auto &p = pool();
+	std::lock_guard<std::mutex> lock{p.mutex};
+
+	for (int i = 0; i < classCount; i++)
+		p.free[i].insert(p.free[i].end(), this->free[i].begin(), this->free[i].end());
+}
+
+//! @return The index of the smallest class big enough, or -1 if none is.
+static int getSizeClass(size_t size)
+{
+	for (int i = 0; i < classCount; i++)
+		if (size <= classes[i].size)
+			return i;
+	return -1;
+}
+
+static char *borrow(int index)
+{
+	auto &sizeClass = classes[index];
+	auto &free = cache.free[index];
+
+	if (free.empty()) {
+		auto &p = pool();
+		std::lock_guard<std::mutex> lock{p.mutex};
+		auto &shared = p.free[index];
+
+		if (shared.empty()) {
+			char *slab = allocator.allocate(sizeClass.size * sizeClass.perSlab);
+
+			for (size_t i = 0; i < sizeClass.perSlab; i++)
+				shared.push_back(slab + i * sizeClass.size);
+			created[index].fetch_add(sizeClass.perSlab, std::memory_order_relaxed);
+		}
+
+		// Also take the ones the next borrows will need, to lock less often
+		size_t count = std::min(shared.size(), std::max<size_t>(sizeClass.cached / 2, 1));
+
+		free.insert(free.end(), shared.end() - count, shared.end());
+		shared.resize(shared.size() - count);
+	}
+
+	auto result = free.back();
+
+	free.pop_back();
+	used[index].fetch_add(1, std::memory_order_relaxed);
+	return result;
+}
+
+static void giveBack(int index, char *data)
+{
+	auto &free = cache.free[index];
+
+	used[index].fetch_sub(1, std::memory_order_relaxed);
+	if (free.size() == classes[index].cached) {
+		auto &p = pool();
+		std::lock_guard<std::mutex> lock{p.mutex};
+		// Half of them, so the next borrows don't have to take them back right away
+		size_t count = free.size() / 2;
+
+		p.free[index].insert(p.free[index].end(), free.end() - count, free.end());
+		free.resize(free.size() - count);
+	}
+	free.push_back(data);
+}
+
+IOBuffer::IOBuffer(size_t capacity)
+{
+	if (!capacity)
+		return;
+
+	int index = getSizeClass(capacity);
+
+	if (index < 0) {
+		oversizedBuffers.add();
+		this->_data = allocator.allocate(capacity);
+		this->_capacity = capacity;
+	} else {
+		this->_data = borrow(index);
+		this->_capacity = classes[index].size;
+	}
+}
+
+IOBuffer::IOBuffer(IOBuffer &&other) noexcept :
+	_data(other._data),
+	_size(other._size),
+	_capacity(other._capacity)
+{
+	other._data = nullptr;
+	other._size = 0;
+	other._capacity = 0;
+}
+
+IOBuffer &IOBuffer::operator=(IOBuffer &&other) noexcept
+{
+	if (this == &other)
+		return *this;
+	this->release();
+	this->_data = other._data;
+	this->_size = other._size;
+	this->_capacity = other._capacity;
+	other._data = nullptr;
+	other._size = 0;
+	other._capacity = 0;
+	return *this;
+}
+
+IOBuffer::~IOBuffer()
+{
+	this->release();
+}
+
+void IOBuffer::resize(size_t size)
+{
+	this->_size = std::min(size, this->_capacity);
+}
+
+void IOBuffer::reserve(size_t capacity)
+{
+	if (capacity <= this->_capacity)
+		return;
+
+	IOBuffer bigger{capacity};
+
+	if (this->_size)
+		memcpy(bigger._data, this->_data, this->_size);
+	bigger._size = this->_size;
+	*this = std::move(bigger);
+}
+
+void IOBuffer::append(std::string_view data)
+{
+	if (this->_size + data.size() > this->_capacity)
+		this->reserve(std::max(this->_size + data.size(), this->_capacity * 2));
+	if (!data.empty())
+		memcpy(this->_data + this->_size, data.data(), data.size());
+	this->_size += data.size();
+}
+
+void IOBuffer::release()
+{
+	if (!this->_data)
+		return;
+
+	int index = getSizeClass(this->_capacity);
+
+	if (index < 0)
+		allocator.deallocate(this->_data, this->_capacity);
+	else
+		giveBack(index, this->_data);
+	this->_data = nullptr;
+	this->_size = 0;
+	this->_capacity = 0;
+}
@@ -0,0 +1,54 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_IOBUFFER_HPP
+#define SWRSTOYS_IOBUFFER_HPP
+
+
+#include <cstddef>
+#include <string_view>
+
+//! @brief Buffer the sockets receive in and the frames are built in, borrowed from a pool and given back when destroyed.
+//! The pooled buffers have a fixed size, smallSize or largeSize, and are cut from slabs which are never freed,
+//! so the memory stays at its peak instead of following the connections coming and going.
+//! Each thread keeps a few free buffers of each size for itself, the others are shared.
+//! Bigger buffers are allocated on the heap.
+class IOBuffer {
+private:
+	char *_data = nullptr;
+	size_t _size = 0;
+	size_t _capacity = 0;
+
+public:
+	static constexpr size_t smallSize = 4096;
+	static constexpr size_t largeSize = 65536;
+
+	IOBuffer() = default;
+	//! @brief Borrow a buffer of at least capacity bytes.
+	explicit IOBuffer(size_t capacity);
+	IOBuffer(IOBuffer &&other) noexcept;
+	IOBuffer &operator=(IOBuffer &&other) noexcept;
+	~IOBuffer();
+
+	IOBuffer(const IOBuffer &) = delete;
+	IOBuffer &operator=(const IOBuffer &) = delete;
+
+	char *data() { return this->_data; }
+	const char *data() const { return this->_data; }
+	size_t size() const { return this->_size; }
+	size_t capacity() const { return this->_capacity; }
+	bool empty() const { return this->_size == 0; }
+	std::string_view view() const { return {this->_data, this->_size}; }
+
+	//! @brief Change the size, without going past the capacity.
+	void resize(size_t size);
+	//! @brief Make room for at least capacity bytes, moving the content to a bigger buffer if needed.
+	void reserve(size_t capacity);
+	void append(std::string_view data);
+	//! @brief Give the buffer back, leaving it without any room.
+	void release();
+};
+
+
+#endif //SWRSTOYS_IOBUFFER_HPP
@@ -0,0 +1,307 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <cmath>
+#include <cstring>
+#include "JsonWriter.hpp"
+#include "nlohmann/json.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	define JSON_WRITER_SSE2
+#	include <emmintrin.h>
+#endif
+
+static const char hexDigits[] = "0123456789abcdef";
+
+void JsonWriter::clear()
+{
+	this->_buffer.clear();
+	this->_needComma = false;
+}
+
+std::string_view JsonWriter::str() const
+{
+	return this->_buffer;
+}
+
+void JsonWriter::_separate()
+{
+	if (this->_needComma)
+		this->_buffer += ',';
+	this->_needComma = true;
+}
+
+JsonWriter &JsonWriter::beginObject()
+{
+	this->_separate();
+	this->_buffer += '{';
+	this->_needComma = false;
+	return *this;
+}
+
+JsonWriter &JsonWriter::endObject()
+{
+	this->_buffer += '}';
+	this->_needComma = true;
+	return *this;
+}
+
+JsonWriter &JsonWriter::beginArray()
+{
+	this->_separate();
+	this->_buffer += '[';
+	this->_needComma = false;
+	return *this;
+}
+
+JsonWriter &JsonWriter::endArray()
+{
+	this->_buffer += ']';
+	this->_needComma = true;
+	return *this;
+}
+
+JsonWriter &JsonWriter::key(const char *name)
+{
+	this->_separate();
+	this->_buffer += '"';
+	this->_buffer += name;
+	this->_buffer += "\":";
+	this->_needComma = false;
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(bool b)
+{
+	this->_separate();
+	this->_buffer += b ? "true" : "false";
+	return *this;
+}
+
+// Writes the decimal representation of nb in out, which must hold at least 20 characters.
+static size_t formatDigits(char *out, unsigned long long nb)
+{
+	size_t size = 1;
+
+	for (auto tmp = nb; tmp >= 10; tmp /= 10)
+		size++;
+	for (size_t i = size; i; i--) {
+		out[i - 1] = static_cast<char>('0' + nb % 10);
+		nb /= 10;
+	}
+	return size;
+}
+
+static void appendDigits(JsonWriter::Buffer &buffer, unsigned long long nb)
+{
+	char digits[20];
+
+	buffer.append(digits, formatDigits(digits, nb));
+}
+
+JsonWriter &JsonWriter::value(long long nb)
+{
+	auto abs = static_cast<unsigned long long>(nb);
+
+	this->_separate();
+	if (nb < 0) {
+		this->_buffer += '-';
+		// Computed unsigned so the smallest value doesn't overflow
+		abs = 0ULL - abs;
+	}
+	appendDigits(this->_buffer, abs);
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(unsigned long long nb)
+{
+	this->_separate();
+	appendDigits(this->_buffer, nb);
+	return *this;
+}
+
+JsonWriter &JsonWriter::array(const unsigned short *data, size_t size)
+{
+	// Card lists are most of the state, so they are formatted by chunks rather than one append per number.
+	char chunk[256];
+	size_t used = 0;
+
+	this->beginArray();
+	for (size_t i = 0; i < size; i++) {
+		if (used > sizeof(chunk) - 21) {
+			this->_buffer.append(chunk, used);
+			used = 0;
+		}
+		if (i)
+			chunk[used++] = ',';
+		used += formatDigits(chunk + used, data[i]);
+	}
+	this->_buffer.append(chunk, used);
+	return this->endArray();
+}
+
+JsonWriter &JsonWriter::value(double nb)
+{
+	char buffer[64];
+
+	this->_separate();
+	if (!std::isfinite(nb)) {
+		this->_buffer += "null";
+		return *this;
+	}
+	// Same shortest round trip representation as nlohmann::json::dump
+	this->_buffer.append(buffer, nlohmann::detail::to_chars(buffer, buffer + sizeof(buffer), nb) - buffer);
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(const char *str, size_t size)
+{
+	this->_separate();
+	this->_writeString(str, size);
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(const char *str)
+{
+	return this->value(str, strlen(str));
+}
+
+// Length of the run of characters at the start of str that can be copied without escaping.
+static size_t plainLength(const unsigned char *str, size_t size)
+{
+	size_t i = 0;
+
+#ifdef JSON_WRITER_SSE2
+	const __m128i space = _mm_set1_epi8(0x20);
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i del = _mm_set1_epi8(0x7F);
+
+	for (; i + 16 <= size; i += 16) {
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(str + i));
+		// Signed comparison, so this catches both the control characters and the non ASCII bytes.
+		__m128i special = _mm_cmplt_epi8(chunk, space);
+
+		special = _mm_or_si128(special, _mm_cmpeq_epi8(chunk, quote));
+		special = _mm_or_si128(special, _mm_cmpeq_epi8(chunk, backslash));
+		special = _mm_or_si128(special, _mm_cmpeq_epi8(chunk, del));
+
+		unsigned mask = _mm_movemask_epi8(special);
+
+		if (mask) {
+			while (!(mask & 1U)) {
+				mask >>= 1U;
+				i++;
+			}
+			return i;
+		}
+	}
+#endif
+	while (i < size && str[i] >= 0x20 && str[i] < 0x7F && str[i] != '"' && str[i] != '\\')
+		i++;
+	return i;
+}
+
+// Decode the UTF-8 sequence at the start of str. Returns its length, or 0 if it is invalid.
+static size_t decodeUtf8(const unsigned char *str, size_t size, uint32_t &codepoint)
+{
+	size_t len;
+	uint32_t min;
+
+	if (str[0] < 0x80) {
+		codepoint = str[0];
+		return 1;
+	}
+	if ((str[0] & 0xE0U) == 0xC0) {
+		len = 2;
+		min = 0x80;
+		codepoint = str[0] & 0x1FU;
+	} else if ((str[0] & 0xF0U) == 0xE0) {
+		len = 3;
+		min = 0x800;
+		codepoint = str[0] & 0x0FU;
+	} else if ((str[0] & 0xF8U) == 0xF0) {
+		len = 4;
+		min = 0x10000;
+		codepoint = str[0] & 0x07U;
+	} else
+		return 0;
+	if (len > size)
+		return 0;
+	for (size_t i = 1; i < len; i++) {
+		if ((str[i] & 0xC0U) != 0x80)
+			return 0;
+		codepoint = (codepoint << 6U) | (str[i] & 0x3FU);
+	}
+	if (codepoint < min || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF))
+		return 0;
+	return len;
+}
+
+void JsonWriter::_writeString(const char *str, size_t size)
+{
+	auto bytes = reinterpret_cast<const unsigned char *>(str);
+	char escape[6] = {'\\', 'u'};
+
+	this->_buffer += '"';
+	while (size) {
+		size_t plain = plainLength(bytes, size);
+		uint32_t codepoint;
+
+		this->_buffer.append(reinterpret_cast<const char *>(bytes), plain);
+		bytes += plain;
+		size -= plain;
+		if (!size)
+			break;
+
+		size_t len = decodeUtf8(bytes, size, codepoint);
+
+		if (!len) {
+			// Skip the invalid byte
+			len = 1;
+			codepoint = 0xFFFD;
+		}
+		bytes += len;
+		size -= len;
+		switch (codepoint) {
+		case '\b':
+			this->_buffer += "\\b";
+			continue;
+		case '\t':
+			this->_buffer += "\\t";
+			continue;
+		case '\n':
+			this->_buffer += "\\n";
+			continue;
+		case '\f':
+			this->_buffer += "\\f";
+			continue;
+		case '\r':
+			this->_buffer += "\\r";
+			continue;
+		case '"':
+			this->_buffer += "\\\"";
+			continue;
+		case '\\':
+			this->_buffer += "\\\\";
+			continue;
+		}
+		if (codepoint > 0xFFFF) {
+			uint32_t high = 0xD7C0U + (codepoint >> 10U);
+
+			escape[2] = hexDigits[(high >> 12U) & 0xFU];
+			escape[3] = hexDigits[(high >> 8U) & 0xFU];
+			escape[4] = hexDigits[(high >> 4U) & 0xFU];
+			escape[5] = hexDigits[high & 0xFU];
+			this->_buffer.append(escape, sizeof(escape));
+			codepoint = 0xDC00U + (codepoint & 0x3FFU);
+		}
+		escape[2] = hexDigits[(codepoint >> 12U) & 0xFU];
+		escape[3] = hexDigits[(codepoint >> 8U) & 0xFU];
+		escape[4] = hexDigits[(codepoint >> 4U) & 0xFU];
+		escape[5] = hexDigits[codepoint & 0xFU];
+		this->_buffer.append(escape, sizeof(escape));
+	}
+	this->_buffer += '"';
+}
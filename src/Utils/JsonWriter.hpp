@@ -0,0 +1,77 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_JSONWRITER_HPP
+#define SWRSTOYS_JSONWRITER_HPP
+
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include "../Memory.hpp"
+
+//! @brief Streaming json serializer writing into a reusable buffer.
+//! The output is the same as nlohmann::json::dump(-1, ' ', true) would give for the same document,
+//! as long as the object keys are given in alphabetical order.
+//! Nothing is allocated once the buffer grew big enough.
+class JsonWriter {
+public:
+	//! Counted as json scratch space.
+	using Buffer = Memory::String<Memory::TAG_JSON>;
+
+private:
+	Buffer _buffer;
+	bool _needComma = false;
+
+	void _separate();
+	void _writeString(const char *str, size_t size);
+
+public:
+	//! @brief Empty the buffer, keeping its capacity.
+	void clear();
+	//! @brief What was written so far, valid until the next write.
+	std::string_view str() const;
+
+	JsonWriter &beginObject();
+	JsonWriter &endObject();
+	JsonWriter &beginArray();
+	JsonWriter &endArray();
+	//! @brief Write an object key. It is written as is, so it must not need escaping.
+	JsonWriter &key(const char *name);
+	JsonWriter &value(bool b);
+	JsonWriter &value(long long nb);
+	JsonWriter &value(unsigned long long nb);
+	JsonWriter &value(int nb) { return this->value(static_cast<long long>(nb)); }
+	JsonWriter &value(unsigned nb) { return this->value(static_cast<unsigned long long>(nb)); }
+	JsonWriter &value(double nb);
+	//! @brief Write a UTF-8 string. Non ASCII characters are escaped.
+	//! Invalid sequences are replaced by U+FFFD.
+	JsonWriter &value(const char *str, size_t size);
+	JsonWriter &value(const char *str);
+	JsonWriter &value(const std::string &str) { return this->value(str.data(), str.size()); }
+
+	JsonWriter &array(const unsigned short *data, size_t size);
+
+	template<typename T>
+	JsonWriter &array(const T *data, size_t size)
+	{
+		this->beginArray();
+		for (size_t i = 0; i < size; i++)
+			this->value(data[i]);
+		return this->endArray();
+	}
+
+	//! @brief Write an array containing size times the same value.
+	template<typename T>
+	JsonWriter &repeat(const T &elem, size_t size)
+	{
+		this->beginArray();
+		for (size_t i = 0; i < size; i++)
+			this->value(elem);
+		return this->endArray();
+	}
+};
+
+
+#endif //SWRSTOYS_JSONWRITER_HPP
@@ -0,0 +1,168 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <algorithm>
+#include <cstring>
+#include "MappedFile.hpp"
+#include "Exceptions.hpp"
+#ifdef _WIN32
+#	include <windows.h>
+#else
+#	include <cerrno>
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <unistd.h>
+#endif
+
+static size_t getGranularity()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+	return info.dwAllocationGranularity;
+#else
+	return sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static std::string getLastError()
+{
+#ifdef _WIN32
+	return "error " + std::to_string(GetLastError());
+#else
+	return strerror(errno);
+#endif
+}
+
+MappedFile::MappedFile(size_t windowSize)
+{
+	size_t granularity = getGranularity();
+
+	this->_windowSize = (std::max)(granularity, (windowSize + granularity - 1) / granularity * granularity);
+}
+
+MappedFile::~MappedFile()
+{
+	this->close();
+}
+
+void MappedFile::open(const std::string &path, uint64_t size)
+{
+	this->close();
+#ifdef _WIN32
+	this->_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (this->_file == INVALID_HANDLE_VALUE) {
+		this->_file = nullptr;
+		throw FileMappingException("Cannot open " + path + ": " + getLastError());
+	}
+#else
+	this->_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (this->_fd < 0)
+		throw FileMappingException("Cannot open " + path + ": " + getLastError());
+#endif
+	this->_size = size;
+	try {
+		this->_map(size - size % getGranularity());
+	} catch (...) {
+		this->close();
+		throw;
+	}
+	// Whatever was after size is garbage now, don't let it look like data.
+	memset(this->_window + (size - this->_windowOffset), 0, this->_windowSize - (size - this->_windowOffset));
+}
+
+void MappedFile::close()
+{
+	if (!this->isOpen())
+		return;
+	this->_unmap();
+#ifdef _WIN32
+	LARGE_INTEGER size;
+
+	size.QuadPart = this->_size;
+	SetFilePointerEx(this->_file, size, nullptr, FILE_BEGIN);
+	SetEndOfFile(this->_file);
+	CloseHandle(this->_file);
+	this->_file = nullptr;
+#else
+	if (ftruncate(this->_fd, this->_size) < 0)
+		perror("ftruncate");
+	::close(this->_fd);
+	this->_fd = -1;
+#endif
+}
+
+bool MappedFile::isOpen() const
+{
+#ifdef _WIN32
+	return this->_file != nullptr;
+#else
+	return this->_fd >= 0;
+#endif
+}
+
+void MappedFile::_unmap()
+{
+#ifdef _WIN32
+	if (this->_window)
+		UnmapViewOfFile(this->_window);
+	if (this->_mapping)
+		CloseHandle(this->_mapping);
+	this->_mapping = nullptr;
+#else
+	if (this->_window)
+		munmap(this->_window, this->_windowSize);
+#endif
+	this->_window = nullptr;
+}
+
+void MappedFile::_map(uint64_t offset)
+{
+	uint64_t end = offset + this->_windowSize;
+
+	this->_unmap();
+#ifdef _WIN32
+	// The mapping object grows the file to its size.
+	this->_mapping = CreateFileMappingA(this->_file, nullptr, PAGE_READWRITE, end >> 32U, end & 0xFFFFFFFFU, nullptr);
+	if (!this->_mapping)
+		throw FileMappingException("Cannot grow file: " + getLastError());
+	this->_window = static_cast<unsigned char *>(MapViewOfFile(this->_mapping, FILE_MAP_WRITE, offset >> 32U, offset & 0xFFFFFFFFU, this->_windowSize));
+	if (!this->_window)
+		throw FileMappingException("Cannot map file: " + getLastError());
+#else
+	if (ftruncate(this->_fd, end) < 0)
+		throw FileMappingException("Cannot grow file: " + getLastError());
+
+	void *window = mmap(nullptr, this->_windowSize, PROT_READ | PROT_WRITE, MAP_SHARED, this->_fd, offset);
+
+	if (window == MAP_FAILED)
+		throw FileMappingException("Cannot map file: " + getLastError());
+	this->_window = static_cast<unsigned char *>(window);
+#endif
+	this->_windowOffset = offset;
+}
+
+void MappedFile::append(const void *data, size_t size)
+{
+	auto bytes = static_cast<const unsigned char *>(data);
+
+	while (size) {
+		if (this->_size >= this->_windowOffset + this->_windowSize)
+			this->_map(this->_windowOffset + this->_windowSize);
+
+		size_t offset = this->_size - this->_windowOffset;
+		size_t chunk = (std::min)(size, this->_windowSize - offset);
+
+		memcpy(this->_window + offset, bytes, chunk);
+		this->_size += chunk;
+		bytes += chunk;
+		size -= chunk;
+	}
+}
+
+uint64_t MappedFile::size() const
+{
+	return this->_size;
+}
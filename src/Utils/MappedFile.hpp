@@ -0,0 +1,48 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_MAPPEDFILE_HPP
+#define SWRSTOYS_MAPPEDFILE_HPP
+
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//! @brief Append only file written through a memory mapped window.
+//! The file grows by whole windows and is truncated back to the written size when closed.
+class MappedFile {
+private:
+#ifdef _WIN32
+	void *_file = nullptr;
+	void *_mapping = nullptr;
+#else
+	int _fd = -1;
+#endif
+	size_t _windowSize;
+	//! Offset in the file of the mapped window.
+	uint64_t _windowOffset = 0;
+	unsigned char *_window = nullptr;
+	uint64_t _size = 0;
+
+	void _unmap();
+	void _map(uint64_t offset);
+
+public:
+	//! @param windowSize Size of the mapped part of the file. Rounded up to the mapping granularity.
+	explicit MappedFile(size_t windowSize = 1024 * 1024);
+	~MappedFile();
+
+	//! @brief Open or create a file, discarding everything after size.
+	//! @throw FileMappingException The file couldn't be opened or mapped.
+	void open(const std::string &path, uint64_t size);
+	void close();
+	bool isOpen() const;
+	void append(const void *data, size_t size);
+	//! @return Number of bytes written in the file so far.
+	uint64_t size() const;
+};
+
+
+#endif //SWRSTOYS_MAPPEDFILE_HPP
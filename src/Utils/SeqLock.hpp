@@ -0,0 +1,59 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_SEQLOCK_HPP
+#define SWRSTOYS_SEQLOCK_HPP
+
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+//! @brief Publishes copies of a trivially copyable value to any number of readers.
+//! The writer never waits for the readers. Readers retry until they got a copy
+//! that wasn't modified while they were reading it.
+//! Writers must be serialized by the caller.
+template<typename T>
+class SeqLock {
+	static_assert(std::is_trivially_copyable<T>::value, "SeqLock can only hold trivially copyable types");
+
+private:
+	//! Odd while a write is in progress.
+	std::atomic<unsigned> _sequence{0};
+	T _value{};
+
+public:
+	void store(const T &value)
+	{
+		unsigned sequence = this->_sequence.load(std::memory_order_relaxed);
+
+		this->_sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(&this->_value, &value, sizeof(T));
+		this->_sequence.store(sequence + 2, std::memory_order_release);
+	}
+
+	T load() const
+	{
+		T result;
+
+		for (unsigned tries = 0; ; tries++) {
+			unsigned before = this->_sequence.load(std::memory_order_acquire);
+
+			if (!(before & 1U)) {
+				memcpy(&result, &this->_value, sizeof(T));
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (this->_sequence.load(std::memory_order_relaxed) == before)
+					return result;
+			}
+			// A write is only a memcpy, so this is rare. Let the writer finish if we keep missing it.
+			if (tries >= 4)
+				std::this_thread::yield();
+		}
+	}
+};
+
+
+#endif //SWRSTOYS_SEQLOCK_HPP
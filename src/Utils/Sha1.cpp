@@ -0,0 +1,258 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <cstring>
+#include "Sha1.hpp"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#	define SHA1_X86
+#	include <immintrin.h>
+#	ifdef _MSC_VER
+#		include <intrin.h>
+#		define SHA1_TARGET
+#	else
+#		include <cpuid.h>
+#		define SHA1_TARGET __attribute__((target("sha,sse4.1")))
+#	endif
+#endif
+
+static inline uint32_t rotl(uint32_t value, unsigned bits)
+{
+	return (value << bits) | (value >> (32 - bits));
+}
+
+static void compressPortable(uint32_t state[5], const unsigned char *data, size_t blocks)
+{
+	uint32_t w[16];
+
+	for (; blocks; blocks--, data += Sha1::blockSize) {
+		uint32_t a = state[0];
+		uint32_t b = state[1];
+		uint32_t c = state[2];
+		uint32_t d = state[3];
+		uint32_t e = state[4];
+
+		for (int i = 0; i < 80; i++) {
+			uint32_t f;
+			uint32_t k;
+
+			if (i < 16)
+				w[i] = (static_cast<uint32_t>(data[i * 4]) << 24U) | (data[i * 4 + 1] << 16U) | (data[i * 4 + 2] << 8U) | data[i * 4 + 3];
+			else
+				w[i % 16] = rotl(w[(i + 13) % 16] ^ w[(i + 8) % 16] ^ w[(i + 2) % 16] ^ w[i % 16], 1);
+			if (i < 20) {
+				f = (b & c) | (~b & d);
+				k = 0x5A827999;
+			} else if (i < 40) {
+				f = b ^ c ^ d;
+				k = 0x6ED9EBA1;
+			} else if (i < 60) {
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8F1BBCDC;
+			} else {
+				f = b ^ c ^ d;
+				k = 0xCA62C1D6;
+			}
+
+			uint32_t tmp = rotl(a, 5) + f + e + k + w[i % 16];
+
+			e = d;
+			d = c;
+			c = rotl(b, 30);
+			b = a;
+			a = tmp;
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+	}
+}
+
+#ifdef SHA1_X86
+// 4 rounds, also scheduling the message words needed for the next ones.
+#define SHA1_ROUNDS(ea, eb, m0, m1, m2, m3, f) \
+	ea = _mm_sha1nexte_epu32(ea, m0);      \
+	eb = abcd;                             \
+	m1 = _mm_sha1msg2_epu32(m1, m0);       \
+	abcd = _mm_sha1rnds4_epu32(abcd, ea, f); \
+	m3 = _mm_sha1msg1_epu32(m3, m0);       \
+	m2 = _mm_xor_si128(m2, m0)
+
+SHA1_TARGET static void compressHardware(uint32_t state[5], const unsigned char *data, size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090A0B0C0D0E0FULL);
+	__m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0x1B);
+	__m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+	__m128i e1;
+	__m128i msg0, msg1, msg2, msg3;
+
+	for (; blocks; blocks--, data += Sha1::blockSize) {
+		__m128i abcdSave = abcd;
+		__m128i e0Save = e0;
+
+		msg0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data)), mask);
+		msg1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16)), mask);
+		msg2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 32)), mask);
+		msg3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 48)), mask);
+
+		// Rounds 0-15
+		e0 = _mm_add_epi32(e0, msg0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		e1 = _mm_sha1nexte_epu32(e1, msg1);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+		e0 = _mm_sha1nexte_epu32(e0, msg2);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+		msg0 = _mm_xor_si128(msg0, msg2);
+		SHA1_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 0);
+
+		// Rounds 16-59
+		SHA1_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 0);
+		SHA1_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 1);
+		SHA1_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 1);
+		SHA1_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 1);
+		SHA1_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 1);
+		SHA1_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 1);
+		SHA1_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 2);
+		SHA1_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 2);
+		SHA1_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 2);
+		SHA1_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 2);
+		SHA1_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 2);
+
+		// Rounds 60-79
+		SHA1_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 3);
+		SHA1_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 3);
+		e1 = _mm_sha1nexte_epu32(e1, msg1);
+		e0 = abcd;
+		msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+		msg3 = _mm_xor_si128(msg3, msg1);
+		e0 = _mm_sha1nexte_epu32(e0, msg2);
+		e1 = abcd;
+		msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+		e1 = _mm_sha1nexte_epu32(e1, msg3);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+		e0 = _mm_sha1nexte_epu32(e0, e0Save);
+		abcd = _mm_add_epi32(abcd, abcdSave);
+	}
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(state), _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = _mm_extract_epi32(e0, 3);
+}
+
+static bool detectHardwareSupport()
+{
+	unsigned regs[4];
+
+#ifdef _MSC_VER
+	__cpuid(reinterpret_cast<int *>(regs), 0);
+	if (regs[0] < 7)
+		return false;
+	__cpuid(reinterpret_cast<int *>(regs), 1);
+
+	bool sse = (regs[2] & (1U << 19U)) && (regs[2] & (1U << 9U));
+
+	__cpuidex(reinterpret_cast<int *>(regs), 7, 0);
+#else
+	if (__get_cpuid_max(0, nullptr) < 7)
+		return false;
+	__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]);
+
+	bool sse = (regs[2] & (1U << 19U)) && (regs[2] & (1U << 9U));
+
+	__cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	// SSSE3 and SSE4.1 are needed for the shuffles and the extract.
+	return sse && (regs[1] & (1U << 29U));
+}
+
+static const bool useHardware = detectHardwareSupport();
+#endif
+
+static void compress(uint32_t state[5], const unsigned char *data, size_t blocks)
+{
+#ifdef SHA1_X86
+	if (useHardware)
+		return compressHardware(state, data, blocks);
+#endif
+	compressPortable(state, data, blocks);
+}
+
+Sha1::Sha1() :
+	_state{0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0}
+{
+}
+
+void Sha1::update(const void *data, size_t size)
+{
+	auto bytes = static_cast<const unsigned char *>(data);
+
+	this->_length += size;
+	if (this->_blockUsed) {
+		size_t missing = blockSize - this->_blockUsed;
+
+		if (size < missing) {
+			memcpy(this->_block + this->_blockUsed, bytes, size);
+			this->_blockUsed += size;
+			return;
+		}
+		memcpy(this->_block + this->_blockUsed, bytes, missing);
+		compress(this->_state, this->_block, 1);
+		bytes += missing;
+		size -= missing;
+		this->_blockUsed = 0;
+	}
+	compress(this->_state, bytes, size / blockSize);
+	bytes += size - size % blockSize;
+	size %= blockSize;
+	memcpy(this->_block, bytes, size);
+	this->_blockUsed = size;
+}
+
+void Sha1::finish(unsigned char (&digest)[digestSize])
+{
+	uint64_t bits = this->_length * 8;
+
+	this->_block[this->_blockUsed++] = 0x80;
+	if (this->_blockUsed > blockSize - 8) {
+		memset(this->_block + this->_blockUsed, 0, blockSize - this->_blockUsed);
+		compress(this->_state, this->_block, 1);
+		this->_blockUsed = 0;
+	}
+	memset(this->_block + this->_blockUsed, 0, blockSize - 8 - this->_blockUsed);
+	for (int i = 0; i < 8; i++)
+		this->_block[blockSize - 1 - i] = bits >> (i * 8U);
+	compress(this->_state, this->_block, 1);
+	for (int i = 0; i < 5; i++) {
+		digest[i * 4]     = this->_state[i] >> 24U;
+		digest[i * 4 + 1] = this->_state[i] >> 16U;
+		digest[i * 4 + 2] = this->_state[i] >> 8U;
+		digest[i * 4 + 3] = this->_state[i];
+	}
+}
+
+void Sha1::hash(const void *data, size_t size, unsigned char (&digest)[digestSize])
+{
+	Sha1 sha1;
+
+	sha1.update(data, size);
+	sha1.finish(digest);
+}
+
+bool Sha1::hasHardwareSupport()
+{
+#ifdef SHA1_X86
+	return useHardware;
+#else
+	return false;
+#endif
+}
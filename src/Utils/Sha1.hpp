@@ -0,0 +1,38 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_SHA1_HPP
+#define SWRSTOYS_SHA1_HPP
+
+
+#include <cstddef>
+#include <cstdint>
+
+//! @brief Incremental SHA-1 hasher which never allocates.
+//! Uses the SHA extensions when the CPU supports them.
+class Sha1 {
+public:
+	static constexpr size_t digestSize = 20;
+	static constexpr size_t blockSize = 64;
+
+	Sha1();
+
+	void update(const void *data, size_t size);
+	//! @brief Write the digest of everything given to update.
+	//! The hasher must not be used anymore afterward.
+	void finish(unsigned char (&digest)[digestSize]);
+
+	static void hash(const void *data, size_t size, unsigned char (&digest)[digestSize]);
+	//! @return Whether the SHA extensions are used.
+	static bool hasHardwareSupport();
+
+private:
+	uint32_t _state[5];
+	uint64_t _length = 0;
+	unsigned char _block[blockSize];
+	size_t _blockUsed = 0;
+};
+
+
+#endif //SWRSTOYS_SHA1_HPP
@@ -2,50 +2,25 @@
 // Created by Gegel85 on 11/11/2020.
 //
 
+#include <algorithm>
+#include <cstring>
 #include "ShiftJISDecoder.hpp"
 
-std::string convertShiftJisToUTF8(const char *str)
-{
-	std::string output;
-	auto bytes = reinterpret_cast<const unsigned char *>(str);
-
-	output.reserve(3 * strlen(str)); //ShiftJis won't give 4byte UTF8, so max. 3 byte per input char are needed
-	for (size_t indexInput = 0; str[indexInput]; indexInput++) {
-		unsigned char arraySection = (bytes[indexInput] >> 4U);
-		unsigned short arrayOffset;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define SHIFTJIS_SSE2
+#	ifdef _MSC_VER
+#		include <intrin.h>
+#	endif
+#endif
 
-		if (arraySection == 0x8 || arraySection == 0x9 || arraySection == 0xE) {
-			arrayOffset = bytes[indexInput] << 8U;
-			indexInput++;
-			arrayOffset |= bytes[indexInput];
-		} else
-			arrayOffset = bytes[indexInput]; //this is one byte shiftjis
+struct Mapping {
+	unsigned short shiftJis;
+	unsigned short unicode;
+};
 
-		//unicode number is...
-		uint16_t unicodeValue = 0xFFFD;
-
-		try {
-			unicodeValue = convTable.at(arrayOffset);
-		} catch (...) {}
-
-		//converting to UTF8
-		if (unicodeValue < 0x80) {
-			output.push_back(unicodeValue);
-		} else if (unicodeValue < 0x800) {
-			output.push_back(0xC0U | (unicodeValue >> 6U));
-			output.push_back((unicodeValue & 0x3fU));
-		} else {
-			output.push_back(0xE0U | (unicodeValue >> 12U));
-			output.push_back(0x80U | ((unicodeValue & 0xfffU) >> 6U));
-			output.push_back(0x80U | (unicodeValue & 0x3fU));
-		}
-	}
-
-	output.shrink_to_fit(); //remove the unnecessary bytes
-	return output;
-}
-
-const std::map<unsigned short, unsigned short> convTable = {
+// Shift-JIS code, Unicode code point
+static constexpr Mapping mappings[] = {
 	{{0x0020}, {0x0020}}, // SPACE
 	{{0x0021}, {0x0021}}, // EXCLAMATION MARK
 	{{0x0022}, {0x0022}}, // QUOTATION MARK
@@ -7083,4 +7058,237 @@ const std::map<unsigned short, unsigned short> convTable = {
 	{{0xeaa2}, {0x7464}}, // <CJK>
 	{{0xeaa3}, {0x51DC}}, // <CJK>
 	{{0xeaa4}, {0x7199}}, // <CJK>
-};
\ No newline at end of file
+};
+// Second bytes go from 0x40 to 0xFC, without 0x7F
+#define TRAIL_BYTES 188
+// Lead bytes are 0x81-0x9F and 0xE0-0xFC
+#define LEAD_BYTES 60
+
+//! Unmapped characters are 0 in the tables, and decoded as U+FFFD.
+struct DecodeTable {
+	//! Index of each lead byte in doubleBytes, plus one. 0 for single bytes.
+	unsigned char rows[256];
+	unsigned short singleBytes[256];
+	unsigned short doubleBytes[LEAD_BYTES][TRAIL_BYTES];
+};
+
+static constexpr int trailIndex(unsigned char trail)
+{
+	if (trail < 0x40 || trail == 0x7F || trail > 0xFC)
+		return -1;
+	return trail - 0x40 - (trail > 0x7F);
+}
+
+static constexpr DecodeTable buildTable()
+{
+	DecodeTable table{};
+	unsigned char row = 0;
+
+	for (unsigned lead = 0x81; lead <= 0xFC; lead++)
+		if (lead <= 0x9F || lead >= 0xE0)
+			table.rows[lead] = ++row;
+	for (auto &mapping : mappings)
+		if (mapping.shiftJis < 0x100)
+			table.singleBytes[mapping.shiftJis] = mapping.unicode;
+		else
+			table.doubleBytes[table.rows[mapping.shiftJis >> 8U] - 1][trailIndex(mapping.shiftJis & 0xFFU)] = mapping.unicode;
+	return table;
+}
+
+static constexpr DecodeTable decodeTable = buildTable();
+
+#define MAPPING_COUNT (sizeof(mappings) / sizeof(*mappings))
+
+//! The mappings sorted by code point, in one bucket per high byte of the code point.
+struct EncodeTable {
+	//! Index in sorted of the first mapping of each bucket, the last one is the end.
+	unsigned short buckets[257];
+	Mapping sorted[MAPPING_COUNT];
+};
+
+static constexpr EncodeTable buildEncodeTable()
+{
+	EncodeTable table{};
+	Mapping byLowByte[MAPPING_COUNT]{};
+	unsigned short offsets[257]{};
+
+	// Radix sort, on the low byte then the high byte. Sorting in place would be too slow to run at compile time.
+	for (auto &mapping : mappings)
+		offsets[(mapping.unicode & 0xFFU) + 1]++;
+	for (unsigned i = 0; i < 256; i++)
+		offsets[i + 1] += offsets[i];
+	for (auto &mapping : mappings)
+		byLowByte[offsets[mapping.unicode & 0xFFU]++] = mapping;
+	for (auto &mapping : mappings)
+		table.buckets[(mapping.unicode >> 8U) + 1]++;
+	for (unsigned i = 0; i < 256; i++)
+		table.buckets[i + 1] += table.buckets[i];
+	for (unsigned i = 0; i < 257; i++)
+		offsets[i] = table.buckets[i];
+	for (auto &mapping : byLowByte)
+		table.sorted[offsets[mapping.unicode >> 8U]++] = mapping;
+	return table;
+}
+
+static constexpr EncodeTable encodeTable = buildEncodeTable();
+
+#ifdef SHIFTJIS_SSE2
+//! @brief Count the bytes at the start of the block which are the same in UTF-8.
+//! Those are the printable ASCII characters, except the backslash and the tilde (yen sign and overline in Shift-JIS).
+static unsigned countPlainBytes(const unsigned char *block)
+{
+	__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block));
+	// Bytes from 0x80 are negative, so they fail the first comparison
+	__m128i plain = _mm_and_si128(
+		_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x1F)),
+		_mm_cmplt_epi8(bytes, _mm_set1_epi8(0x7E))
+	);
+	unsigned mask = _mm_movemask_epi8(_mm_andnot_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(0x5C)), plain));
+
+	if (mask == 0xFFFF)
+		return 16;
+#ifdef _MSC_VER
+	unsigned long index;
+
+	_BitScanForward(&index, ~mask);
+	return index;
+#else
+	return __builtin_ctz(~mask);
+#endif
+}
+#endif
+
+std::string convertShiftJisToUTF8(const char *str)
+{
+	auto bytes = reinterpret_cast<const unsigned char *>(str);
+	size_t size = strlen(str);
+	std::string output;
+	size_t out = 0;
+
+	// Shift-JIS characters are at most 3 bytes long in UTF-8
+	output.resize(3 * size);
+	for (size_t i = 0; i < size;) {
+#ifdef SHIFTJIS_SSE2
+		while (i + 16 <= size) {
+			unsigned count = countPlainBytes(bytes + i);
+
+			memcpy(&output[out], bytes + i, count);
+			out += count;
+			i += count;
+			if (count != 16)
+				break;
+		}
+		if (i == size)
+			break;
+#endif
+
+		unsigned char row = decodeTable.rows[bytes[i]];
+		unsigned short unicodeValue;
+
+		if (!row)
+			unicodeValue = decodeTable.singleBytes[bytes[i++]];
+		else {
+			// A lead byte at the end of the string, or followed by something which isn't a second byte,
+			// is invalid on its own. The next byte is decoded separately.
+			int trail = i + 1 < size ? trailIndex(bytes[i + 1]) : -1;
+
+			if (trail < 0) {
+				unicodeValue = 0;
+				i++;
+			} else {
+				unicodeValue = decodeTable.doubleBytes[row - 1][trail];
+				i += 2;
+			}
+		}
+		if (!unicodeValue)
+			unicodeValue = 0xFFFD;
+
+		//converting to UTF8
+		if (unicodeValue < 0x80)
+			output[out++] = unicodeValue;
+		else if (unicodeValue < 0x800) {
+			output[out++] = 0xC0U | (unicodeValue >> 6U);
+			output[out++] = 0x80U | (unicodeValue & 0x3FU);
+		} else {
+			output[out++] = 0xE0U | (unicodeValue >> 12U);
+			output[out++] = 0x80U | ((unicodeValue >> 6U) & 0x3FU);
+			output[out++] = 0x80U | (unicodeValue & 0x3FU);
+		}
+	}
+	output.resize(out);
+	return output;
+}
+
+//! @return The Shift-JIS code of the character, 0 if it has none.
+static unsigned short encodeCharacter(unsigned codePoint)
+{
+	if (codePoint > 0xFFFF)
+		return 0;
+
+	auto begin = encodeTable.sorted + encodeTable.buckets[codePoint >> 8U];
+	auto end = encodeTable.sorted + encodeTable.buckets[(codePoint >> 8U) + 1];
+	auto it = std::lower_bound(begin, end, codePoint, [](const Mapping &mapping, unsigned value){
+		return mapping.unicode < value;
+	});
+
+	return it != end && it->unicode == codePoint ? it->shiftJis : 0;
+}
+
+std::string convertUTF8ToShiftJis(const char *str, size_t maxSize)
+{
+	// Indexed by the length of the sequence
+	static const unsigned char leadMasks[] = {0, 0x7F, 0x1F, 0x0F, 0x07};
+	static const unsigned minimums[] = {0, 0, 0x80, 0x800, 0x10000};
+	auto bytes = reinterpret_cast<const unsigned char *>(str);
+	size_t size = strlen(str);
+	std::string output;
+	size_t out = 0;
+
+	// Only the backslash gets longer in Shift-JIS, where it is a 2 bytes character
+	output.resize(std::min(2 * size, maxSize));
+	for (size_t i = 0; i < size;) {
+#ifdef SHIFTJIS_SSE2
+		while (i + 16 <= size) {
+			unsigned count = std::min<size_t>(countPlainBytes(bytes + i), maxSize - out);
+
+			memcpy(&output[out], bytes + i, count);
+			out += count;
+			i += count;
+			if (count != 16)
+				break;
+		}
+		if (i == size || out == maxSize)
+			break;
+#endif
+
+		unsigned char lead = bytes[i];
+		unsigned length = lead < 0x80 ? 1 : (lead & 0xE0U) == 0xC0 ? 2 : (lead & 0xF0U) == 0xE0 ? 3 : (lead & 0xF8U) == 0xF0 ? 4 : 0;
+		unsigned codePoint = lead & leadMasks[length];
+		unsigned short shiftJis = 0;
+
+		for (unsigned j = 1; j < length; j++) {
+			if (i + j >= size || (bytes[i + j] & 0xC0U) != 0x80) {
+				length = 0;
+				break;
+			}
+			codePoint = (codePoint << 6U) | (bytes[i + j] & 0x3FU);
+		}
+		// Invalid sequences are replaced byte by byte
+		if (length && codePoint >= minimums[length])
+			shiftJis = encodeCharacter(codePoint);
+		else
+			length = 1;
+		if (!shiftJis)
+			shiftJis = '?';
+
+		// Never cut a character in half
+		if (out + 1 + (shiftJis > 0xFF) > maxSize)
+			break;
+		if (shiftJis > 0xFF)
+			output[out++] = shiftJis >> 8U;
+		output[out++] = shiftJis & 0xFFU;
+		i += length;
+	}
+	output.resize(out);
+	return output;
+}
@@ -6,11 +6,16 @@
 #define HISOUTENSOKUDISCORDINTEGRATION_SHIFTJISDECODER_HPP
 
 
+#include <cstdint>
 #include <string>
-#include <map>
 
+//! @brief Convert a nul terminated Shift-JIS string to UTF-8.
+//! Invalid or unmapped characters become U+FFFD.
 std::string convertShiftJisToUTF8(const char *str);
-extern const std::map<unsigned short, unsigned short> convTable;
+//! @brief Convert a nul terminated UTF-8 string to Shift-JIS.
+//! Characters which have no Shift-JIS code, and invalid sequences, become '?'.
+//! @param maxSize Maximum size of the result, the characters which don't fit are dropped.
+std::string convertUTF8ToShiftJis(const char *str, size_t maxSize = SIZE_MAX);
 
 
 #endif //HISOUTENSOKUDISCORDINTEGRATION_SHIFTJISDECODER_HPP
@@ -0,0 +1,71 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#ifndef SWRSTOYS_SPSCRING_HPP
+#define SWRSTOYS_SPSCRING_HPP
+
+
+#include <atomic>
+#include <cstddef>
+
+//! @brief Hands values from one writer thread to one reader thread in order, without locks.
+//! The writer fills back() then publishes it, the reader reads front() then pops it.
+//! Neither of them ever waits for the other. When the reader is N values behind, the ring is full
+//! and the writer has to skip its value.
+template<typename T, size_t N>
+class SpscRing {
+	static_assert(N && !(N & (N - 1)), "The size of a SpscRing must be a power of two");
+
+private:
+	T _buffers[N];
+	//! Values popped so far, only written by the reader.
+	std::atomic<size_t> _head{0};
+	//! Values published so far, only written by the writer.
+	std::atomic<size_t> _tail{0};
+
+public:
+	//! @brief Whether there is no room for another value. Only the writer may use it.
+	bool full() const
+	{
+		return this->_tail.load(std::memory_order_relaxed) - this->_head.load(std::memory_order_acquire) == N;
+	}
+
+	//! @brief Buffer the writer fills, when the ring isn't full. Only the writer may use it.
+	T &back()
+	{
+		return this->_buffers[this->_tail.load(std::memory_order_relaxed) % N];
+	}
+
+	//! @brief Queue the back buffer after the other values.
+	void publish()
+	{
+		this->_tail.store(this->_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	//! @brief Number of values published and not popped yet.
+	size_t size() const
+	{
+		return this->_tail.load(std::memory_order_acquire) - this->_head.load(std::memory_order_acquire);
+	}
+
+	bool empty() const
+	{
+		return this->size() == 0;
+	}
+
+	//! @brief Oldest value not popped yet, when the ring isn't empty. Only the reader may use it.
+	const T &front() const
+	{
+		return this->_buffers[this->_head.load(std::memory_order_relaxed) % N];
+	}
+
+	//! @brief Give the front buffer back to the writer.
+	void pop()
+	{
+		this->_head.store(this->_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+};
+
+
+#endif //SWRSTOYS_SPSCRING_HPP
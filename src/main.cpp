@@ -3,7 +3,14 @@
 //
 
 #include <windows.h>
+#include "Aggregator.hpp"
+#include "GameSource.hpp"
+#include "HookTimer.hpp"
+#include "KeyInputs.hpp"
+#include "Logger.hpp"
+#include "Timeline.hpp"
 #include "Exceptions.hpp"
+#include "Network/GameHandlers.hpp"
 #include "Network/Handlers.hpp"
 #include "State.hpp"
 #include "Utils/InputBox.hpp"
@@ -24,6 +31,18 @@ char profilePath[1024 + MAX_PATH];
 char parentPath[1024 + MAX_PATH];
 // Vanilla characters
 std::vector<unsigned> availableCharacters = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19};
+int (SokuLib::BattleManager::*s_origCBattleManager_Render)();
+int (SokuLib::BattleManager::*s_origCBattleManager_Start)();
+int (SokuLib::BattleManager::*s_origCBattleManager_KO)();
+int (SokuLib::LoadingWatch::*s_origCLoadingWatch_Process)();
+int (SokuLib::BattleWatch::*s_origCBattleWatch_Process)();
+int (SokuLib::Loading::*s_origCLoading_Process)();
+int (SokuLib::Battle::*s_origCBattle_Process)();
+int (SokuLib::Title::*s_origCTitle_Process)();;
+HWND myWindow;
+
+const char *jpTitle = "ôîò√ö±æzôVæÑ ü` Æ┤£WïëâMâjâçâïé╠ôΣé≡Æ╟éª Ver1.10a";
+
 static bool gameStarted = false;
 static bool sessionStarted = false;
 static int (__stdcall *s_origRecvFrom)(SOCKET s, char * buf, int len, int flags, sockaddr * from, int * fromlen);
@@ -34,9 +53,12 @@ int __stdcall myRecvFrom(SOCKET s, char *buf, int len, int flags, sockaddr *from
 	int result = s_origRecvFrom(s, buf, len, flags, from, fromlen);
 
 	if (packet->type == SokuLib::HOST_GAME && packet->game.event.type == SokuLib::GAME_MATCH && packet->game.event.match.host.deckId >= 5 && packet->game.event.match.client().deckId >= 5) {
+		CacheWriteLock lock;
+
 		_cache.leftScore = packet->game.event.match.host.deckId - 5;
 		_cache.rightScore = packet->game.event.match.client().deckId - 5;
-		_cache.recvScores = true;
+		_cache.version++;
+		recvScores = true;
 	}
 	return result;
 }
@@ -45,11 +67,13 @@ int __fastcall CTitle_OnProcess(SokuLib::Title *This) {
 	// super
 	int ret = (This->*s_origCTitle_Process)();
 
+	HookTimer timer{HOOK_TITLE};
+
 	if (gameStarted)
 		broadcastOpcode(GAME_ENDED, "null");
 	if (sessionStarted)
 		broadcastOpcode(SESSION_ENDED, "null");
-	_cache.recvScores = false;
+	recvScores = false;
 	gameStarted = false;
 	sessionStarted = false;
 	needReset = true;
@@ -62,6 +86,9 @@ int __fastcall CBattleWatch_OnProcess(SokuLib::BattleWatch *This) {
 	// super
 	int ret = (This->*s_origCBattleWatch_Process)();
 
+	HookTimer timer{HOOK_BATTLE_WATCH};
+
+	beginBroadcastBatch();
 	if (!gameStarted)
 		broadcastOpcode(GAME_STARTED, "null");
 	if (!sessionStarted)
@@ -69,6 +96,8 @@ int __fastcall CBattleWatch_OnProcess(SokuLib::BattleWatch *This) {
 	gameStarted = true;
 	sessionStarted = true;
 	updateCache(true);
+	checkKeyInputs();
+	endBroadcastBatch();
 	return ret;
 }
 
@@ -76,14 +105,20 @@ int __fastcall CBattle_OnProcess(SokuLib::Battle *This) {
 	// super
 	int ret = (This->*s_origCBattle_Process)();
 
+	HookTimer timer{HOOK_BATTLE};
+
+	beginBroadcastBatch();
 	if (!gameStarted)
 		broadcastOpcode(GAME_STARTED, "null");
 	if (!sessionStarted)
 		broadcastOpcode(SESSION_STARTED, "null");
 	gameStarted = true;
 	sessionStarted = true;
-	if (SokuLib::mainMode == SokuLib::BATTLE_MODE_VSPLAYER)
+	if (SokuLib::mainMode == SokuLib::BATTLE_MODE_VSPLAYER) {
 		updateCache(false);
+		checkKeyInputs();
+	}
+	endBroadcastBatch();
 	return ret;
 }
 
@@ -102,6 +137,8 @@ int __fastcall CLoading_OnProcess(SokuLib::Loading *This) {
 	// super
 	int ret = (This->*s_origCLoading_Process)();
 
+	HookTimer timer{HOOK_LOADING};
+
 	loadCommon();
 	return ret;
 }
@@ -110,6 +147,8 @@ int __fastcall CLoadingWatch_OnProcess(SokuLib::LoadingWatch *This) {
 	// super
 	int ret = (This->*s_origCLoadingWatch_Process)();
 
+	HookTimer timer{HOOK_LOADING_WATCH};
+
 	loadCommon();
 	return ret;
 }
@@ -118,6 +157,8 @@ int __fastcall CBattleManager_KO(SokuLib::BattleManager *This) {
 	// super
 	int ret = (This->*s_origCBattleManager_KO)();
 
+	HookTimer timer{HOOK_KO};
+
 	onKO();
 	return ret;
 }
@@ -126,6 +167,8 @@ int __fastcall CBattleManager_Start(SokuLib::BattleManager *This) {
 	// super
 	int ret = (This->*s_origCBattleManager_Start)();
 
+	HookTimer timer{HOOK_ROUND_START};
+
 	onRoundStart();
 	return ret;
 }
@@ -135,9 +178,9 @@ void loadSoku2CSV(LPWSTR path)
 	std::ifstream stream{path};
 	std::string line;
 
-	printf("Loading character CSV from %S\n", path);
+	LOG_INFO("Loading character CSV from %S", path);
 	if (stream.fail()) {
-		printf("%S: %s\n", path, strerror(errno));
+		LOG_ERROR("%S: %s", path, strerror(errno));
 		return;
 	}
 	while (std::getline(stream, line)) {
@@ -149,13 +192,13 @@ void loadSoku2CSV(LPWSTR path)
 		std::getline(str, idStr, ';');
 		std::getline(str, stuff, '\n');
 		if (str.fail()) {
-			printf("Skipping line %s: Stream failed\n", line.c_str());
+			LOG_WARNING("Skipping line %s: Stream failed", line.c_str());
 			continue;
 		}
 		try {
 			id = std::stoi(idStr);
 		} catch (...){
-			printf("Skipping line %s: Invalid id\n", line.c_str());
+			LOG_WARNING("Skipping line %s: Invalid id", line.c_str());
 			continue;
 		}
 		availableCharacters.push_back(id);
@@ -164,7 +207,7 @@ void loadSoku2CSV(LPWSTR path)
 
 void loadSoku2Config()
 {
-	puts("Looking for Soku2 config...");
+	LOG_INFO("Looking for Soku2 config...");
 
 	int argc;
 	wchar_t app_path[MAX_PATH];
@@ -185,7 +228,7 @@ void loadSoku2Config()
 			LocalFree(arg_list);
 		}
 	}
-	printf("Config file is %S\n", setting_path);
+	LOG_INFO("Config file is %S", setting_path);
 
 	wchar_t moduleKeys[1024];
 	wchar_t moduleValue[MAX_PATH];
@@ -197,7 +240,7 @@ void loadSoku2Config()
 
 		wchar_t *filename = wcsrchr(moduleValue, '/');
 
-		printf("Check %S\n", moduleValue);
+		LOG_DEBUG("Check %S", moduleValue);
 		if (!filename)
 			filename = app_path;
 		else
@@ -212,7 +255,7 @@ void loadSoku2Config()
 		while (auto result = wcschr(module_path, '/'))
 			*result = '\\';
 		PathRemoveFileSpecW(module_path);
-		printf("Found Soku2 module folder at %S\n", module_path);
+		LOG_INFO("Found Soku2 module folder at %S", module_path);
 		PathAppendW(module_path, L"\\config\\info");
 		wcscpy(soku2Path, module_path);
 		PathAppendW(module_path, L"characters.csv");
@@ -221,6 +264,65 @@ void loadSoku2Config()
 	}
 }
 
+void loadAggregatorConfig()
+{
+	char setupKeys[4096];
+	char setupValue[1024];
+
+	if (!GetPrivateProfileIntA("Aggregator", "Enabled", 0, profilePath))
+		return;
+	LOG_INFO("Create aggregator");
+	aggregator = std::make_unique<Aggregator>(
+		*webServer,
+		GetPrivateProfileIntA("Aggregator", "QueueSize", 64, profilePath),
+		GetPrivateProfileIntA("Aggregator", "ReconnectDelay", 5000, profilePath)
+	);
+	GetPrivateProfileStringA("Setups", nullptr, nullptr, setupKeys, sizeof(setupKeys), profilePath);
+	for (char *key = setupKeys; *key; key += strlen(key) + 1) {
+		GetPrivateProfileStringA("Setups", key, "", setupValue, sizeof(setupValue), profilePath);
+
+		char *sep = strrchr(setupValue, ':');
+
+		if (!sep) {
+			LOG_WARNING("Skipping setup %s: %s is not in the form host:port", key, setupValue);
+			continue;
+		}
+		*sep = 0;
+		aggregator->addUpstream(key, setupValue, atoi(sep + 1));
+	}
+	aggregator->start();
+}
+
+void loadTimelineConfig()
+{
+	char path[1024 + MAX_PATH];
+
+	if (!GetPrivateProfileIntA("Timeline", "Enabled", 0, profilePath))
+		return;
+	GetPrivateProfileStringA("Timeline", "Path", "", path, sizeof(path), profilePath);
+	if (!*path) {
+		strcpy(path, parentPath);
+		PathAppend(path, "timeline.bin");
+	}
+	LOG_INFO("Create timeline");
+	timeline = std::make_unique<Timeline>(path, GetPrivateProfileIntA("Timeline", "WindowSize", 1024 * 1024, profilePath));
+}
+
+void loadLogConfig()
+{
+	char level[16];
+	char path[1024 + MAX_PATH];
+
+	GetPrivateProfileStringA("Log", "Level", "Info", level, sizeof(level), profilePath);
+	GetPrivateProfileStringA("Log", "Path", "", path, sizeof(path), profilePath);
+	Logger::level = Logger::parseLevel(level);
+	Logger::start(
+		path,
+		GetPrivateProfileIntA("Log", "MaxSize", 10 * 1024 * 1024, profilePath),
+		GetPrivateProfileIntA("Log", "MaxFiles", 3, profilePath)
+	);
+}
+
 // �ݒ胍�[�h
 void LoadSettings() {
 #ifdef _DEBUG
@@ -229,6 +331,7 @@ void LoadSettings() {
 	AllocConsole();
 	freopen_s(&_, "CONOUT$", "w", stdout);
 #endif
+	loadLogConfig();
 	port = GetPrivateProfileInt("Server", "Port", 80, profilePath);
 	keys[KEY_DECREASE_L_SCORE] = GetPrivateProfileInt("Keys", "DecreaseLeftScore", '1', profilePath);
 	keys[KEY_INCREASE_L_SCORE] = GetPrivateProfileInt("Keys", "IncreaseLeftScore", '2', profilePath);
@@ -240,9 +343,12 @@ void LoadSettings() {
 	keys[KEY_INCREASE_R_SCORE] = GetPrivateProfileInt("Keys", "IncreaseRightScore", '9', profilePath);
 	keys[KEY_CHANGE_R_NAME] = GetPrivateProfileInt("Keys", "ChangeRightName", '0', profilePath);
 
-	puts("Create webserver");
+	LOG_INFO("Create webserver");
 	loadSoku2Config();
 
+	timestampMessages = GetPrivateProfileIntA("Server", "Timestamps", 0, profilePath);
+	traceMessages = GetPrivateProfileIntA("Server", "Trace", 0, profilePath);
+	stallBudget = GetPrivateProfileIntA("Server", "StallBudget", 1000, profilePath) * 1000LL;
 	webServer = std::make_unique<WebServer>(GetPrivateProfileIntA("Server", "Cache", 0, profilePath));
 	webServer->addRoute("^/$", root);
 	webServer->addRoute("^/state$", state);
@@ -251,9 +357,23 @@ void LoadSettings() {
 	webServer->addRoute("^/charName/\\d+$", getCharName);
 	webServer->addRoute("^/internal(/.*)?$", loadInternalAsset);
 	webServer->addRoute("^/skillSheet/\\d+$", loadSkillSheet);
+	webServer->addRoute("^/setups$", setups);
+	webServer->addRoute("^/setups/[^/]+/state$", setupState);
+	webServer->addRoute("^/history$", history);
+	webServer->addRoute("^/history/\\d+$", matchHistory);
+	webServer->addRoute("^/metrics$", metrics);
+	webServer->addRoute("^/debug/stalls$", stalls);
+	webServer->addRoute("^/debug/trace$", trace, true);
+	webServer->addRoute("^/debug/memory$", memory);
 	webServer->addStaticFolder("/static", std::string(parentPath) + "/static", true);
 	webServer->start(port);
 	webServer->onWebSocketConnect(onNewWebSocket);
+	webServer->onWebSocketMessage(onWebSocketMessage);
+	webServer->onWebSocketClose(onWebSocketClose);
+	loadTimelineConfig();
+	battleSource = std::make_unique<GameSource>();
+	startStateWorker();
+	loadAggregatorConfig();
 }
 
 void hookFunctions() {
@@ -286,7 +406,7 @@ extern "C" __declspec(dllexport) bool Initialize(HMODULE hMyModule, HMODULE hPar
 		PathAppend(profilePath, "SokuStreaming.ini");
 		LoadSettings();
 
-		puts("Hook functions");
+		LOG_INFO("Hook functions");
 		hookFunctions();
 	} catch (std::exception &e) {
 		MessageBoxA(nullptr, e.what(), "Cannot init SokuStreaming", MB_OK | MB_ICONERROR);
@@ -295,13 +415,18 @@ extern "C" __declspec(dllexport) bool Initialize(HMODULE hMyModule, HMODULE hPar
 		MessageBoxA(nullptr, "Wtf ?", "Huh... ok", MB_OK | MB_ICONERROR);
 		abort();
 	}
-	puts("Initialize ended");
+	LOG_INFO("Initialize ended");
 	return true;
 }
 
 extern "C" int APIENTRY DllMain(HMODULE hModule, DWORD fdwReason, LPVOID lpReserved)
 {
-	if(fdwReason == DLL_PROCESS_DETACH)
+	if(fdwReason == DLL_PROCESS_DETACH) {
+		aggregator.reset();
+		stopStateWorker();
 		webServer.reset();
+		timeline.reset();
+		Logger::stop();
+	}
 	return TRUE;
 }
\ No newline at end of file
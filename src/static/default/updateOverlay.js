@@ -12,6 +12,7 @@ let Opcodes = {
     "R_NAME_UPDATE":  7,
     "L_STATS_UPDATE": 8,
     "R_STATS_UPDATE": 9,
+    "STATE_DELTA":    16,
 }
 let standsOverride = [];
 
@@ -301,9 +302,50 @@ function updateRightName(newName)
     global_state.right.name = newName;
 }
 
-function handleWebSocketMsg(event)
+async function applyDelta(patch)
+{
+    if (!checkState())
+        return;
+
+    let decks = { left: false, right: false };
+    let stats = { left: false, right: false };
+
+    for (let op of patch) {
+        let path = op.path.split('/').slice(1);
+        let obj = global_state;
+
+        for (let i = 0; i < path.length - 1; i++)
+            obj = obj[path[i]];
+        obj[path[path.length - 1]] = op.value;
+        if (path[1] === "stats")
+            stats[path[0]] = true;
+        else
+            decks[path[0]] = true;
+    }
+    if (decks.left)
+        await displayDeck("lCard", global_state.left.used,  global_state.left.hand,  global_state.left.deck,  global_state.left.character);
+    if (decks.right)
+        await displayDeck("rCard", global_state.right.used, global_state.right.hand, global_state.right.deck, global_state.right.character);
+    if (stats.left)
+        displayStats(global_state.left.character, "l", global_state.left.stats);
+    if (stats.right)
+        displayStats(global_state.right.character, "r", global_state.right.stats);
+}
+
+async function handleWebSocketMsg(event)
 {
     let json = JSON.parse(event.data);
+
+    if (Array.isArray(json)) {
+        for (let elem of json)
+            await handleEvent(elem);
+        return;
+    }
+    return handleEvent(json);
+}
+
+function handleEvent(json)
+{
     let data = json.d;
 
     console.log(json);
@@ -328,6 +370,8 @@ function handleWebSocketMsg(event)
         return updateLeftStats(data);
     case Opcodes.R_STATS_UPDATE:
         return updateRightStats(data);
+    case Opcodes.STATE_DELTA:
+        return applyDelta(data);
     }
 }
 
@@ -338,6 +382,7 @@ async function initWebSocket() {
 
     let sock = new WebSocket(url);
 
+    sock.onopen = () => sock.send(JSON.stringify({ deltas: true }));
     sock.onmessage = handleWebSocketMsg;
     sock.onclose = (e) => {
         console.warn(e);
@@ -0,0 +1,398 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "Network/WebSocket.hpp"
+#include "Exceptions.hpp"
+
+#ifdef _WIN32
+#define SHUT_RDWR 2
+#endif
+
+struct Options {
+	std::string host = "127.0.0.1";
+	//! The host, resolved once for all the subscribers.
+	unsigned ip = 0;
+	unsigned short port = 8080;
+	unsigned subscribers = 10;
+	unsigned fetchers = 2;
+	std::vector<std::string> paths;
+	unsigned duration = 10;
+	std::string output;
+	bool ack = false;
+};
+
+//! @brief A /chat client, only touched by its own thread until it is joined.
+struct Subscriber {
+	WebSocket socket;
+	//! The socket once connected, for the main thread to wake the subscriber up.
+	std::atomic<SOCKET> fd{INVALID_SOCKET};
+	std::thread thread;
+	bool connected = false;
+	std::string error;
+	double connectTime = 0;
+	std::vector<double> interArrival;
+	std::vector<double> latency;
+	unsigned long long messages = 0;
+	unsigned long long events = 0;
+	unsigned long long bytes = 0;
+};
+
+struct PathStats {
+	unsigned long long requests = 0;
+	unsigned long long bytes = 0;
+	//! Number of answers for each status code, 0 when the request didn't get an answer.
+	std::map<int, unsigned long long> codes;
+	std::map<std::string, unsigned long long> errors;
+	std::vector<double> latency;
+};
+
+struct Fetcher {
+	std::thread thread;
+	std::map<std::string, PathStats> paths;
+};
+
+static std::atomic<bool> running{true};
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options]\n", name);
+	puts("Connects websocket subscribers and asset fetchers to a local instance and reports how it held up.");
+	puts("  --host <host>          Host of the instance (default 127.0.0.1)");
+	puts("  --port <port>          Port of the instance (default 8080)");
+	puts("  --subscribers <n>      Number of /chat subscribers (default 10)");
+	puts("  --fetchers <n>         Number of threads fetching the paths in a loop (default 2)");
+	puts("  --path <path>          Path fetched by the fetchers, can be given several times (default /state and /static/html/overlay.html)");
+	puts("  --duration <seconds>   Time to keep the load up (default 10)");
+	puts("  --output <file>        Write the report to a file instead of the standard output");
+	puts("  --ack                  Acknowledge the traced messages, for the server to measure the round trip time");
+	puts("The broadcast latency is only measured when the server adds timestamps to the messages (Timestamps in the [Server] section of the ini, --timestamps for ReplayDriver).");
+}
+
+static bool parseOptions(int argc, char **argv, Options &options)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto next = [&]() -> const char * {
+			if (i + 1 >= argc)
+				throw std::invalid_argument(arg + " needs a value");
+			return argv[++i];
+		};
+
+		if (arg == "--host")
+			options.host = next();
+		else if (arg == "--port")
+			options.port = std::stoul(next());
+		else if (arg == "--subscribers")
+			options.subscribers = std::stoul(next());
+		else if (arg == "--fetchers")
+			options.fetchers = std::stoul(next());
+		else if (arg == "--path")
+			options.paths.emplace_back(next());
+		else if (arg == "--duration")
+			options.duration = std::stoul(next());
+		else if (arg == "--output")
+			options.output = next();
+		else if (arg == "--ack")
+			options.ack = true;
+		else
+			return false;
+	}
+	if (options.paths.empty())
+		options.paths = {"/state", "/static/html/overlay.html"};
+	return true;
+}
+
+static double toMs(std::chrono::steady_clock::duration duration)
+{
+	return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+static nlohmann::json summarize(std::vector<double> &samples)
+{
+	if (samples.empty())
+		return nullptr;
+	std::sort(samples.begin(), samples.end());
+
+	double sum = 0;
+	auto percentile = [&samples](double p){
+		return samples[(std::min)(samples.size() - 1, static_cast<size_t>(p * samples.size()))];
+	};
+
+	for (auto sample : samples)
+		sum += sample;
+	return {
+		{"count", samples.size()},
+		{"min",   samples.front()},
+		{"mean",  sum / samples.size()},
+		{"p50",   percentile(0.5)},
+		{"p99",   percentile(0.99)},
+		{"p999",  percentile(0.999)},
+		{"max",   samples.back()}
+	};
+}
+
+static void subscribe(const Options &options, Subscriber &subscriber)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	try {
+		subscriber.socket.connect(options.ip, options.port, options.host);
+	} catch (std::exception &e) {
+		subscriber.error = e.what();
+		return;
+	}
+	subscriber.fd = subscriber.socket.getSockFd();
+	subscriber.connectTime = toMs(std::chrono::steady_clock::now() - start);
+	subscriber.connected = true;
+
+	auto last = std::chrono::steady_clock::now();
+
+	while (running) {
+		std::string msg;
+
+		try {
+			msg = subscriber.socket.getAnswer();
+		} catch (std::exception &e) {
+			// The socket is shut down once the test is over
+			if (running)
+				subscriber.error = e.what();
+			return;
+		}
+
+		auto received = std::chrono::steady_clock::now();
+		// The server timestamps are wall clock times, which is fine as long as it runs on the same machine.
+		auto now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		auto json = nlohmann::json::parse(msg, nullptr, false);
+		auto addEvent = [&](const nlohmann::json &event){
+			subscriber.events++;
+			if (!event.is_object())
+				return;
+
+			auto it = event.find("t");
+
+			if (it != event.end() && it->is_number())
+				subscriber.latency.push_back((now - it->get<long long>()) / 1000.);
+			it = event.find("ts");
+			if (options.ack && it != event.end() && it->is_number())
+				try {
+					subscriber.socket.send(nlohmann::json{{"ack", *it}}.dump());
+				} catch (std::exception &) {
+					// The next read fails the same way and reports it
+				}
+		};
+
+		if (subscriber.messages)
+			subscriber.interArrival.push_back(toMs(received - last));
+		last = received;
+		subscriber.messages++;
+		subscriber.bytes += msg.size();
+		if (json.is_array())
+			for (auto &event : json)
+				addEvent(event);
+		else
+			addEvent(json);
+	}
+}
+
+static void fetch(const Options &options, Fetcher &fetcher, unsigned offset)
+{
+	// Each fetcher starts on a different path so they are all loaded from the start
+	for (unsigned i = offset; running; i++) {
+		auto &path = options.paths[i % options.paths.size()];
+		auto &stats = fetcher.paths[path];
+		Socket socket;
+		Socket::HttpRequest request;
+		auto start = std::chrono::steady_clock::now();
+		int code = 0;
+
+		request.method = "GET";
+		request.httpVer = "HTTP/1.1";
+		request.host = options.host;
+		request.portno = options.port;
+		request.path = path;
+		try {
+			auto response = socket.makeHttpRequest(request);
+
+			code = response.returnCode;
+			stats.bytes += response.body.size();
+		} catch (HTTPErrorException &e) {
+			code = e.getResponse().returnCode;
+		} catch (std::exception &e) {
+			stats.errors[e.what()]++;
+		}
+		stats.latency.push_back(toMs(std::chrono::steady_clock::now() - start));
+		stats.requests++;
+		stats.codes[code]++;
+	}
+}
+
+static nlohmann::json subscribersReport(std::vector<std::unique_ptr<Subscriber>> &subscribers, double seconds)
+{
+	std::vector<double> connectTimes;
+	std::vector<double> interArrival;
+	std::vector<double> latency;
+	std::map<std::string, unsigned> errors;
+	unsigned long long messages = 0;
+	unsigned long long events = 0;
+	unsigned long long bytes = 0;
+	unsigned connected = 0;
+
+	for (auto &subscriber : subscribers) {
+		if (subscriber->connected) {
+			connected++;
+			connectTimes.push_back(subscriber->connectTime);
+		}
+		if (!subscriber->error.empty())
+			errors[subscriber->error]++;
+		interArrival.insert(interArrival.end(), subscriber->interArrival.begin(), subscriber->interArrival.end());
+		latency.insert(latency.end(), subscriber->latency.begin(), subscriber->latency.end());
+		messages += subscriber->messages;
+		events += subscriber->events;
+		bytes += subscriber->bytes;
+	}
+	return {
+		{"count",             subscribers.size()},
+		{"connected",         connected},
+		{"errors",            errors},
+		{"connectMs",         summarize(connectTimes)},
+		{"interArrivalMs",    summarize(interArrival)},
+		{"latencyMs",         summarize(latency)},
+		{"messages",          messages},
+		{"events",            events},
+		{"bytes",             bytes},
+		{"messagesPerSecond", messages / seconds},
+		{"bytesPerSecond",    bytes / seconds}
+	};
+}
+
+static nlohmann::json fetchersReport(std::vector<std::unique_ptr<Fetcher>> &fetchers, double seconds)
+{
+	std::map<std::string, PathStats> merged;
+	nlohmann::json paths = nlohmann::json::object();
+	unsigned long long requests = 0;
+	unsigned long long bytes = 0;
+
+	for (auto &fetcher : fetchers)
+		for (auto &entry : fetcher->paths) {
+			auto &stats = merged[entry.first];
+
+			stats.requests += entry.second.requests;
+			stats.bytes += entry.second.bytes;
+			for (auto &code : entry.second.codes)
+				stats.codes[code.first] += code.second;
+			for (auto &error : entry.second.errors)
+				stats.errors[error.first] += error.second;
+			stats.latency.insert(stats.latency.end(), entry.second.latency.begin(), entry.second.latency.end());
+		}
+	for (auto &entry : merged) {
+		nlohmann::json codes = nlohmann::json::object();
+
+		for (auto &code : entry.second.codes)
+			codes[code.first ? std::to_string(code.first) : "failed"] = code.second;
+		paths[entry.first] = {
+			{"requests",  entry.second.requests},
+			{"codes",     codes},
+			{"errors",    entry.second.errors},
+			{"bytes",     entry.second.bytes},
+			{"latencyMs", summarize(entry.second.latency)}
+		};
+		requests += entry.second.requests;
+		bytes += entry.second.bytes;
+	}
+	return {
+		{"count",             fetchers.size()},
+		{"requests",          requests},
+		{"bytes",             bytes},
+		{"requestsPerSecond", requests / seconds},
+		{"bytesPerSecond",    bytes / seconds},
+		{"paths",             paths}
+	};
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+
+	try {
+		if (!parseOptions(argc, argv, options)) {
+			usage(argv[0]);
+			return 1;
+		}
+		options.ip = Socket::resolve(options.host);
+	} catch (std::exception &e) {
+		printf("%s\n", e.what());
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::vector<std::unique_ptr<Subscriber>> subscribers;
+	std::vector<std::unique_ptr<Fetcher>> fetchers;
+	auto start = std::chrono::steady_clock::now();
+
+	fprintf(stderr, "Loading %s:%u for %u seconds\n", options.host.c_str(), options.port, options.duration);
+	for (unsigned i = 0; i < options.subscribers; i++) {
+		subscribers.emplace_back(new Subscriber());
+
+		auto &subscriber = *subscribers.back();
+
+		subscriber.thread = std::thread([&options, &subscriber]{
+			subscribe(options, subscriber);
+		});
+	}
+	for (unsigned i = 0; i < options.fetchers; i++) {
+		fetchers.emplace_back(new Fetcher());
+
+		auto &fetcher = *fetchers.back();
+
+		fetcher.thread = std::thread([&options, &fetcher, i]{
+			fetch(options, fetcher, i);
+		});
+	}
+	std::this_thread::sleep_for(std::chrono::seconds(options.duration));
+	running = false;
+
+	auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// Wakes up the subscribers waiting for a message
+	for (auto &subscriber : subscribers)
+		if (subscriber->fd != INVALID_SOCKET)
+			shutdown(subscriber->fd, SHUT_RDWR);
+	for (auto &subscriber : subscribers)
+		subscriber->thread.join();
+	for (auto &fetcher : fetchers)
+		fetcher->thread.join();
+
+	auto report = nlohmann::json{
+		{"host",        options.host},
+		{"port",        options.port},
+		{"seconds",     seconds},
+		{"subscribers", subscribersReport(subscribers, seconds)},
+		{"fetchers",    fetchersReport(fetchers, seconds)}
+	}.dump(4);
+
+	if (options.output.empty()) {
+		printf("%s\n", report.c_str());
+		return 0;
+	}
+
+	std::ofstream stream{options.output};
+
+	if (!stream) {
+		printf("Cannot open %s\n", options.output.c_str());
+		return 1;
+	}
+	stream << report << std::endl;
+	return 0;
+}
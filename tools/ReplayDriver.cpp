@@ -0,0 +1,273 @@
+//
+// Created by PinkySmile on 19/10/2026.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Aggregator.hpp"
+#include "HookTimer.hpp"
+#include "Logger.hpp"
+#include "Network/Handlers.hpp"
+#include "ReplaySource.hpp"
+#include "State.hpp"
+#include "Timeline.hpp"
+
+struct Options {
+	unsigned short port = 8080;
+	std::string staticFolder;
+	std::string timelinePath;
+	unsigned match = 0;
+	std::string sessionPath;
+	unsigned seed = 0;
+	unsigned roundFrames = 3600;
+	unsigned games = 1;
+	bool maxSpeed = false;
+	std::string recordPath;
+	unsigned linger = 0;
+	bool timestamps = false;
+	bool trace = false;
+	unsigned stallBudget = 1000;
+	Logger::Level logLevel = Logger::LEVEL_INFO;
+	std::string logPath;
+	std::vector<std::string> upstreams;
+	unsigned queueSize = 64;
+	unsigned reconnectDelay = 5000;
+};
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options]\n", name);
+	puts("Plays games through the state pipeline and serves them like the mod does.");
+	puts("  --port <port>          Port of the web server (default 8080)");
+	puts("  --static <folder>      Serve a folder at /static");
+	puts("  --timeline <file>      Replay a match recorded in a timeline");
+	puts("  --match <id>           Match to replay from the timeline (default 0)");
+	puts("  --session <file>       Replay a session stored as json");
+	puts("  --seed <seed>          Seed of the generated games, when no timeline or session is given (default 0)");
+	puts("  --round-frames <n>     Average length of the generated rounds (default 3600)");
+	puts("  --games <n>            Number of games to play, 0 to play until killed (default 1)");
+	puts("  --max-speed            Play the frames as fast as the state worker applies them instead of 60 per second");
+	puts("  --record <file>        Record the games in a timeline");
+	puts("  --linger <seconds>     Keep serving after the last game (default 0)");
+	puts("  --timestamps           Add the server time to the websocket messages");
+	puts("  --trace                Add the frame and the sampling time to the websocket messages");
+	puts("  --stall-budget <us>    Log the frames taking longer than this, 0 to disable (default 1000)");
+	puts("  --log-level <level>    Lowest level logged: debug, info, warning, error or none (default info)");
+	puts("  --log-file <file>      Also write the log in a file");
+	puts("  --upstream <id=host:port>  Follow another instance as a setup of the aggregator, can be repeated");
+	puts("  --queue-size <n>       Messages the aggregator queues per setup before sending a full state instead (default 64)");
+	puts("  --reconnect-delay <ms> Delay before the aggregator reconnects to a lost setup (default 5000)");
+}
+
+static bool parseOptions(int argc, char **argv, Options &options)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto next = [&]() -> const char * {
+			if (i + 1 >= argc)
+				throw std::invalid_argument(arg + " needs a value");
+			return argv[++i];
+		};
+
+		if (arg == "--port")
+			options.port = std::stoul(next());
+		else if (arg == "--static")
+			options.staticFolder = next();
+		else if (arg == "--timeline")
+			options.timelinePath = next();
+		else if (arg == "--match")
+			options.match = std::stoul(next());
+		else if (arg == "--session")
+			options.sessionPath = next();
+		else if (arg == "--seed")
+			options.seed = std::stoul(next());
+		else if (arg == "--round-frames")
+			options.roundFrames = std::stoul(next());
+		else if (arg == "--games")
+			options.games = std::stoul(next());
+		else if (arg == "--max-speed")
+			options.maxSpeed = true;
+		else if (arg == "--record")
+			options.recordPath = next();
+		else if (arg == "--linger")
+			options.linger = std::stoul(next());
+		else if (arg == "--timestamps")
+			options.timestamps = true;
+		else if (arg == "--trace")
+			options.trace = true;
+		else if (arg == "--stall-budget")
+			options.stallBudget = std::stoul(next());
+		else if (arg == "--log-level")
+			options.logLevel = Logger::parseLevel(next());
+		else if (arg == "--log-file")
+			options.logPath = next();
+		else if (arg == "--upstream")
+			options.upstreams.emplace_back(next());
+		else if (arg == "--queue-size")
+			options.queueSize = std::stoul(next());
+		else if (arg == "--reconnect-delay")
+			options.reconnectDelay = std::stoul(next());
+		else
+			return false;
+	}
+	return true;
+}
+
+static nlohmann::json loadSession(const Options &options, unsigned game)
+{
+	if (!options.timelinePath.empty())
+		return ReplaySource::loadTimeline(options.timelinePath, options.match);
+	if (!options.sessionPath.empty()) {
+		std::ifstream stream{options.sessionPath};
+
+		if (!stream)
+			throw std::invalid_argument("Cannot open " + options.sessionPath);
+		return nlohmann::json::parse(stream);
+	}
+	return ReplaySource::generate(options.seed + game, options.roundFrames);
+}
+
+//! @brief Same as the [Setups] section of the .ini, but from the command line.
+static void startAggregator(const Options &options)
+{
+	aggregator = std::make_unique<Aggregator>(*webServer, options.queueSize, options.reconnectDelay);
+	for (auto &upstream : options.upstreams) {
+		auto equal = upstream.find('=');
+		auto colon = upstream.rfind(':');
+
+		if (equal == std::string::npos || colon == std::string::npos || colon < equal)
+			throw std::invalid_argument(upstream + " is not in the form id=host:port");
+		aggregator->addUpstream(upstream.substr(0, equal), upstream.substr(equal + 1, colon - equal - 1), std::stoul(upstream.substr(colon + 1)));
+	}
+	aggregator->start();
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+
+	try {
+		if (!parseOptions(argc, argv, options)) {
+			usage(argv[0]);
+			return 1;
+		}
+	} catch (std::exception &e) {
+		printf("%s\n", e.what());
+		usage(argv[0]);
+		return 1;
+	}
+
+	Logger::level = options.logLevel;
+	Logger::start(options.logPath);
+
+	auto source = new ReplaySource();
+	unsigned long long frames = 0;
+
+	battleSource.reset(source);
+	try {
+		source->load(loadSession(options, 0));
+		if (!options.recordPath.empty())
+			timeline = std::make_unique<Timeline>(options.recordPath);
+	} catch (std::exception &e) {
+		printf("Cannot load the session: %s\n", e.what());
+		Logger::stop();
+		return 1;
+	}
+
+	timestampMessages = options.timestamps;
+	traceMessages = options.trace;
+	stallBudget = options.stallBudget * 1000LL;
+	webServer = std::make_unique<WebServer>(0);
+	webServer->addRoute("^/state$", state);
+	webServer->addRoute("^/setups$", setups);
+	webServer->addRoute("^/setups/[^/]+/state$", setupState);
+	webServer->addRoute("^/history$", history);
+	webServer->addRoute("^/history/\\d+$", matchHistory);
+	webServer->addRoute("^/metrics$", metrics);
+	webServer->addRoute("^/debug/stalls$", stalls);
+	webServer->addRoute("^/debug/trace$", trace, true);
+	webServer->addRoute("^/debug/memory$", memory);
+	if (!options.staticFolder.empty())
+		webServer->addStaticFolder("/static", std::string(options.staticFolder), true);
+	webServer->onWebSocketConnect(onNewWebSocket);
+	webServer->onWebSocketMessage(onWebSocketMessage);
+	webServer->onWebSocketClose(onWebSocketClose);
+	webServer->start(options.port);
+	if (!options.upstreams.empty())
+		try {
+			startAggregator(options);
+		} catch (std::exception &e) {
+			printf("Cannot start the aggregator: %s\n", e.what());
+			webServer.reset();
+			Logger::stop();
+			return 1;
+		}
+	startStateWorker();
+	fprintf(stderr, "Serving on port %u\n", options.port);
+
+	auto start = std::chrono::steady_clock::now();
+
+	broadcastOpcode(SESSION_STARTED, "null");
+	for (unsigned game = 0; !options.games || game < options.games; game++) {
+		if (game) {
+			// Recorded sessions are played again, generated ones change each game.
+			if (options.timelinePath.empty() && options.sessionPath.empty())
+				source->load(loadSession(options, game));
+			else
+				source->rewind();
+		}
+
+		auto gameStart = std::chrono::steady_clock::now();
+
+		// Same as what the game does when loading a battle
+		needReset = true;
+		needRefresh = true;
+		broadcastOpcode(GAME_STARTED, "null");
+		for (;;) {
+			bool played;
+
+			{
+				// Stands for CBattle_OnProcess
+				HookTimer timer{HOOK_BATTLE};
+
+				beginBroadcastBatch();
+				played = source->step();
+				endBroadcastBatch();
+			}
+
+			if (!played)
+				break;
+			frames++;
+			if (options.maxSpeed)
+				waitStateWorker();
+			else
+				std::this_thread::sleep_until(gameStart + std::chrono::microseconds(1000000ULL * source->getFrame() / 60));
+		}
+		broadcastOpcode(GAME_ENDED, "null");
+	}
+	waitStateWorker();
+
+	auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	broadcastOpcode(SESSION_ENDED, "null");
+	printf("%s\n", nlohmann::json{
+		{"games", options.games},
+		{"frames", frames},
+		{"seconds", elapsed},
+		{"framesPerSecond", frames / elapsed}
+	}.dump().c_str());
+	fflush(stdout);
+	std::this_thread::sleep_for(std::chrono::seconds(options.linger));
+	aggregator.reset();
+	stopStateWorker();
+	webServer.reset();
+	timeline.reset();
+	battleSource.reset();
+	Logger::stop();
+	return 0;
+}